@@ -0,0 +1,319 @@
+#include "edf.h"
+#include "os_internal.h"
+#include "os_internal_def.h"
+#include "stm32f4xx.h"
+#include "roundRobin.h"
+#include "wait.h"
+#include "sleep.h"
+#include "debug.h"
+
+/* This is an implementation of an Earliest-Deadline-First scheduler.
+    Runnable tasks are held in a minimum binary heap ordered by absolute deadline,
+     with the task with the earliest deadline always at the root, in the same
+     manner as sleeping tasks are held in the sleep heap (sleep.c).
+    The running task stays in the heap while it runs, and is removed from it
+     only when it sleeps, waits or exits.
+    Deadlines are compared using sleep_time1IsAfterTime2, so they are unaffected
+     by an overflowing SysTick counter as long as all deadlines are within
+     (31^2 -1) ticks of the current time. */
+
+/*=============================================================================
+**      Static Function Prototypes
+=============================================================================*/
+static OS_TCB_t const * edf_scheduler_callback(void);
+/* Adding and Removing tasks from the OS completely*/
+static void edf_addTask(OS_TCB_t * const tcb);
+static void edf_exitTask(OS_TCB_t * const tcb);
+/* Insert and Removes tasks into and from the heap for sleep and wait mechanisms */
+static void edf_insertTask(OS_TCB_t * const tcb);
+static void edf_removeTask(OS_TCB_t * const tcb);
+static void edf_releaseTask(OS_TCB_t * const tcb, uint32_t release_time);
+/* Wait and notify callbacks, see roundRobin.c */
+static void edf_wait(void * const reason, void * const unavailable_resource_wait_list, uint32_t fail_fast_sequence);
+static OS_TCB_t * edf_notify(void * const available_resource_wait_list);
+static uint32_t edf_tick(void);
+/* Heap maintenance */
+static uint32_t edf_deadlineIsBefore(OS_TCB_t const * const tcb_1, OS_TCB_t const * const tcb_2);
+static void edf_heapSwapElements(uint32_t * element_index_main, uint32_t element_index_sub);
+static void edf_heapUp(uint32_t tcb_index);
+static void edf_heapDown(uint32_t tcb_index);
+
+
+/*=============================================================================
+**      Static Variables
+=============================================================================*/
+/* A binary minimum heap of runnable tasks, with the earliest deadline at the
+    root, sized to hold all tasks in the OS at once. */
+static OS_TCB_t * _edf_heap[MAX_TASKS];
+/* The length of the heap */
+static uint32_t _edf_heap_length = 0;
+/* Number of currently added tasks, see roundRobin.c */
+static uint8_t _tasks_added = 0;
+
+/*=============================================================================
+**      Scheduler Declaration and Instantiation
+=============================================================================*/
+/* Scheduler block for the Earliest-Deadline-First scheduler */
+OS_Scheduler_t const edf_scheduler = {
+	.preemptive = 1,
+	.scheduler_callback = edf_scheduler_callback,
+	.taskAdd_callback = edf_addTask,
+    .taskExit_callback = edf_exitTask,
+    .taskRemove_callback = edf_removeTask,
+	.wait_callback = edf_wait,
+    .notify_callback = edf_notify,
+    .tick_callback = edf_tick
+};
+
+/*=============================================================================
+**      Functions
+=============================================================================*/
+/**
+ * [OS_edfSetDeadline Sets the relative deadline and period of a task.]
+ * @param tcb               [pointer to the OS_TCB_t to set the parameters of]
+ * @param relative_deadline [ticks from each release to the deadline, or 0 for
+ *   EDF_DEFAULT_RELATIVE_DEADLINE]
+ * @param period            [ticks between releases]
+ */
+void OS_edfSetDeadline(OS_TCB_t * tcb, uint32_t relative_deadline, uint32_t period) {
+    /* Deadlines further away than this can not be compared reliably */
+    ASSERT_DEBUG(relative_deadline < HALF_OF_UINT32_T_MAX);
+    tcb->relative_deadline = relative_deadline ? relative_deadline : EDF_DEFAULT_RELATIVE_DEADLINE;
+    tcb->period = period;
+}
+
+/**
+ * [OS_edfWaitNextPeriod Sleeps until the next release of the current task.
+ *  The next release is calculated from the previous one rather than the current
+ *   time, so the releases do not drift with the execution time of the task.]
+ */
+void OS_edfWaitNextPeriod(void) {
+    OS_TCB_t * tcb = OS_currentTCB();
+    uint32_t current_time = OS_elapsedTicks();
+    uint32_t next_release = tcb->deadline - tcb->relative_deadline + tcb->period;
+    ASSERT_DEBUG(tcb->period);
+
+    /* The task is released with a deadline based on its awakening time, which
+        is exactly next_release, even if the task is preempted before sleeping.
+        If the release is already due, sleep for 0 ticks to be released on the
+        next scheduler run. */
+    if (sleep_time1IsAfterTime2(next_release, current_time, current_time + HALF_OF_UINT32_T_MAX)) {
+        _OS_sleepUntil(next_release);
+    } else {
+        OS_sleep(0);
+    }
+}
+
+/**
+ * [edf_scheduler_callback The scheduler call back. Releases any tasks due to be
+ *   awoken and returns the task with the earliest deadline.]
+ * @return  [pointer to the next task to be run]
+ */
+static OS_TCB_t const * edf_scheduler_callback(void) {
+    /* Awoken tasks are released as a new job, with a deadline based on the time
+        they were set to be awoken at (held in the data field). Tasks whose wait
+        for a resource timed out continue their current job instead. */
+    while( sleep_taskNeedsAwakening() ) {
+        OS_TCB_t * tcb = sleep_extract();
+        if (tcb->state & TASK_STATE_TIMEOUT) {
+            edf_insertTask(tcb);
+        } else {
+            edf_releaseTask(tcb, tcb->data);
+        }
+    }
+
+    /* Yielding has no effect as the earliest deadline is always run */
+    OS_currentTCB()->state &= ~TASK_STATE_YIELD;
+
+    /* No tasks active; return the idle task */
+    if (_edf_heap_length == 0) {
+        return OS_idleTCB_p;
+    }
+    return _edf_heap[0];
+}
+
+/**
+ * [edf_addTask Initially adds a task to the runnable tasks, releasing its first job]
+ * @param tcb [pointer to the tcb to add]
+ */
+static void edf_addTask(OS_TCB_t * const tcb) {
+    /* Make sure not too many tasks are added, see roundRobin_addTask */
+    if(_tasks_added >= MAX_TASKS) {
+        ASSERT_DEBUG(0);
+        return;
+    }
+    if (tcb->relative_deadline == 0) {
+        tcb->relative_deadline = EDF_DEFAULT_RELATIVE_DEADLINE;
+    }
+    edf_releaseTask(tcb, OS_elapsedTicks());
+    _tasks_added++;
+}
+
+/**
+ * [edf_exitTask Removes a task completely when it has finished running.]
+ * @param tcb [pointer to task to remove]
+ */
+static void edf_exitTask(OS_TCB_t * const tcb) {
+    edf_removeTask(tcb);
+    _tasks_added--;
+}
+
+/**
+ * [edf_releaseTask Releases a new job of a task, setting its absolute deadline
+ *   from the release time, and makes it runnable.]
+ * @param tcb          [pointer to the TCB to release]
+ * @param release_time [the time (in ticks) of the release]
+ */
+static void edf_releaseTask(OS_TCB_t * const tcb, uint32_t release_time) {
+    tcb->deadline = release_time + tcb->relative_deadline;
+    edf_insertTask(tcb);
+}
+
+/**
+ * [edf_insertTask Inserts a task into the heap of runnable tasks.]
+ * @param tcb [pointer to the TCB to insert]
+ */
+static void edf_insertTask(OS_TCB_t * const tcb) {
+    _edf_heap[_edf_heap_length++] = tcb;
+    edf_heapUp(_edf_heap_length - 1);
+}
+
+/**
+ * [edf_removeTask Removes a task from the heap of runnable tasks, ie when it
+ *   goes to wait or sleep.
+ *  The removed task is usually the running task at the root, but a task with an
+ *   earlier deadline may have been inserted since it was scheduled, so it is
+ *   searched for in the (at most MAX_TASKS) heap elements.]
+ * @param tcb [pointer to the TCB to remove]
+ */
+static void edf_removeTask(OS_TCB_t * const tcb) {
+    uint32_t tcb_index = 0;
+    while (tcb_index < _edf_heap_length && _edf_heap[tcb_index] != tcb) {
+        tcb_index++;
+    }
+    if (tcb_index == _edf_heap_length) {
+        ASSERT_DEBUG(0);
+        return;
+    }
+
+    /* Move the last element into the gap, and restore the heap order around it,
+        which could be either up or down */
+    _edf_heap[tcb_index] = _edf_heap[--_edf_heap_length];
+    if (tcb_index < _edf_heap_length) {
+        edf_heapUp(tcb_index);
+        edf_heapDown(tcb_index);
+    }
+}
+
+/**
+ * [edf_wait Sets a task to wait for a resource as long as the fail-fast sequence
+ *  of the resource has not been incremented. Then schedules a task switch. See roundRobin_wait.]
+ * @param unavailable_resource                 [the semaphore or mutex that is unavialable]
+ * @param unavailable_resource_wait_list  [the OS_WaitList_t of the resource]
+ * @param fail_fast_sequence                   [the fail fast check code]
+ */
+static void edf_wait(void * const unavailable_resource, void * const unavailable_resource_wait_list, uint32_t fail_fast_sequence) {
+    if (fail_fast_sequence == ((OS_WaitList_t *)unavailable_resource_wait_list)->sequence) {
+        edf_removeTask(OS_currentTCB());
+        wait_queueInsert( (OS_WaitQueue_t **)&((OS_WaitList_t *)unavailable_resource_wait_list)->queue, OS_currentTCB());
+        SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+    }
+}
+
+/**
+ * [edf_notify Notify a task of available resource, continuing its current job.
+ *  A task switch is scheduled straight away if the notified task has an earlier
+ *   deadline than the current task.]
+ * @param available_resource_wait_list  [the OS_WaitList_t to be notified.]
+ * @return                              [the notified task, or 0 if none was waiting]
+ */
+static OS_TCB_t * edf_notify(void * const available_resource_wait_list) {
+    OS_TCB_t * waiting_task = wait_queueExtract( (OS_WaitQueue_t **)&((OS_WaitList_t *)available_resource_wait_list)->queue );
+    if (waiting_task != 0) {
+        edf_insertTask(waiting_task);
+        if (_edf_heap[0] != OS_currentTCB()) {
+            SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+        }
+    }
+    return waiting_task;
+}
+
+/**
+ * [edf_tick The tick callback. Tasks are only released by being awoken, which
+ *   the SysTick handler checks for itself, so the scheduler only needs to run if
+ *   the task with the earliest deadline is not already running.]
+ * @return [1 if the scheduler needs to run, 0 otherwise]
+ */
+static uint32_t edf_tick(void) {
+    if (_edf_heap_length == 0) {
+        return 0;
+    }
+    return _edf_heap[0] != OS_currentTCB();
+}
+
+/**
+ * [edf_deadlineIsBefore Compares the absolute deadlines of two tasks.]
+ * @param  tcb_1 [the task to check if has the earlier deadline]
+ * @param  tcb_2 [the task to compare against]
+ * @return       [1 if tcb_1 has a strictly earlier deadline than tcb_2, 0 otherwise]
+ */
+static uint32_t edf_deadlineIsBefore(OS_TCB_t const * const tcb_1, OS_TCB_t const * const tcb_2) {
+    uint32_t current_time = OS_elapsedTicks();
+    return sleep_time1IsAfterTime2(tcb_2->deadline, tcb_1->deadline, current_time + HALF_OF_UINT32_T_MAX);
+}
+
+/**
+ * [edf_heapSwapElements Swaps two elements in the heap. NOTE: Only the Main
+ *   element index will be updated. See sleep_heapSwapElements.]
+ * @param element_index_main [pointer to Heap Index of Main Element]
+ * @param element_index_sub  [heap Index of Sub Element]
+ */
+static void edf_heapSwapElements(uint32_t * element_index_main, uint32_t element_index_sub) {
+    OS_TCB_t * tmp_tcb = _edf_heap[element_index_sub];
+    _edf_heap[element_index_sub] = _edf_heap[*element_index_main];
+    _edf_heap[*element_index_main] = tmp_tcb;
+    *element_index_main = element_index_sub;
+}
+
+/**
+ * [edf_heapUp Moves an element up the heap until its parent has an earlier
+ *   or equal deadline.]
+ * @param tcb_index [heap index of the element to move]
+ */
+static void edf_heapUp(uint32_t tcb_index) {
+    uint32_t parent_tcb_index;
+    while (tcb_index > 0) {
+        parent_tcb_index = (tcb_index - 1) / 2;
+        if (!edf_deadlineIsBefore(_edf_heap[tcb_index], _edf_heap[parent_tcb_index])) {
+            return;
+        }
+        edf_heapSwapElements(&tcb_index, parent_tcb_index);
+    }
+}
+
+/**
+ * [edf_heapDown Moves an element down the heap until both its children have a
+ *   later or equal deadline.]
+ * @param tcb_index [heap index of the element to move]
+ */
+static void edf_heapDown(uint32_t tcb_index) {
+    uint32_t child_tcb_index, earliest_tcb_index;
+    while (1) {
+        earliest_tcb_index = tcb_index;
+        child_tcb_index = (2 * tcb_index) + 1;
+        /* Find the earliest deadline out of the element and its up to two children */
+        if (child_tcb_index < _edf_heap_length
+                && edf_deadlineIsBefore(_edf_heap[child_tcb_index], _edf_heap[earliest_tcb_index])) {
+            earliest_tcb_index = child_tcb_index;
+        }
+        child_tcb_index++;
+        if (child_tcb_index < _edf_heap_length
+                && edf_deadlineIsBefore(_edf_heap[child_tcb_index], _edf_heap[earliest_tcb_index])) {
+            earliest_tcb_index = child_tcb_index;
+        }
+        if (earliest_tcb_index == tcb_index) {
+            return;
+        }
+        edf_heapSwapElements(&tcb_index, earliest_tcb_index);
+    }
+}
@@ -0,0 +1,75 @@
+#ifndef _EDF_H_
+#define _EDF_H_
+
+#include "os.h"
+
+/*=============================================================================
+ *  This is an implementation of a preemptive Earliest-Deadline-First (EDF)
+ *   scheduler, an alternative to the fixed priority round_robin_scheduler.
+ *  The runnable task with the earliest absolute deadline is always run,
+ *   which allows periodic tasks to be scheduled up to 100% CPU utilisation.
+ *  A task's job is released (given a new absolute deadline of the release time
+ *   plus its relative deadline) when it is added and when it is awoken from
+ *   sleep. Waking from waiting for a resource continues the same job.
+ *  Task priorities are not used for scheduling, but still order the tasks
+ *   waiting for a resource.
+===============================================================================
+**       Example Use
+*******************************************************************************
+OS_initialiseTCB(&tcb_control, stack_control + 64, task_control, 1, NULL);
+OS_edfSetDeadline(&tcb_control, 5, 10);
+OS_init(&edf_scheduler);
+OS_addTask(&tcb_control);
+...
+void task_control(void const * const args) {
+    while (1) {
+        // Do the periodic work
+        OS_edfWaitNextPeriod();
+    }
+}
+=============================================================================*/
+
+/*=============================================================================
+**       Global Scheduler Declaration
+=============================================================================*/
+/* The global EDF scheduler, which can be used instead of round_robin_scheduler */
+extern OS_Scheduler_t const edf_scheduler;
+
+/*=============================================================================
+**       Definitions
+=============================================================================*/
+/*****************************************************************************
+**      USER MODIFIABLE CONFIGURATION - START
+******************************************************************************/
+/*  The relative deadline (in ticks) given to tasks that have not been given one
+     using OS_edfSetDeadline, making them run in the background of tasks with
+     shorter deadlines. Must be less than 2^31. */
+#define EDF_DEFAULT_RELATIVE_DEADLINE 0x10000000UL
+/*****************************************************************************
+**      USER MODIFIABLE CONFIGURATION - END
+******************************************************************************/
+
+
+/*=============================================================================
+**       Function Prototypes
+=============================================================================*/
+/**
+ * [OS_edfSetDeadline Sets the relative deadline and period of a task. Must be
+ *   called after OS_initialiseTCB and before the task is added to the OS.]
+ * @param tcb               [pointer to the OS_TCB_t to set the parameters of]
+ * @param relative_deadline [ticks from the release of each job until its
+ *   deadline. 0 uses EDF_DEFAULT_RELATIVE_DEADLINE.]
+ * @param period            [ticks between the releases of consecutive jobs,
+ *   used by OS_edfWaitNextPeriod]
+ */
+void OS_edfSetDeadline(OS_TCB_t * tcb, uint32_t relative_deadline, uint32_t period);
+
+/**
+ * [OS_edfWaitNextPeriod Ends the current job of a periodic task by sleeping
+ *   until its next release, one period after the release of the current job.
+ *  If the next release has already passed (an overrun), the next job is released
+ *   immediately. Must never be called outside a task.]
+ */
+void OS_edfWaitNextPeriod(void);
+
+#endif /* _EDF_H_ */
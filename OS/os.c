@@ -1,9 +1,12 @@
 #include "os.h"
 #include "os_internal.h"
+#include "os_internal_def.h"
 #include "stm32f4xx.h"
 #include "roundRobin.h"
 #include "mutex.h"
+#include "semaphore.h"
 #include "sleep.h"
+#include "wait.h"
 #include <stdlib.h>
 #include <string.h>
 #include "debug.h"
@@ -24,16 +27,57 @@ OS_TCB_t const * const OS_idleTCB_p = &OS_idleTCB;
 #ifndef DEBUG_HARD 
     /* Total elapsed ticks, will overflow about every 49.71 days ((2^32 -1) / (1000 * 3600 *24)) */
     static volatile uint32_t _ticks = 0;
-    /* Fast-Fail Check Counter to prevent deadlock at failed mutex aquisition when OS wait is called */
-    static volatile uint32_t _fast_fail_counter = 0; 
+    /* Number of ticks on which PendSV was not pended, as the scheduler would not
+        have changed the running task */
+    static volatile uint32_t _pendsv_avoided = 0;
+    /* Number of times tasks tried to wait for a resource, and of those, the number
+        of waits aborted as the resource was notified in between */
+    static volatile uint32_t _wait_count = 0;
+    static volatile uint32_t _wait_aborted = 0;
 #else
     volatile uint32_t _ticks = 0;
-    volatile uint32_t _fast_fail_counter = 0;    
+    volatile uint32_t _pendsv_avoided = 0;
+    volatile uint32_t _wait_count = 0;
+    volatile uint32_t _wait_aborted = 0;
 #endif
 
 /* Pointer to the 'scheduler' struct containing callback pointers */
 static OS_Scheduler_t const * _scheduler = 0;
 
+/* Wait lists with notifications deferred by interrupt handlers, linked through
+    their next_deferred field (see _OS_notifyFromISR) */
+static OS_WaitList_t * volatile _deferred_notify = 0;
+
+#ifdef OS_TICKLESS_IDLE
+/* Number of ticks the currently programmed SysTick period spans, or 0 if the
+    SysTick is firing every tick as normal */
+static volatile uint32_t _tickless_ticks = 0;
+/* SysTick clock cycles in a single tick, and the largest number of ticks that
+    fits in the 24-bit SysTick reload register. Set when the SysTick is enabled. */
+static uint32_t _cycles_per_tick = 0;
+static uint32_t _tickless_max_ticks = 0;
+#endif
+
+/*=============================================================================
+**      Static Function Prototypes
+=============================================================================*/
+static uint32_t os_tickNeedsScheduler(void);
+static void os_notify(OS_WaitList_t * wait_list);
+static void os_waitStart(OS_WaitList_t * wait_list, uint32_t timeout);
+static void os_waitEnd(OS_TCB_t * tcb);
+static void os_sleepStart(uint32_t wake_time);
+static void os_notifyDeferred(void);
+#ifdef OS_TICKLESS_IDLE
+static void os_ticklessEnter(void);
+static void os_ticklessExit(void);
+#endif
+#if MUTEX_PRIORITY_INHERITANCE
+static void os_taskSetPriority(OS_TCB_t * tcb, uint32_t priority);
+static void os_mutexInheritPriority(OS_Mutex_t * mutex, uint32_t priority);
+static void os_mutexRestorePriority(OS_TCB_t * tcb);
+static void os_mutexRemoveContended(OS_TCB_t * tcb, OS_Mutex_t * mutex);
+#endif
+
 /*=============================================================================
 **      Global Internal Variable
 =============================================================================*/
@@ -55,24 +99,68 @@ uint32_t OS_elapsedTicks(void) {
 	return _ticks;
 }
 
-/* Getter for the Fast-Fail Check Counter, incremented with task notifications and
-    utilised to prevent race-conditions when tasks are set to wait 
-    (fail fast behaviour). */
-uint32_t OS_currentFastFailCounter(void) {
-	return _fast_fail_counter;
+/* Getter for the number of ticks on which the scheduler was not run. */
+uint32_t OS_pendSVAvoidedCount(void) {
+	return _pendsv_avoided;
 }
 
-/* IRQ handler for the system tick.  Schedules PendSV */
+/* Getters for the number of times tasks tried to wait for a resource, and the number
+    of those waits that were aborted. */
+uint32_t OS_waitCount(void) {
+	return _wait_count;
+}
+
+uint32_t OS_waitAbortedCount(void) {
+	return _wait_aborted;
+}
+
+/* IRQ handler for the system tick.  Schedules PendSV if the scheduler could
+    change the running task: a sleeping task is due to be awoken, or the scheduler's
+    tick callback (if any) asks for it. Otherwise the tick is counted as avoided.
+    In tickless mode the SysTick may have been programmed to span several ticks
+     while idling, in which case all of them are added and the SysTick is
+     returned to firing every tick. */
 void SysTick_Handler(void) {
+#ifdef OS_TICKLESS_IDLE
+    uint32_t elapsed_cycles, remaining_cycles;
+    if (_tickless_ticks) {
+        /* The SysTick has reloaded with the programmed period and counted on
+            since it fired (longer than the interrupt latency if interrupts were
+            disabled), so the ticks and cycles elapsed since are carried over and
+            the next tick is shortened to keep the tick phase. */
+        elapsed_cycles = SysTick->LOAD - SysTick->VAL;
+        _ticks = _ticks + _tickless_ticks + (elapsed_cycles / _cycles_per_tick);
+        _tickless_ticks = 0;
+        remaining_cycles = _cycles_per_tick - (elapsed_cycles % _cycles_per_tick);
+        if (remaining_cycles == 1) {
+            /* Too short to load, as a LOAD of 0 never fires - the tick boundary is now */
+            _ticks = _ticks + 1;
+            remaining_cycles = _cycles_per_tick;
+        }
+        /* The LOAD is only used when the counter reloads, which clearing the VAL
+            makes it do on the next cycle, so the shortened tick is loaded and
+            the following ticks reload the full tick again */
+        SysTick->LOAD = remaining_cycles - 1;
+        SysTick->VAL = 0;
+        SysTick->LOAD = _cycles_per_tick - 1;
+    } else {
+        _ticks = _ticks + 1;
+    }
+#else
 	_ticks = _ticks + 1;  
-	SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+#endif
+	if (os_tickNeedsScheduler()) {
+		SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+	} else {
+		_pendsv_avoided++;
+	}
 }
 
 /* Sets up the OS by storing a pointer to the structure containing all the callbacks.
    Also establishes the system tick timer and interrupt if preemption is enabled. */
 void OS_init(OS_Scheduler_t const * scheduler) {
 	_scheduler = scheduler;
-    *((uint32_t volatile *)0xE000ED14) |= (1 << 9); // Set STKALIGN
+    SCB->CCR |= SCB_CCR_STKALIGN_Msk; // Set STKALIGN
 	ASSERT_DEBUG(_scheduler->scheduler_callback);
 	ASSERT_DEBUG(_scheduler->taskAdd_callback);
  	ASSERT_DEBUG(_scheduler->taskExit_callback);
@@ -94,13 +182,16 @@ void OS_initialiseTCB(OS_TCB_t * TCB, uint32_t * const stack, void (* const func
     /* Make sure priority is within bounds. User will not be notified, but will cause adverse problems
         if designed to work according to priorities that have been modified.
         Checking for pri>MAX is sufficient due to unsigned. */
-    if (priority >= PRIORITY_MAX) {
+    if (priority > PRIORITY_MAX) {
         ASSERT_DEBUG(0);
         priority = PRIORITY_MAX;
     }   
-    TCB->priority = priority; 
+    TCB->priority = TCB->base_priority = priority;
     TCB->state = TCB->data = 0;
+    TCB->deadline = TCB->relative_deadline = TCB->period = 0;
     TCB->next = TCB->prev = NULL;
+    TCB->waiting_mutex = TCB->contended_mutexes = NULL;
+    TCB->wait_list = NULL;
 	OS_StackFrame_t *sf = (OS_StackFrame_t *)(TCB->sp);
 	memset(sf, 0, sizeof(OS_StackFrame_t));
 	/* By placing the address of the task function in pc, and the address of _OS_taskEnd() in lr, the task
@@ -110,6 +201,28 @@ void OS_initialiseTCB(OS_TCB_t * TCB, uint32_t * const stack, void (* const func
 	sf->pc = (uint32_t)(func);
 	sf->r0 = (uint32_t)(data);
 	sf->psr = 0x01000000;  /* Sets the thumb bit to avoid a big steaming fault */
+	/* Return to thread mode using the PSP with a basic (non-FPU) frame. The CPU
+	   switches to extended frames by itself once the task uses the FPU. */
+	sf->exc_return = EXC_RETURN_THREAD_PSP;
+}
+
+/* Deferred notification from interrupt handlers, see os_internal.h.
+    The notification is counted on the wait list, which is pushed onto the
+    deferred list by the first notification only, so it is never on the list
+    twice. Both are updated with LDREX/STREX, as a higher priority interrupt
+    handler may notify in between. */
+void _OS_notifyFromISR(OS_WaitList_t * resource_wait_list) {
+    uint32_t deferred;
+    do {
+        deferred = __LDREXW(&resource_wait_list->deferred);
+    } while (__STREXW(deferred + 1, &resource_wait_list->deferred) != STREXW_SUCCESSFUL);
+
+    if (deferred == 0) {
+        do {
+            resource_wait_list->next_deferred = (OS_WaitList_t *)__LDREXW((uint32_t *)&_deferred_notify);
+        } while (__STREXW((uint32_t)resource_wait_list, (uint32_t *)&_deferred_notify) != STREXW_SUCCESSFUL);
+    }
+    SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
 }
 
 /*=============================================================================
@@ -130,6 +243,10 @@ void _svc_OS_enableSystick(void) {
 		SystemCoreClockUpdate();
 		SysTick_Config(SystemCoreClock / 1000);
 		NVIC_SetPriority(SysTick_IRQn, 0x10);
+#ifdef OS_TICKLESS_IDLE
+        _cycles_per_tick = SystemCoreClock / 1000;
+        _tickless_max_ticks = (SysTick_LOAD_RELOAD_Msk / _cycles_per_tick) - 1;
+#endif
 	}
 }
 
@@ -138,8 +255,23 @@ void _svc_OS_schedule(void) {
 	SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
 }
 
-/* SVC handler to invoke the scheduler (via a callback) from PendSV */
+/* SVC handler to invoke the scheduler (via a callback) from PendSV.
+    Notifications deferred by interrupt handlers are carried out first.
+    In tickless mode, any suppressed ticks are caught up with before the scheduler
+     runs, and the tick is suppressed again if only the idle task is runnable. */
 OS_TCB_t const * _OS_scheduler(void) {
+    os_notifyDeferred();
+#ifdef OS_TICKLESS_IDLE
+    OS_TCB_t const * next_tcb;
+    if (_scheduler->preemptive) {
+        os_ticklessExit();
+        next_tcb = _scheduler->scheduler_callback();
+        if (next_tcb == OS_idleTCB_p) {
+            os_ticklessEnter();
+        }
+        return next_tcb;
+    }
+#endif
 	return _scheduler->scheduler_callback();
 }
 
@@ -161,14 +293,20 @@ void _svc_OS_taskExit(void) {
 
 /* SVC handler for OS_yield().  Sets the TASK_STATE_YIELD flag and schedules PendSV */
 void _svc_OS_taskYield(void) {
+    _currentTCB->state |= TASK_STATE_YIELD;
 	SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
 }
 
-/* SVC handler to remove a task.  Invokes a scheduler callback. */
-void _svc_OS_taskRemove(_OS_SVC_StackFrame_t const * const stack) {
-	_scheduler->taskRemove_callback((OS_TCB_t *)stack->r0);
-    //Schedule a task change after removing the task from the scheduler.
-    SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+/* SVC handler for OS_sleep().  Puts the current task to sleep for the number of ticks in r0.
+    The time is read here rather than in the task, so the task can not be preempted between
+    reading the time and sleeping. */
+void _svc_OS_sleep(_OS_SVC_StackFrame_t const * const stack) {
+    os_sleepStart(_ticks + stack->r0);
+}
+
+/* SVC handler for _OS_sleepUntil().  Puts the current task to sleep until the tick in r0. */
+void _svc_OS_sleepUntil(_OS_SVC_StackFrame_t const * const stack) {
+    os_sleepStart(stack->r0);
 }
 
 /* SVC handler for _OS_wait(). Simply calls the scheduler wait function with the unit32_t* reason (* mutex) as argument*/
@@ -176,18 +314,422 @@ void _svc_OS_taskWait(_OS_SVC_StackFrame_t const * const stack) {
     
     /* Call the Scheduler Wait callback with arguments
                 r0 (OS_Mutex_t * OR OS_Semaphore_t *)
-                r1 (OS_TCB_t ** head_of_resource_wait_queue)
-                r2 (uint32_t fail_fast_counter)  */
-    _scheduler->wait_callback((OS_Mutex_t *)stack->r0, (OS_TCB_t **)stack->r1, (uint32_t)stack->r2);
-    
+                r1 (OS_WaitList_t * resource_wait_list)
+                r2 (uint32_t fail_fast_sequence)  */
+    _scheduler->wait_callback((OS_Mutex_t *)stack->r0, (OS_WaitList_t *)stack->r1, (uint32_t)stack->r2);
+    /* The scheduler only lets the task wait if the resource's sequence is unchanged */
+    _wait_count++;
+    if ((uint32_t)stack->r2 == ((OS_WaitList_t *)stack->r1)->sequence) {
+        os_waitStart((OS_WaitList_t *)stack->r1, 0);
+    } else {
+        _wait_aborted++;
+    }
 }
 
 /* SVC handler for _OS_notify().  Simply calls the scheduler notify function with the uint32_t* reason as argument.
-	Will increment the _fast_Fail_counter for the ability to check for deadlock situations prior to _OS_wait() */
+	Will increment the resource's fail-fast sequence for the ability to check for deadlock situations prior to _OS_wait() */
 void _svc_OS_taskNotify(_OS_SVC_StackFrame_t const * const stack) {
-    _fast_fail_counter++;
+    os_notify((OS_WaitList_t *)stack->r0);
+}
+
+/* SVC handler for _OS_mutexHandOff(). Notifies the first waiting task of the mutex as
+    _svc_OS_taskNotify, and makes it the owner of the mutex before it can run, so no other
+    task can take the mutex in between. The woken task finds itself the owner when it
+    retries OS_mutexAcquire, which sets the recursive counter.
+   With MUTEX_PRIORITY_INHERITANCE, the releasing task (the current task) drops any priority
+    inherited through the mutex, and the new owner takes over the mutex if tasks are still
+    waiting for it. */
+void _svc_OS_mutexHandOff(_OS_SVC_StackFrame_t const * const stack) {
+    OS_Mutex_t * mutex = (OS_Mutex_t *)stack->r0;
+    OS_TCB_t * waiting_task;
+    mutex->wait_list.sequence++;
+    __CLREX();
+    /* The mutex is released if there was no waiting task, and keeps the waiters
+        flag if tasks are still waiting */
+    waiting_task = _scheduler->notify_callback((void *)&mutex->wait_list);
+    if (waiting_task == 0) {
+        mutex->tcb = 0;
+        return;
+    }
+    if (mutex->wait_list.queue != 0) {
+        mutex->tcb = (OS_TCB_t *)((uint32_t)waiting_task | MUTEX_WAITERS_FLAG);
+    } else {
+        mutex->tcb = waiting_task;
+    }
+    os_waitEnd(waiting_task);
+#if MUTEX_PRIORITY_INHERITANCE
+    os_mutexRemoveContended(_currentTCB, mutex);
+    /* The new owner has the highest priority of the tasks still waiting, so
+        does not need to inherit any priority */
+    if (mutex->wait_list.queue != 0) {
+        mutex->next_contended = waiting_task->contended_mutexes;
+        waiting_task->contended_mutexes = mutex;
+    }
+    os_mutexRestorePriority(_currentTCB);
+#endif
+}
+
+/* SVC handler for _OS_mutexWait(). As _svc_OS_taskWait, but only waits if the mutex is still
+    held by another task, for at most r2 ticks if non-zero. With MUTEX_HAND_OFF, a mutex
+    released without waiting tasks does not notify (or change the fail-fast sequence), so the
+    release may have happened after the calling task found the mutex taken.
+   Sets the waiters flag of the mutex, which makes the owner hand the mutex over on release.
+    Entering this handler clears the exclusive access flag, so a release in progress fails
+    its STREX and sees the waiters flag when it retries. */
+void _svc_OS_mutexWait(_OS_SVC_StackFrame_t const * const stack) {
+    OS_Mutex_t * mutex = (OS_Mutex_t *)stack->r0;
+    OS_TCB_t * owner = MUTEX_OWNER(mutex);
+    /* The scheduler only lets the task wait if the fail-fast sequence is unchanged */
+    _wait_count++;
+    if (owner == 0 || owner == _currentTCB || (uint32_t)stack->r1 != mutex->wait_list.sequence) {
+        _wait_aborted++;
+        return;
+    }
+#if MUTEX_PRIORITY_INHERITANCE
+    /* The first waiting task adds the mutex to the owner's contended mutexes */
+    if (mutex->wait_list.queue == 0) {
+        mutex->next_contended = owner->contended_mutexes;
+        owner->contended_mutexes = mutex;
+    }
+#endif
+    _scheduler->wait_callback(mutex, (void *)&mutex->wait_list, (uint32_t)stack->r1);
+    os_waitStart(&mutex->wait_list, (uint32_t)stack->r2);
+    mutex->tcb = (OS_TCB_t *)((uint32_t)owner | MUTEX_WAITERS_FLAG);
+    _currentTCB->waiting_mutex = mutex;
+#if MUTEX_PRIORITY_INHERITANCE
+    os_mutexInheritPriority(mutex, _currentTCB->priority);
+#endif
+}
+
+/* SVC handler for _OS_semaphoreWait(). As _svc_OS_taskWait, but only waits if the semaphore is
+    still empty when taking (r2 == 0), or has no room for the r2 tokens when giving, for at most r3
+    ticks if non-zero. Tokens taken or given without waiting tasks do not notify (or change the
+    fail-fast sequence), so this may have happened after the calling task found the semaphore
+    unavailable. */
+void _svc_OS_semaphoreWait(_OS_SVC_StackFrame_t const * const stack) {
+    OS_Semaphore_t * semaphore = (OS_Semaphore_t *)stack->r0;
+    uint32_t available;
+    if (stack->r2) {
+        available = semaphore->tokens + (uint32_t)stack->r2 <= semaphore->max_tokens || semaphore->max_tokens == 0;
+    } else {
+        available = semaphore->tokens > 0;
+    }
+    /* The scheduler only lets the task wait if the fail-fast sequence is unchanged */
+    _wait_count++;
+    if (available || (uint32_t)stack->r1 != semaphore->wait_list.sequence) {
+        _wait_aborted++;
+        return;
+    }
+    _scheduler->wait_callback(semaphore, (void *)&semaphore->wait_list, (uint32_t)stack->r1);
+    os_waitStart(&semaphore->wait_list, (uint32_t)stack->r3);
+}
+
+
+#if MUTEX_PRIORITY_INHERITANCE
+/*=============================================================================
+**      Priority Inheritance
+=============================================================================*/
+/**
+ * [os_taskSetPriority Changes the priority of a task, which may be runnable,
+ *   sleeping or waiting. A task waiting for any resource is moved to the
+ *   bucket of its new priority in the wait queue, so that it is woken in the
+ *   order of its new priority and is found there if its wait times out.]
+ * @param tcb      [pointer to the OS_TCB_t to change the priority of]
+ * @param priority [the new priority]
+ */
+static void os_taskSetPriority(OS_TCB_t * tcb, uint32_t priority) {
+    if (tcb->state & TASK_STATE_WAIT) {
+        wait_queueChangePriority(tcb->wait_list->queue, tcb, priority);
+    }
+    if (_scheduler->priorityChange_callback != 0 && !(tcb->state & (TASK_STATE_SLEEP | TASK_STATE_WAIT))) {
+        _scheduler->priorityChange_callback(tcb, priority);
+    } else {
+        tcb->priority = priority;
+    }
+    if (priority != tcb->base_priority) {
+        tcb->state |= TASK_STATE_PRIORITY_INHERITED;
+    } else {
+        tcb->state &= ~TASK_STATE_PRIORITY_INHERITED;
+    }
+}
+
+/**
+ * [os_mutexInheritPriority Raises the priority of the owner of a mutex to the
+ *   priority of a task that has started waiting for it, if higher. If the owner
+ *   is itself waiting for a mutex, the owner of that mutex is raised as well,
+ *   and so on.]
+ * @param mutex    [pointer to the OS_Mutex_t the task is waiting for]
+ * @param priority [the priority of the waiting task]
+ */
+static void os_mutexInheritPriority(OS_Mutex_t * mutex, uint32_t priority) {
+    OS_TCB_t * owner = MUTEX_OWNER(mutex);
+    /* Stops at the first owner of at least the priority, which also ends any
+        cycle of tasks waiting for each other (a deadlock) */
+    while (owner != 0 && owner->priority < priority) {
+        os_taskSetPriority(owner, priority);
+        mutex = owner->waiting_mutex;
+        owner = (mutex != 0) ? MUTEX_OWNER(mutex) : 0;
+    }
+}
+
+/**
+ * [os_mutexRestorePriority Sets the priority of a task back to the highest of
+ *   its own priority, and the priorities of the tasks waiting for the mutexes
+ *   it still holds.]
+ * @param tcb [pointer to the OS_TCB_t to restore the priority of]
+ */
+static void os_mutexRestorePriority(OS_TCB_t * tcb) {
+    uint32_t priority = tcb->base_priority, waiting_priority;
+    for (OS_Mutex_t * mutex = tcb->contended_mutexes; mutex != 0; mutex = mutex->next_contended) {
+        waiting_priority = priorityBitmap_highest(&mutex->wait_list.queue->priorities);
+        if (waiting_priority > priority) {
+            priority = waiting_priority;
+        }
+    }
+    if (priority != tcb->priority) {
+        os_taskSetPriority(tcb, priority);
+    }
+}
+
+/**
+ * [os_mutexRemoveContended Removes a mutex from the list of contended mutexes
+ *   held by a task]
+ * @param tcb   [pointer to the OS_TCB_t holding the mutex]
+ * @param mutex [pointer to the OS_Mutex_t to remove]
+ */
+static void os_mutexRemoveContended(OS_TCB_t * tcb, OS_Mutex_t * mutex) {
+    OS_Mutex_t * volatile * link = &tcb->contended_mutexes;
+    while (*link != 0 && *link != mutex) {
+        link = &(*link)->next_contended;
+    }
+    if (*link != 0) {
+        *link = mutex->next_contended;
+    }
+    mutex->next_contended = 0;
+}
+#endif /* MUTEX_PRIORITY_INHERITANCE */
+
+
+/**
+ * [os_notify Notifies the first waiting task of a resource, incrementing its
+ *   fail-fast sequence, so tasks about to wait for it try again instead.
+ *  Must only be called in handler mode (SVC or PendSV).]
+ * @param wait_list [pointer to the OS_WaitList_t of the resource]
+ */
+static void os_notify(OS_WaitList_t * wait_list) {
+    wait_list->sequence++;
     __CLREX();
-    /* Call the Scheduler Notify callback with arguments r1 (TCB pointer) */
-    _scheduler->notify_callback((OS_TCB_t **)stack->r0);
+    /* Call the Scheduler Notify callback with the resource's wait list */
+    OS_TCB_t * waiting_task = _scheduler->notify_callback(wait_list);
+    if (waiting_task != 0) {
+        os_waitEnd(waiting_task);
+    }
 }
 
+/**
+ * [os_sleepStart Invokes a scheduler callback to remove the current task, and
+ *   inserts it into the sleeping tasks (flagged as sleeping) until it is
+ *   extracted again. The sleeping tasks are only modified in handler mode,
+ *   see sleep.c.]
+ * @param wake_time [the tick after which the task is awoken]
+ */
+static void os_sleepStart(uint32_t wake_time) {
+    OS_TCB_t * tcb = _currentTCB;
+    tcb->data = wake_time;
+	_scheduler->taskRemove_callback(tcb);
+    tcb->state &= ~TASK_STATE_TIMEOUT;
+    sleep_insert(tcb);
+    //Schedule a task change after removing the task from the scheduler.
+    SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+}
+
+/**
+ * [os_waitStart Flags the current task, just put into the wait queue of a
+ *   resource by the scheduler, as waiting. With a timeout, the task is also
+ *   inserted into the sleeping tasks, to be woken by whichever comes first.]
+ * @param wait_list [pointer to the OS_WaitList_t of the resource]
+ * @param timeout   [ticks to wait for at most, or 0 to wait until notified]
+ */
+static void os_waitStart(OS_WaitList_t * wait_list, uint32_t timeout) {
+    _currentTCB->wait_list = wait_list;
+    _currentTCB->state = (_currentTCB->state & ~TASK_STATE_TIMEOUT) | TASK_STATE_WAIT;
+    if (timeout != 0) {
+        _currentTCB->data = _ticks + timeout;
+        sleep_insert(_currentTCB);
+    }
+}
+
+/**
+ * [os_waitEnd Clears the waiting state of a task taken out of a wait queue by
+ *   the scheduler when notified, and cancels its timeout, if any.]
+ * @param tcb [pointer to the notified OS_TCB_t]
+ */
+static void os_waitEnd(OS_TCB_t * tcb) {
+    if (tcb->state & TASK_STATE_SLEEP) {
+        sleep_remove(tcb);
+    }
+    tcb->state &= ~TASK_STATE_WAIT;
+    tcb->wait_list = 0;
+    tcb->waiting_mutex = 0;
+}
+
+/* Timed out wait, see os_internal.h. The task is taken out of the wait queue
+    as it would have been by the scheduler if notified, and is made runnable
+    by the scheduler as a task awoken from sleep.
+   A mutex loses its waiters flag with its last waiting task, so it can be
+    released without entering the OS. The exclusive access flag is cleared, as
+    the owner may be releasing it. With MUTEX_PRIORITY_INHERITANCE the owner
+    drops any priority inherited from the task. */
+void _OS_waitTimeout(OS_TCB_t * tcb) {
+    OS_Mutex_t * mutex = tcb->waiting_mutex;
+    OS_WaitList_t * wait_list = tcb->wait_list;
+
+    wait_queueRemove((OS_WaitQueue_t **)&wait_list->queue, tcb);
+    tcb->state = (tcb->state & ~TASK_STATE_WAIT) | TASK_STATE_TIMEOUT;
+    tcb->wait_list = 0;
+    tcb->waiting_mutex = 0;
+    if (mutex == 0) {
+        return;
+    }
+
+    OS_TCB_t * owner = MUTEX_OWNER(mutex);
+    if (mutex->wait_list.queue == 0) {
+        mutex->tcb = owner;
+        __CLREX();
+#if MUTEX_PRIORITY_INHERITANCE
+        if (owner != 0) {
+            os_mutexRemoveContended(owner, mutex);
+        }
+#endif
+    }
+#if MUTEX_PRIORITY_INHERITANCE
+    if (owner != 0) {
+        os_mutexRestorePriority(owner);
+    }
+#endif
+}
+
+/**
+ * [os_notifyDeferred Carries out the notifications deferred by interrupt
+ *   handlers (see _OS_notifyFromISR). Called from PendSV.
+ *  The deferred list is taken as a whole, so interrupt handlers can keep
+ *   adding to a new one. The next wait list is read before the count of each
+ *   is cleared, as the wait list can be pushed again as soon as it is. As in
+ *   semaphore.c, each notification only continues while tasks are waiting.]
+ */
+static void os_notifyDeferred(void) {
+    OS_WaitList_t * wait_list, * next;
+    uint32_t count;
+    if (_deferred_notify == 0) {
+        return;
+    }
+    do {
+        wait_list = (OS_WaitList_t *)__LDREXW((uint32_t *)&_deferred_notify);
+    } while (__STREXW(0, (uint32_t *)&_deferred_notify) != STREXW_SUCCESSFUL);
+
+    while (wait_list != 0) {
+        next = wait_list->next_deferred;
+        do {
+            count = __LDREXW(&wait_list->deferred);
+        } while (__STREXW(0, &wait_list->deferred) != STREXW_SUCCESSFUL);
+        while (count-- > 0 && wait_list->queue != 0) {
+            os_notify(wait_list);
+        }
+        wait_list = next;
+    }
+}
+
+/**
+ * [os_tickNeedsScheduler Decides on a tick whether the scheduler needs to run.
+ *  The cheap checks are done first, and the scheduler's tick callback is only
+ *   called if nothing else requires the scheduler to run.
+ *  Must only be called from the SysTick handler.]
+ * @return [1 if PendSV should be pended, 0 otherwise]
+ */
+static uint32_t os_tickNeedsScheduler(void) {
+    /* PendSV is already pending (ie from a task switch requested in this tick),
+        so there is nothing to avoid */
+    if (SCB->ICSR & SCB_ICSR_PENDSVSET_Msk) {
+        return 1;
+    }
+#ifdef OS_TICKLESS_IDLE
+    /* The idle task relies on the scheduler to suppress the tick again */
+    if (_currentTCB == OS_idleTCB_p) {
+        return 1;
+    }
+#endif
+    if (sleep_tickMayNeedAwakening() || _scheduler->tick_callback == 0) {
+        return 1;
+    }
+    return _scheduler->tick_callback();
+}
+
+
+#ifdef OS_TICKLESS_IDLE
+/*=============================================================================
+**      Tickless Idle
+=============================================================================*/
+/**
+ * [os_ticklessEnter Programs the SysTick to fire once at the next tick boundary
+ *   at which a sleeping task should be awoken, instead of every tick, so the
+ *   idle task can sleep (WFI) without being woken needlessly.
+ *  The period is limited by the 24-bit SysTick, around 99 ticks at 168 MHz.
+ *  Must only be called from PendSV when the idle task is to run.]
+ */
+static void os_ticklessEnter(void) {
+    uint32_t ticks, primask;
+
+    /* Already suppressing ticks, or the next tick is needed anyway */
+    ticks = sleep_ticksUntilAwakening();
+    if (_tickless_ticks || ticks <= 1) {
+        return;
+    }
+    if (ticks > _tickless_max_ticks) {
+        ticks = _tickless_max_ticks;
+    }
+
+    /* Stop the SysTick from interrupting while it is being reprogrammed.
+        The new period is the remainder of the current tick followed by
+        (ticks - 1) full ticks, so the tick phase is kept. */
+    primask = __get_PRIMASK();
+    __disable_irq();
+    if (!(SCB->ICSR & SCB_ICSR_PENDSTSET_Msk)) {
+        SysTick->LOAD = SysTick->VAL + ((ticks - 1) * _cycles_per_tick);
+        SysTick->VAL = 0;
+        _tickless_ticks = ticks;
+    }
+    __set_PRIMASK(primask);
+}
+
+/**
+ * [os_ticklessExit Catches up the elapsed ticks if the idle task was left before
+ *   the programmed SysTick fired (ie an interrupt made a task runnable), and
+ *   programs the SysTick to fire at the next tick boundary.
+ *  If the SysTick has already fired, its handler will catch up instead.]
+ */
+static void os_ticklessExit(void) {
+    uint32_t remaining_cycles, remaining_ticks, primask;
+
+    if (!_tickless_ticks) {
+        return;
+    }
+
+    primask = __get_PRIMASK();
+    __disable_irq();
+    if (!(SCB->ICSR & SCB_ICSR_PENDSTSET_Msk)) {
+        /* Add the ticks whose boundaries have passed, and let the SysTick
+            fire at the next one, counting a single tick */
+        remaining_cycles = SysTick->VAL;
+        remaining_ticks = (remaining_cycles + _cycles_per_tick - 1) / _cycles_per_tick;
+        _ticks = _ticks + (_tickless_ticks - remaining_ticks);
+        remaining_cycles = remaining_cycles % _cycles_per_tick;
+        if (remaining_cycles == 0) {
+            remaining_cycles = _cycles_per_tick;
+        }
+        SysTick->LOAD = remaining_cycles - 1;
+        SysTick->VAL = 0;
+        _tickless_ticks = 1;
+    }
+    __set_PRIMASK(primask);
+}
+#endif
@@ -5,6 +5,25 @@
 
 /*=============================================================================
  *  This is the main file of DocetOS.
+ *  Optional features are enabled by defining the following constants in the
+ *   compiler (and where stated, assembler) command line options:
+ *       OS_TICKLESS_IDLE
+ *           When only the idle task is runnable, the SysTick is programmed to
+ *            fire at the next sleeping task's awakening instead of every tick,
+ *            and elapsed ticks are caught up when it fires. Must also be
+ *            defined for the assembler (--pd "OS_TICKLESS_IDLE SETA 1") so the
+ *            idle task sleeps using WFI. OS_elapsedTicks() is not updated
+ *            while the ticks are suppressed.
+ *       OS_PRIVILEGED_TASKS
+ *           Tasks run privileged instead of unprivileged, and can access the
+ *            core peripherals (ie the DWT cycle counter used by main_BENCH.c).
+ *            Must be defined for both the compiler and the assembler
+ *            (--pd "OS_PRIVILEGED_TASKS SETA 1"), and is not intended for
+ *            deployment.
+ *  Interrupt handlers must only use the functions ending in FromISR, which
+ *   never wait. Their priority must not be higher (numerically lower) than that
+ *   of SVCall and PendSV, so that they can not interrupt the OS itself. The
+ *   reset priority of all exceptions and interrupts (0) satisfies this.
 ===============================================================================
 **       Example Use of OS
 *******************************************************************************
@@ -24,22 +43,56 @@ enum OS_SVC_e {
     OS_SVC_ADD_TASK,
 	OS_SVC_EXIT_TASK,
 	OS_SVC_YIELD_TASK,
-    OS_SVC_REMOVE_TASK,
+    OS_SVC_SLEEP,
+    OS_SVC_SLEEP_UNTIL,
     OS_SVC_WAIT,
-    OS_SVC_NOTIFY
+    OS_SVC_NOTIFY,
+    OS_SVC_MUTEX_HAND_OFF,
+    OS_SVC_MUTEX_WAIT,
+    OS_SVC_SEMAPHORE_WAIT
 };
 
-/* A structure to hold callbacks for a scheduler, plus a 'preemptive' flag */
+/* A structure to hold callbacks for a scheduler, plus a 'preemptive' flag.
+    The tick_callback is optional (may be NULL), and is called from the SysTick
+     handler to decide whether the scheduler needs to run on a tick where no
+     sleeping task is due to be awoken. It must return non-zero if the running
+     task should be preempted (ie a time slice has expired, or a task that should
+     run instead has become ready), and must be kept short. Without it the
+     scheduler is run on every tick.
+    The notify_callback returns the task it made runnable, or 0 if no task was
+     waiting.
+    The priorityChange_callback is optional (may be NULL), and is called to
+     change the priority of a runnable task (ie when it inherits a priority, see
+     MUTEX_PRIORITY_INHERITANCE in mutex.h), for schedulers that keep runnable
+     tasks ordered by priority. Without it the priority field is just updated. */
 typedef struct {
 	uint_fast8_t preemptive;
 	OS_TCB_t const * (* scheduler_callback)(void);
 	void (* taskAdd_callback)(OS_TCB_t * const new_task);
 	void (* taskExit_callback)(OS_TCB_t * const finished_task);
     void (* taskRemove_callback)(OS_TCB_t * const sleep_wait_task);
-    void (* wait_callback)(void * const reason, void * const resource_wait_queue_head, uint32_t fail_fast_counter);
-    void (* notify_callback)(void * const resource_wait_queue_head);
+    void (* wait_callback)(void * const reason, void * const resource_wait_list, uint32_t fail_fast_sequence);
+    OS_TCB_t * (* notify_callback)(void * const resource_wait_list);
+    uint32_t (* tick_callback)(void);
+    void (* priorityChange_callback)(OS_TCB_t * const tcb, uint32_t priority);
 } OS_Scheduler_t;
 
+/* The result of the OS functions that can fail instead of waiting, ie those
+    callable from interrupt handlers (FromISR), or waiting with a timeout. */
+typedef enum OS_Status_e {
+    OS_OK = 0,
+    /* The resource was full (ie no room in a queue) */
+    OS_ERR_FULL,
+    /* The resource was empty (ie no items in a queue) */
+    OS_ERR_EMPTY,
+    /* The resource was held by the task the interrupt handler interrupted */
+    OS_ERR_BUSY,
+    /* The resource did not become available within the timeout */
+    OS_ERR_TIMEOUT,
+    /* The arguments do not fit the configuration (ie too much memory) */
+    OS_ERR_INVALID
+} OS_Status_t;
+
 /*=============================================================================
 **       Global Idle TCB Declaration
 =============================================================================*/
@@ -74,12 +127,27 @@ OS_TCB_t * OS_currentTCB(void);
 uint32_t OS_elapsedTicks(void);
 
 /**
- * [OS_currentFastFailCounter  Returns the Fail-Fast Counter used to guard against
- *   deadlock situations from _OS_wait() calls. The counter is incremented from
- *   _OS_notify]
- * @return fail_fast_counter [current fast fail counter value (uint32_t).]
+ * [OS_pendSVAvoidedCount Returns the number of ticks on which the scheduler was
+ *   not run (PendSV not pended), as nothing could have changed which task
+ *   should run (modulo 2^32).]
+ * @return pendsv_avoided [number of ticks without a scheduler run (uint32_t)]
+ */
+uint32_t OS_pendSVAvoidedCount(void);
+
+/**
+ * [OS_waitCount Returns the number of times tasks have tried to wait for a
+ *   resource (mutex or semaphore) that was unavailable (modulo 2^32).]
+ * @return wait_count [number of waits tried (uint32_t)]
+ */
+uint32_t OS_waitCount(void);
+
+/**
+ * [OS_waitAbortedCount Returns the number of tried waits that were aborted, as
+ *   the resource was released (notified) after the task found it unavailable,
+ *   so the task had to try to take it again (modulo 2^32).]
+ * @return wait_aborted [number of aborted waits (uint32_t)]
  */
-uint32_t OS_currentFastFailCounter (void);
+uint32_t OS_waitAbortedCount(void);
 
 
 /*=============================================================================
@@ -17,9 +17,13 @@
 	IMPORT _svc_OS_taskAdd
     IMPORT _svc_OS_taskExit
     IMPORT _svc_OS_taskYield
-	IMPORT _svc_OS_taskRemove
+	IMPORT _svc_OS_sleep
+	IMPORT _svc_OS_sleepUntil
 	IMPORT _svc_OS_taskWait
 	IMPORT _svc_OS_taskNotify
+	IMPORT _svc_OS_mutexHandOff
+	IMPORT _svc_OS_mutexWait
+	IMPORT _svc_OS_semaphoreWait
     
 SVC_Handler
     ; Link register contains special 'exit handler mode' code
@@ -49,9 +53,13 @@ SVC_tableStart
     DCD _svc_OS_taskAdd
     DCD _svc_OS_taskExit
     DCD _svc_OS_taskYield
-	DCD _svc_OS_taskRemove
+	DCD _svc_OS_sleep
+	DCD _svc_OS_sleepUntil
 	DCD _svc_OS_taskWait
 	DCD _svc_OS_taskNotify
+	DCD _svc_OS_mutexHandOff
+	DCD _svc_OS_mutexWait
+	DCD _svc_OS_semaphoreWait
 SVC_tableEnd
 
     ALIGN
@@ -70,13 +78,24 @@ _task_switch
     BXEQ    lr
     ; If not, stack remaining process registers (pc, PSR, lr, r0-r3, r12 already stacked)
     MRS     r3, PSP
-    STMFD   r3!, {r4-r11}
+    ; If the task has used the FPU (EXC_RETURN bit 4 clear), also stack s16-s31.
+    ; s0-s15 and FPSCR have space reserved by the CPU, and are only stacked lazily
+    ; by the CPU when an FPU instruction is executed here.
+    TST     lr, #0x10
+    IT      EQ
+    VSTMDBEQ r3!, {s16-s31}
+    ; Stack r4-r11 and EXC_RETURN, which tells whether the FPU registers were stacked
+    STMFD   r3!, {r4-r11, lr}
     ; Store stack pointer
     STR     r3, [r1]
     ; Load new stack pointer
     LDR     r3, [r0]
-    ; Unstack process registers
-    LDMFD   r3!, {r4-r11}
+    ; Unstack process registers and the new task's EXC_RETURN
+    LDMFD   r3!, {r4-r11, lr}
+    ; Unstack s16-s31 if the new task has used the FPU
+    TST     lr, #0x10
+    IT      EQ
+    VLDMIAEQ r3!, {s16-s31}
     MSR     PSP, r3
     ; Update _currentTCB
     STR     r0, [r2]
@@ -97,8 +116,14 @@ _task_initialiseSwitch
     LDR     r2, =_currentTCB
     STR     r0, [r2]
     ; Switch to using PSP instead of MSP for thread mode (bit 1 = 1)
-    ; Also lose privileges in thread mode (bit 0 = 1) and disable FPU (bit 2 = 0)
+    ; Also lose privileges in thread mode (bit 0 = 1) and clear the FPU context
+    ; active flag (bit 2 = 0) - it is set by the CPU when a task first uses the FPU
+    ; With OS_PRIVILEGED_TASKS, tasks keep their privileges (bit 0 = 0)
+    IF :DEF:OS_PRIVILEGED_TASKS
+    MOV     r2, #2
+    ELSE
     MOV     r2, #3
+    ENDIF
     MSR     CONTROL, r2
     ; Instruction barrier (stack pointer switch)
     ISB
@@ -112,10 +137,12 @@ _task_initialiseSwitch
     ; It causes a switch to a runnable task, if possible
     SVC     0x04
 _idle_task
-    ; The following line is commented out because it doesn't play nicely with the debugger.
-    ; For deployment, uncomment this line and the CPU will sleep when idling, waking only to
-    ; handle interrupts.
-;   WFI
+    ; WFI doesn't play nicely with the debugger, so it is only assembled when OS_TICKLESS_IDLE
+    ; is defined, sleeping the CPU when idling and waking only to handle interrupts.
+    ; Other builds busy-wait here; remove the IF/ENDIF to have them sleep when idling too.
+    IF :DEF:OS_TICKLESS_IDLE
+    WFI
+    ENDIF
     B       _idle_task
     
     ALIGN
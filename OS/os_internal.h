@@ -43,29 +43,64 @@ extern OS_TCB_t * volatile _currentTCB;
  * [_OS_wait SVC delegate to let the current task enter a wait state when it has tried
      to aquire an unavailable resource]
  * @param resource [the resource to wait for]
- * @param resource_wait_queue_head  [pointer to the head (OS_TCB_t *) of the wait queue]
- * @param fail_fast_counter  [fail fast count from when wait was called]
+ * @param resource_wait_list  [pointer to the OS_WaitList_t of the resource]
+ * @param fail_fast_sequence  [sequence of the wait list from when wait was called]
  */
 void __svc(OS_SVC_WAIT) _OS_wait(void *, void *, const uint32_t);
 
 /**
  * [_OS_notify SVC delegate to notify waiting tasks that the resource they are
  * 	waiting for is now available.]
- * @param resource_wait_queue_head  [pointer to the head (OS_TCB_t *) of the wait queue]
+ * @param resource_wait_list  [pointer to the OS_WaitList_t of the resource]
  */
 void __svc(OS_SVC_NOTIFY) _OS_notify(void *);
 
+/**
+ * [_OS_mutexHandOff SVC delegate to release a mutex by handing it over to the
+ *  highest priority waiting task, which becomes the owner before it runs.
+ *  The mutex is released if no task is waiting.]
+ * @param mutex  [pointer to the OS_Mutex_t to hand over]
+ */
+void __svc(OS_SVC_MUTEX_HAND_OFF) _OS_mutexHandOff(void *);
+
+/**
+ * [_OS_mutexWait SVC delegate to let the current task wait for a mutex, as
+ *  _OS_wait. The task only waits if the mutex is still held by another task,
+ *  as a mutex released without waiting tasks does not notify.]
+ * @param mutex              [pointer to the OS_Mutex_t to wait for]
+ * @param fail_fast_sequence [sequence of the mutex wait list from when wait was called]
+ * @param timeout            [ticks after which the task stops waiting, or 0 to
+ *  wait until notified]
+ */
+void __svc(OS_SVC_MUTEX_WAIT) _OS_mutexWait(void *, const uint32_t, const uint32_t);
+
+/**
+ * [_OS_semaphoreWait SVC delegate to let the current task wait for a semaphore,
+ *  as _OS_wait. The task only waits if the semaphore is still empty (or has no
+ *  room for the tokens when giving), as tokens taken or given without waiting
+ *  tasks do not notify.]
+ * @param semaphore          [pointer to the OS_Semaphore_t to wait for]
+ * @param fail_fast_sequence [sequence of the semaphore wait list from when wait was called]
+ * @param give               [the number of tokens waiting to be given, or 0 if
+ *  waiting to take a token]
+ * @param timeout            [ticks after which the task stops waiting, or 0 to
+ *  wait until notified]
+ */
+void __svc(OS_SVC_SEMAPHORE_WAIT) _OS_semaphoreWait(void *, const uint32_t, const uint32_t, const uint32_t);
+
 /**
  * [_OS_taskExit SVC delegate to exit a finished task]
  */
 void __svc(OS_SVC_EXIT_TASK) _OS_taskExit(void);
 
-/*  */
 /**
- * [_OS_removeTask SVC delegate to remove a task to be put into wait or sleep queues]
- * @param tcb [pointer to OS_TCB_t to remove]
+ * [_OS_sleepUntil SVC delegate to put the current task to sleep until the
+ *  given tick, as OS_sleep but with an absolute awakening time (ie a periodic
+ *  release that must not drift with the time the task was preempted for)]
+ * @param wake_time [the tick after which the task is awoken, which must not
+ *   have already passed]
  */
-void __svc(OS_SVC_REMOVE_TASK) _OS_removeTask(OS_TCB_t const * const);
+void __svc(OS_SVC_SLEEP_UNTIL) _OS_sleepUntil(const uint32_t);
 
 /*****************************************************************************
 **  C  Function Prototypes
@@ -76,6 +111,29 @@ void __svc(OS_SVC_REMOVE_TASK) _OS_removeTask(OS_TCB_t const * const);
  */
 void _OS_taskEnd(void);
 
+/**
+ * [_OS_notifyFromISR Notifies a waiting task from an interrupt handler, which
+ *  can not call the _OS_notify SVC. The notification is deferred until PendSV
+ *  runs, which is pended, and happens before any task runs again.
+ *  Can be called by any number of (nested) interrupt handlers at once.]
+ * @param resource_wait_list [pointer to the OS_WaitList_t of the resource]
+ */
+void _OS_notifyFromISR(OS_WaitList_t * resource_wait_list);
+
+/**
+ * [_OS_waitTimeout Takes a task whose wait for a resource has timed out out of
+ *  the resource's wait queue, called when it is extracted from the sleeping tasks.
+ *  Must only be called in handler mode.]
+ * @param tcb [pointer to the timed out OS_TCB_t]
+ */
+void _OS_waitTimeout(OS_TCB_t * tcb);
+
+/**
+ * [_OS_scheduler Invokes the scheduler callback, called from PendSV]
+ * @return  [pointer to the OS_TCB_t of the next task to run]
+ */
+OS_TCB_t const * _OS_scheduler(void);
+
 /*****************************************************************************
 **  ASM Function Prototypes (os_asm.c)
 ******************************************************************************/
@@ -4,6 +4,13 @@
 /*=============================================================================
  *      Definitions for Internal Use within the OS
 =============================================================================*/
+/*****************************************************************************
+**  Used by os.c
+******************************************************************************/
+/* EXC_RETURN value returning to thread mode using the PSP, with a basic stack
+    frame (bit 4 set - the FPU registers are not stacked) */
+#define EXC_RETURN_THREAD_PSP 0xFFFFFFFD
+
 /*****************************************************************************
 **  Used by mutex.c and semaphore.c
 ******************************************************************************/
@@ -12,9 +19,24 @@
 #define STREXW_SUCCESSFUL 0
 
 /*****************************************************************************
-**  Used by sleep.c
+**  Used by sleep.c and edf.c
 ******************************************************************************/
 /* Half the size of uint32_MAX */
 #define HALF_OF_UINT32_T_MAX 0x7FFFFFFF
 
+/**
+* [sleep_time1IsAfterTime2 Macro funtion calculates whether time1 is after time2
+*    while taking into account potential overflows, based on modular arithmetic
+*    on uint32_t.
+*   This limits the sleep check to HALF_OF_UINT32_T_MAX, where any differences
+*    equal to or over this (31^2 -1) will cause undefined behavour.]
+* @param  time_1 [the time to check if is after 'time2']
+* @param  time_2 [the second time to compare against]
+* @param  ref_time  [the reference time to calculate time intervals from/to]
+* @return uint32_t  [   1 if time_1 is after time_2 (including after overflow),
+*                       0 if time_1 is equal to or before time_2]
+*/
+#define sleep_time1IsAfterTime2(time_1,time_2,ref_time) ( ( (uint32_t)( (uint32_t)(time_1)-(uint32_t)(ref_time) ) > \
+                                                        (uint32_t)( (uint32_t)(time_2)-(uint32_t)(ref_time) )) )
+
 #endif /* _OS_INTERNAL_DEF_H_ */
@@ -0,0 +1,106 @@
+#ifndef _PRIORITY_BITMAP_H_
+#define _PRIORITY_BITMAP_H_
+
+#include <stdint.h>
+#include "roundRobin.h"
+#include "stm32f4xx.h"
+
+/*=============================================================================
+ *  This file implements a bitmap of occupied priority levels, used by the OS
+ *   to find the highest priority with any runnable (or waiting) tasks in
+ *   constant time using the Count Leading Zeros (CLZ) instruction instead of
+ *   traversing every priority level.
+ *  Up to 32 priority levels are held in a single word. Up to 256 priority
+ *   levels are supported using a two-level bitmap, where a group word marks
+ *   which of the (up to 8) words in the second level have any bits set.
+ *  The bitmap is not protected against concurrent access, and must only be
+ *   modified from within the OS (handler mode).
+=============================================================================*/
+
+/*=============================================================================
+**       Definitions
+=============================================================================*/
+/* Number of priorities held in a single bitmap word */
+#define PRIORITY_BITMAP_WORD_BITS 32
+
+/* Number of words required to hold PRIORITY_LEVELS bits */
+#define PRIORITY_BITMAP_WORDS ((PRIORITY_LEVELS + PRIORITY_BITMAP_WORD_BITS - 1) / PRIORITY_BITMAP_WORD_BITS)
+
+
+/*=============================================================================
+**       Type Definitions
+=============================================================================*/
+/* A bitmap with one bit per priority level, set if the priority is occupied */
+typedef struct {
+#if PRIORITY_BITMAP_WORDS > 1
+    /* Bit n is set if word n of the second level has any bits set */
+    uint32_t volatile group;
+#endif
+    /* Bit p of word (p / 32) is set if priority p is occupied */
+    uint32_t volatile map[PRIORITY_BITMAP_WORDS];
+} OS_PriorityBitmap_t;
+
+
+/*=============================================================================
+**       Inline Functions
+=============================================================================*/
+/**
+ * [priorityBitmap_set Marks a priority level as occupied]
+ * @param bitmap   [pointer to the OS_PriorityBitmap_t to modify]
+ * @param priority [the priority to mark, must be < PRIORITY_LEVELS]
+ */
+static inline void priorityBitmap_set(OS_PriorityBitmap_t * bitmap, uint32_t priority) {
+#if PRIORITY_BITMAP_WORDS > 1
+    bitmap->map[priority / PRIORITY_BITMAP_WORD_BITS] |= (1UL << (priority % PRIORITY_BITMAP_WORD_BITS));
+    bitmap->group |= (1UL << (priority / PRIORITY_BITMAP_WORD_BITS));
+#else
+    bitmap->map[0] |= (1UL << priority);
+#endif
+}
+
+/**
+ * [priorityBitmap_clear Marks a priority level as empty]
+ * @param bitmap   [pointer to the OS_PriorityBitmap_t to modify]
+ * @param priority [the priority to clear, must be < PRIORITY_LEVELS]
+ */
+static inline void priorityBitmap_clear(OS_PriorityBitmap_t * bitmap, uint32_t priority) {
+#if PRIORITY_BITMAP_WORDS > 1
+    bitmap->map[priority / PRIORITY_BITMAP_WORD_BITS] &= ~(1UL << (priority % PRIORITY_BITMAP_WORD_BITS));
+    if (bitmap->map[priority / PRIORITY_BITMAP_WORD_BITS] == 0) {
+        bitmap->group &= ~(1UL << (priority / PRIORITY_BITMAP_WORD_BITS));
+    }
+#else
+    bitmap->map[0] &= ~(1UL << priority);
+#endif
+}
+
+/**
+ * [priorityBitmap_isEmpty Checks whether any priority level is occupied]
+ * @param  bitmap [pointer to the OS_PriorityBitmap_t to check]
+ * @return        [1 if no priority levels are occupied, 0 otherwise]
+ */
+static inline uint32_t priorityBitmap_isEmpty(OS_PriorityBitmap_t const * bitmap) {
+#if PRIORITY_BITMAP_WORDS > 1
+    return bitmap->group == 0;
+#else
+    return bitmap->map[0] == 0;
+#endif
+}
+
+/**
+ * [priorityBitmap_highest Finds the highest occupied priority level using CLZ.
+ *  The result is undefined if the bitmap is empty, so the caller must check
+ *   priorityBitmap_isEmpty() first.]
+ * @param  bitmap [pointer to the OS_PriorityBitmap_t to search]
+ * @return        [the highest occupied priority]
+ */
+static inline uint32_t priorityBitmap_highest(OS_PriorityBitmap_t const * bitmap) {
+#if PRIORITY_BITMAP_WORDS > 1
+    uint32_t word = (PRIORITY_BITMAP_WORD_BITS - 1) - __CLZ(bitmap->group);
+    return (word * PRIORITY_BITMAP_WORD_BITS) + ((PRIORITY_BITMAP_WORD_BITS - 1) - __CLZ(bitmap->map[word]));
+#else
+    return (PRIORITY_BITMAP_WORD_BITS - 1) - __CLZ(bitmap->map[0]);
+#endif
+}
+
+#endif /* _PRIORITY_BITMAP_H_ */
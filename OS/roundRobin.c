@@ -4,12 +4,23 @@
 #include "semaphore.h"
 #include "wait.h"
 #include "sleep.h"
+#include "priorityBitmap.h"
 #include "debug.h"
 
 /* This is an implementation of a fixed priority round-robin scheduler similar
      to that in FreeRTOS.
     Priorities go from PRIORITY_MAX down to 1, with only the system idle task at
-    a lower priority. */
+    a lower priority.
+    The highest priority with runnable tasks is found in constant time from a
+     bitmap of occupied priorities (see priorityBitmap.h). Defining
+     ROUNDROBIN_LINEAR_SCAN (-DROUNDROBIN_LINEAR_SCAN) instead searches every
+     priority from PRIORITY_MAX and down, which is only kept as a reference
+     for benchmarking the scheduler.
+    Tasks of equal priority share the CPU in time slices of
+     ROUNDROBIN_TIME_SLICE ticks (or as set per priority by
+     OS_roundRobinSetTimeSlice). A priority's list is only rotated when the
+     running task's slice has expired, or it yields, sleeps or waits, rather
+     than on every call of the scheduler. */
 
 /*=============================================================================
 **      Static Function Prototypes
@@ -21,10 +32,17 @@ static void roundRobin_exitTask(OS_TCB_t * const tcb);
 /* Insert and Removes tasks into and from the scheduler for sleep and wait mechanisms */
 static void roundRobin_insertTask(OS_TCB_t * const tcb);
 static void roundRobin_removeTask(OS_TCB_t * const tcb);
+/* Time slicing of tasks within a priority */
+static void roundRobin_chargeTimeSlice(void);
+static OS_TCB_t * roundRobin_nextInPriority(uint32_t priority);
 /* Removes tasks from the scheduler if a resource is unavialable when requested,
     or notifies the first task waiting for a resource that has been made available.*/
-static void roundRobin_wait(void * const reason, void * const unavailable_resource_wait_queue_head, uint32_t fail_fast_counter);
-static void roundRobin_notify(void * const available_resource_wait_queue_head);
+static void roundRobin_wait(void * const reason, void * const unavailable_resource_wait_list, uint32_t fail_fast_sequence);
+static OS_TCB_t * roundRobin_notify(void * const available_resource_wait_list);
+/* Decides from the SysTick whether the scheduler needs to run */
+static uint32_t roundRobin_tick(void);
+/* Moves a runnable task to the list of a new priority */
+static void roundRobin_priorityChange(OS_TCB_t * const tcb, uint32_t priority);
 
 
 /*=============================================================================
@@ -43,6 +61,19 @@ OS_TCB_t * _tasks_pri[PRIORITY_LEVELS] = {0};
 OS_TCB_t * _debug_tasks[MAX_TASKS] = {0};
 #endif
 
+/* Bitmap of the priorities which have runnable tasks, kept up to date by
+    roundRobin_insertTask and roundRobin_removeTask */
+static OS_PriorityBitmap_t _ready_priorities = {0};
+
+/* The time slice (in ticks) of each priority, or 0 for ROUNDROBIN_TIME_SLICE */
+static uint32_t _time_slice[PRIORITY_LEVELS] = {0};
+/* The ticks remaining of the time slice of the task last run in each priority
+    (_tasks_pri[priority]). The list is rotated when this reaches 0. */
+static uint32_t _slice_remaining[PRIORITY_LEVELS] = {0};
+/* The time (in ticks) of the last scheduler run, used to charge the time slice
+    of the task that ran since */
+static uint32_t _slice_last_tick = 0;
+
 /* Variable to hold number of currently added tasks (incl. sleeping and waiting tasks, excl. idle task),
     to make sure that tasks aren't added over the scheduler capacity set by MAX_TASKS. The limitation
     is implemented to make sure the sleep heap is sufficiently sized for all tasks to be asleep at the same time.  */
@@ -59,12 +90,27 @@ OS_Scheduler_t const round_robin_scheduler = {
     .taskExit_callback = roundRobin_exitTask,
     .taskRemove_callback = roundRobin_removeTask,
 	.wait_callback = roundRobin_wait,
-    .notify_callback = roundRobin_notify
+    .notify_callback = roundRobin_notify,
+    .tick_callback = roundRobin_tick,
+    .priorityChange_callback = roundRobin_priorityChange
 };
 
 /*=============================================================================
 **      Functions
 =============================================================================*/
+/**
+ * [OS_roundRobinSetTimeSlice Sets the length of the time slice given to each
+ *   task of a priority before the next task of the same priority is run.]
+ * @param priority [the priority to set the time slice of]
+ * @param ticks    [length of the time slice in ticks, or 0 for ROUNDROBIN_TIME_SLICE]
+ */
+void OS_roundRobinSetTimeSlice(uint32_t priority, uint32_t ticks) {
+    if (priority > PRIORITY_MAX) {
+        ASSERT_DEBUG(0);
+        return;
+    }
+    _time_slice[priority] = ticks;
+}
 
 /**
  * [roundRobin_scheduler The scheduler call back. Returns the first task of
@@ -72,9 +118,7 @@ OS_Scheduler_t const round_robin_scheduler = {
  * @return  [pointer to the next task to be run]
  */
 static OS_TCB_t const * roundRobin_scheduler(void) {
-    /* For-loop to return the next task, higher priorities first.
-        If there are tasks in the highest priority, return the next TCB held in the TCB
-        If there are no tasks in the priority, search for tasks in the next priority until one is found.
+    /* Return the next task of the highest priority with runnable tasks.
         If no tasks are runnable, return the Idle task. */
 
     /* Check whether any tasks should be awoken.
@@ -82,22 +126,86 @@ static OS_TCB_t const * roundRobin_scheduler(void) {
         until the next awakening, triggering a ISR to insert it again, which
         means no time waisted on polling the top sleep */
     while( sleep_taskNeedsAwakening() ) {
-        roundRobin_insertTask(sleep_heapExtract());
+        roundRobin_insertTask(sleep_extract());
+    }
+
+    /* Charge the ticks since the last scheduler run to the time slice of the
+        task that was running, as long as it is still runnable (a removed task
+        has already had its slice ended by roundRobin_removeTask) */
+    roundRobin_chargeTimeSlice();
+
+    /* Return the next task of the highest occupied priority, or the idle task
+        if no priorities have tasks in them */
+    uint32_t priority = OS_roundRobinHighestPriority();
+    if (priority != 0) {
+        return roundRobin_nextInPriority(priority);
     }
 
-    /*  Return the first task in the highest priority, or the idle task if
-        none of the buckets have tasks / doubly-linked lists in them */
+    /* No tasks active; return the idle task */
+	return OS_idleTCB_p;
+}
+
+/**
+ * [OS_roundRobinHighestPriority Finds the highest priority with runnable tasks,
+ *   without modifying any scheduler state.]
+ * @return  [the highest runnable priority, or 0 if only the idle task can run]
+ */
+uint32_t OS_roundRobinHighestPriority(void) {
+#ifndef ROUNDROBIN_LINEAR_SCAN
+    /*  Found from the bitmap using CLZ */
+    if (!priorityBitmap_isEmpty(&_ready_priorities)) {
+        return priorityBitmap_highest(&_ready_priorities);
+    }
+#else
+    /*  Found by searching the buckets from the top for the first one with
+        tasks / a doubly-linked list in it */
     for (uint_fast8_t priority = PRIORITY_MAX; priority > 0; priority--) {
-        if(_tasks_pri[priority] == 0) {
-            continue;
+        if(_tasks_pri[priority] != 0) {
+            return priority;
+        }
+    }
+#endif
+    return 0;
+}
+
+/**
+ * [roundRobin_chargeTimeSlice Subtracts the ticks elapsed since the last
+ *   scheduler run from the time slice of the current task, and ends the slice
+ *   straight away if the task has yielded.]
+ */
+static void roundRobin_chargeTimeSlice(void) {
+    OS_TCB_t * current_tcb = OS_currentTCB();
+    uint32_t current_time = OS_elapsedTicks();
+    uint32_t elapsed_ticks = current_time - _slice_last_tick;
+    _slice_last_tick = current_time;
+
+    /* Nothing to charge before the OS is started or while idling */
+    if (current_tcb == 0 || current_tcb == OS_idleTCB_p) {
+        return;
+    }
+    if (_tasks_pri[current_tcb->priority] == current_tcb) {
+        if ((current_tcb->state & TASK_STATE_YIELD) || elapsed_ticks >= _slice_remaining[current_tcb->priority]) {
+            _slice_remaining[current_tcb->priority] = 0;
         } else {
-            _tasks_pri[priority] = _tasks_pri[priority]->next;
-            return _tasks_pri[priority];
+            _slice_remaining[current_tcb->priority] -= elapsed_ticks;
         }
     }
+    current_tcb->state &= ~TASK_STATE_YIELD;
+}
 
-    /* No tasks active; return the idle task */
-	return OS_idleTCB_p;
+/**
+ * [roundRobin_nextInPriority Returns the task to run in a priority, which is
+ *   the task last run in it unless its time slice has ended, in which case
+ *   the list is rotated and the next task is given a new time slice.]
+ * @param  priority [the priority to pick a task from, must have tasks in it]
+ * @return          [pointer to the task to be run]
+ */
+static OS_TCB_t * roundRobin_nextInPriority(uint32_t priority) {
+    if (_slice_remaining[priority] == 0) {
+        _tasks_pri[priority] = _tasks_pri[priority]->next;
+        _slice_remaining[priority] = _time_slice[priority] ? _time_slice[priority] : ROUNDROBIN_TIME_SLICE;
+    }
+    return _tasks_pri[priority];
 }
 
 /**
@@ -148,9 +256,11 @@ static void roundRobin_insertTask(OS_TCB_t * const tcb) {
          with more than 1 task, at which point it will be set by the addition
          of the new task). */
     if(_tasks_pri[tcb->priority] == 0) {
-        /* If no tasks in the given priority, link the task->next to itself */
+        /* If no tasks in the given priority, link the task->next to itself
+            and mark the priority as occupied */
         _tasks_pri[tcb->priority] = tcb;
         tcb->next = tcb;
+        priorityBitmap_set(&_ready_priorities, tcb->priority);
     } else {
         /* There are one or more tasks in the same priority - insert between current
             and next task. */
@@ -170,32 +280,49 @@ static void roundRobin_removeTask(OS_TCB_t * const tcb) {
     /* Remove the task from the doubly linked list. */
     if (tcb->next == tcb) {
         _tasks_pri[tcb->priority] = 0;
+        priorityBitmap_clear(&_ready_priorities, tcb->priority);
     } else {
         (tcb->prev)->next = tcb->next;
         (tcb->next)->prev = tcb->prev;
         /* Update the pointer to the previous task, so the next scheduler run will run the current tcb->next  */
         _tasks_pri[tcb->priority] = tcb->prev;
     }
+    /* End the time slice so the next scheduler run moves on to tcb->next */
+    _slice_remaining[tcb->priority] = 0;
+}
 
+/**
+ * [roundRobin_priorityChange Changes the priority of a runnable task, moving it
+ *   to the list of its new priority (ie when it inherits the priority of a task
+ *   waiting for a mutex it holds). The scheduler is run, as the task may now
+ *   need to preempt, or be preempted by, the running task.]
+ * @param tcb      [pointer to the runnable TCB]
+ * @param priority [the new priority]
+ */
+static void roundRobin_priorityChange(OS_TCB_t * const tcb, uint32_t priority) {
+    roundRobin_removeTask(tcb);
+    tcb->priority = priority;
+    roundRobin_insertTask(tcb);
+    SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
 }
 
 /**
- * [roundRobin_wait Sets a task to wait for a resource as long as the fast-fail_fast_count
- *  has not been incremented. Then schedules a task switch. ]
+ * [roundRobin_wait Sets a task to wait for a resource as long as the fail-fast sequence
+ *  of the resource has not been incremented. Then schedules a task switch. ]
  * @param unavailable_resource                 [the semaphore or mutex that is unavialable]
- * @param unavailable_resource_wait_queue_head [the task at the head of the queue]
- * @param fail_fast_counter                    [the fail fast check code]
+ * @param unavailable_resource_wait_list  [the OS_WaitList_t of the resource]
+ * @param fail_fast_sequence                   [the fail fast check code]
  */
-static void roundRobin_wait(void * const unavailable_resource, void * const unavailable_resource_wait_queue_head, uint32_t fail_fast_counter) {
-    /* Only initiate wait if no task notifications have occcurred
+static void roundRobin_wait(void * const unavailable_resource, void * const unavailable_resource_wait_list, uint32_t fail_fast_sequence) {
+    /* Only initiate wait if the resource has not notified any task
         between current task called _OS_wait() and here. */
-    if (fail_fast_counter == OS_currentFastFailCounter()) {
+    if (fail_fast_sequence == ((OS_WaitList_t *)unavailable_resource_wait_list)->sequence) {
 		/* Insert the now waiting task into the wait queue,
             remove it from the runnable scheduler tasks,
 			and finally invoke the scheduler.
             This NEEDS to happen before queueInsert as we are modifying the ->next field. */
         roundRobin_removeTask(OS_currentTCB());
-        wait_queueInsert( (OS_TCB_t **)unavailable_resource_wait_queue_head, OS_currentTCB());
+        wait_queueInsert( (OS_WaitQueue_t **)&((OS_WaitList_t *)unavailable_resource_wait_list)->queue, OS_currentTCB());
         SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
     }
 }
@@ -203,13 +330,51 @@ static void roundRobin_wait(void * const unavailable_resource, void * const unav
 
 /**
  * [roundRobin_notify Notify a task of available resource.]
- * @param available_resource_wait_queue_head [the head of the wait queue to be notified.]
+ * @param available_resource_wait_list  [the OS_WaitList_t to be notified.]
+ * @return                              [the notified task, or 0 if none was waiting]
  */
-static void roundRobin_notify(void * const available_resource_wait_queue_head) {
+static OS_TCB_t * roundRobin_notify(void * const available_resource_wait_list) {
     /* Make the highest priority tasks, that requested this resource first
         when uavailable, runnable, (if any waiting tasks). */
-    OS_TCB_t * waiting_task = wait_queueExtract( (OS_TCB_t **)available_resource_wait_queue_head );
+    OS_TCB_t * waiting_task = wait_queueExtract( (OS_WaitQueue_t **)&((OS_WaitList_t *)available_resource_wait_list)->queue );
     if (waiting_task != 0) {
         roundRobin_insertTask(waiting_task);
+        /* Preempt straight away if the notified task has a higher priority, as the
+            SysTick no longer runs the scheduler on every tick */
+        if (OS_currentTCB() == OS_idleTCB_p || waiting_task->priority > OS_currentTCB()->priority) {
+            SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+        }
+    }
+    return waiting_task;
+}
+
+/**
+ * [roundRobin_tick The tick callback. Checks whether the running task should be
+ *   replaced, which is only if a task of a higher priority is ready, or the time
+ *   slice of the running task has expired while other tasks of the same priority
+ *   are ready. Called from the SysTick handler.]
+ * @return [1 if the scheduler needs to run, 0 otherwise]
+ */
+static uint32_t roundRobin_tick(void) {
+    OS_TCB_t * current_tcb = OS_currentTCB();
+    uint32_t priority;
+
+    if (priorityBitmap_isEmpty(&_ready_priorities)) {
+        return 0;
+    }
+    if (current_tcb == OS_idleTCB_p) {
+        return 1;
+    }
+    priority = current_tcb->priority;
+    /* A higher priority task is ready, or the running task is no longer in the
+        scheduler (the switch away from it has not happened yet) */
+    if (priorityBitmap_highest(&_ready_priorities) != priority || _tasks_pri[priority] != current_tcb) {
+        return 1;
+    }
+    /* Only the running task is ready in its priority, so there is no one to share
+        a time slice with */
+    if (current_tcb->next == current_tcb) {
+        return 0;
     }
+    return (OS_elapsedTicks() - _slice_last_tick) >= _slice_remaining[priority];
 }
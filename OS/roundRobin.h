@@ -29,16 +29,25 @@ extern OS_Scheduler_t const round_robin_scheduler;
      allocated to the OS for sleep functionality, and should be used in 'small'
      systems only due to the schedulers reduced overhead by not implementing
      more intricate features required in larger systems such as aging and resource
-     starvation. */
-#define MAX_TASKS 15
+     starvation. The default tests of main_TEST.c add 17 tasks. */
+#define MAX_TASKS 20
 
 /*  Number of different priority levels - a higher priority is prioritised by
 `    the scheduler over lower priorities.
-    The user should also consider the overhead added by increasing this number,
-     and should aim for a lower number of different priorities if possible.
+    The highest runnable priority is found in constant time, but the user should
+     consider the static memory added by increasing this number (4 bytes per
+     level), and that more than 32 levels uses a slightly slower two-level
+     priority bitmap. At most 256 levels are supported.
     The priorities are 1-indexed from PRIORITY_MAX (PRIORITY_LEVELS - 1)
      down to PRIORITY_MIN (1). */
 #define PRIORITY_LEVELS 5
+
+/*  The default length (in ticks) of the time slice each task gets before the
+     next task of the same priority is run. Longer slices reduce the number of
+     context switches between CPU-bound tasks of equal priority, at the cost
+     of their responsiveness. Can be changed per priority at run time using
+     OS_roundRobinSetTimeSlice. */
+#define ROUNDROBIN_TIME_SLICE 1
 /*****************************************************************************
 **      USER MODIFIABLE CONFIGURATION - END
 **      DO NOT MODIFY ANYTHING BELOW THIS LINE
@@ -60,4 +69,32 @@ extern OS_Scheduler_t const round_robin_scheduler;
 # error "PRIORITY_LEVELS must be at least 1. Please increase PRIORITY_LEVELS.."
 #endif
 
+#if ROUNDROBIN_TIME_SLICE < 1
+# error "ROUNDROBIN_TIME_SLICE must be at least 1. Please increase ROUNDROBIN_TIME_SLICE.."
+#endif
+
+#if PRIORITY_LEVELS > 256
+# error "PRIORITY_LEVELS must be at most 256. Please decrease PRIORITY_LEVELS.."
+#endif
+
+/*=============================================================================
+**       Function Prototypes
+=============================================================================*/
+/**
+ * [OS_roundRobinSetTimeSlice Sets the length of the time slice given to each
+ *   task of a priority before the next task of the same priority is run.
+ *  The new length applies from the next time slice of the priority.]
+ * @param priority [the priority to set the time slice of]
+ * @param ticks    [length of the time slice in ticks, or 0 for ROUNDROBIN_TIME_SLICE]
+ */
+void OS_roundRobinSetTimeSlice(uint32_t priority, uint32_t ticks);
+
+/**
+ * [OS_roundRobinHighestPriority Finds the highest priority with runnable tasks,
+ *   without modifying any scheduler state. Uses the priority bitmap, or a
+ *   linear scan of the priorities with -DROUNDROBIN_LINEAR_SCAN.]
+ * @return  [the highest runnable priority, or 0 if only the idle task can run]
+ */
+uint32_t OS_roundRobinHighestPriority(void);
+
 #endif /* _ROUNDROBIN_H_ */
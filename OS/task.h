@@ -10,8 +10,12 @@
 =============================================================================*/
 /* Describes a single stack frame, as found at the top of the stack of a task
    that is not currently running.  Registers r0-r3, r12, lr, pc and psr are stacked
-	 automatically by the CPU on entry to handler mode.  Registers r4-r11 are subsequently
-	 stacked by the task switcher.  That's why the order is a bit weird. */
+	 automatically by the CPU on entry to handler mode.  Registers r4-r11 and the
+	 EXC_RETURN value are subsequently stacked by the task switcher.  That's why the
+	 order is a bit weird.
+   If the task has used the FPU (EXC_RETURN bit 4 clear), s16-s31 are stacked by the
+     task switcher between exc_return and r0, and s0-s15 and the FPSCR are stacked
+     lazily by the CPU after psr. Neither is described by this structure. */
 typedef struct s_StackFrame {
 	volatile uint32_t r4;
 	volatile uint32_t r5;
@@ -21,6 +25,7 @@ typedef struct s_StackFrame {
 	volatile uint32_t r9;
 	volatile uint32_t r10;
 	volatile uint32_t r11;
+	volatile uint32_t exc_return;
 	volatile uint32_t r0;
 	volatile uint32_t r1;
 	volatile uint32_t r2;
@@ -31,6 +36,27 @@ typedef struct s_StackFrame {
 	volatile uint32_t psr;
 } OS_StackFrame_t;
 
+/* The wait queue of a resource, defined in wait.h */
+typedef struct OS_WaitQueue_t OS_WaitQueue_t;
+
+/* The waiting tasks of a resource (mutex or semaphore). The sequence number is
+    incremented every time the resource notifies a waiting task, and a task that
+    found the resource unavailable only starts to wait if it is unchanged
+    (fail-fast behaviour), so notifications of other resources do not matter.
+   Interrupt handlers can not notify directly, so their notifications are
+    counted, and the wait list is linked into a list processed by PendSV
+    (see _OS_notifyFromISR). */
+typedef struct OS_WaitList_t {
+    /* Pointer to the queue of waiting tasks, or 0 if there are none */
+    OS_WaitQueue_t * volatile queue;
+    /* Fail-fast sequence number of the resource */
+    uint32_t volatile sequence;
+    /* Number of notifications deferred by interrupt handlers, and the next wait
+        list with deferred notifications while this is non-zero */
+    uint32_t volatile deferred;
+    struct OS_WaitList_t * volatile next_deferred;
+} OS_WaitList_t;
+
 typedef struct OS_TCB_t {
 	/* Task stack pointer.  It's important that this is the first entry in the structure,
 	   so that a simple double-dereference of a TCB pointer yields a stack pointer. */
@@ -41,9 +67,25 @@ typedef struct OS_TCB_t {
 	uint32_t volatile state;
 	/* This field holds the task priority  */
 	uint32_t volatile priority;
+    /* Priority inheritance fields, see MUTEX_PRIORITY_INHERITANCE in mutex.h:
+        the priority the task was given, the mutex it is waiting for (or 0), and
+        the first of the mutexes it holds that other tasks are waiting for.
+       The waiting mutex is set regardless, to time out waits for mutexes. */
+    uint32_t volatile base_priority;
+    struct OS_Mutex_t * volatile waiting_mutex;
+    struct OS_Mutex_t * volatile contended_mutexes;
+    /* The wait list of the resource the task is waiting for, used to take the
+        task out of its wait queue if the wait times out */
+    OS_WaitList_t * volatile wait_list;
     /* This field is used to store any data to aid the OS oepration and flow,
 		including awakening times for sleeping tasks. */
 	uint32_t volatile data;
+    /* Earliest-Deadline-First parameters, only used by the edf_scheduler:
+        the absolute deadline of the task's current job, and its relative
+        deadline and period in ticks (see edf.h). */
+    uint32_t volatile deadline;
+    uint32_t volatile relative_deadline;
+    uint32_t volatile period;
     /* Holds the previous task when in a runnable state,
 		implementing a doubly-linked list.  */
     struct OS_TCB_t * volatile prev;
@@ -51,6 +93,13 @@ typedef struct OS_TCB_t {
 		implementing a doubly-linked list. Also used in other places in the
 		OS, including to implement a singly-linked list in the resource wait queue*/
     struct OS_TCB_t * volatile next;
+#ifdef SLEEP_TIMER_WHEEL
+    /* The next sleeping task in the same slot of the timer wheel, and the
+        pointer to this task (the slot, or the sleep_next of the previous task),
+        so that a task can be unlinked without searching (see sleepWheel.c) */
+    struct OS_TCB_t * sleep_next;
+    struct OS_TCB_t ** sleep_pprev;
+#endif
 } OS_TCB_t;
 
 
@@ -61,6 +110,7 @@ typedef struct OS_TCB_t {
 #define TASK_STATE_YIELD    (1UL << 0) // Bit zero is the 'yield' flag 
 #define TASK_STATE_SLEEP    (1UL << 1) // Bit one is the 'sleep' flag 
 #define TASK_STATE_WAIT     (1UL << 2) // Bit two is the 'wait' flag
-#define TASK_STATE_PRIORITY_INHERITED    (1UL << 3) //Bit five is whether or not the task is currently running with inherited priority
+#define TASK_STATE_PRIORITY_INHERITED    (1UL << 3) //Bit three is whether or not the task is currently running with inherited priority
+#define TASK_STATE_TIMEOUT  (1UL << 4) // Bit four is set if the last wait of the task timed out, until it waits or sleeps again
 
 #endif /* _TASK_H_ */
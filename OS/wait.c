@@ -3,89 +3,193 @@
 
 /**
  *  This file is adding wait functionality to the OS, utilised indirectly by
- *   mutex.c and semaphore.c through _OS_wait().
- *  This file specifically implements the Singly Linked Insertion Sorted list
- *   used to maintain wait queue, of which each resource (semaphore or mutex)
- *   has a reference to the head of.
- *  The IS SLL sorts waiting tasks based on priority and is implemented on a
- *   first-come first-served basis.
- *  If the OS scale is expanded, the sorting of waiting tasks would have to be
- *   modified as it scales with the nuber of waiting tasks as O(n).
+ *   mutex.c and semaphore.c through _OS_wait() and its mutex and
+ *   semaphore specific variants.
+ *  This file specifically implements the wait queues of the resources
+ *   (semaphores and mutexes), which hold a first-come first-served bucket of
+ *   waiting tasks for every priority, and a bitmap of the non-empty buckets
+ *   (see priorityBitmap.h).
+ *  Both inserting and extracting a task take constant time, regardless of the
+ *   number of waiting tasks.
+ *  A resource only holds a pointer to its wait queue, so that it stays small.
+ *   As a task can only wait for one resource at a time, at most MAX_TASKS wait
+ *   queues are in use at once, and are taken from a static pool.
  *  IMPORTANT: The next field of the TCB will be modified within this module.
  */
 
+/*=============================================================================
+**      Global Variables
+=============================================================================*/
+/* The pool of wait queues. Queues are handed out in order the first time,
+    and are then reused from the free list. */
+static OS_WaitQueue_t _wait_queue_pool[MAX_TASKS];
+static uint32_t _wait_queue_pool_used = 0;
+static OS_WaitQueue_t * _wait_queue_free = 0;
+
+
 /*=============================================================================
 **      Functions
 =============================================================================*/
+/**
+ * [wait_queueAllocate Takes an empty wait queue from the pool]
+ * @return [pointer to the empty OS_WaitQueue_t]
+ */
+static OS_WaitQueue_t * wait_queueAllocate(void) {
+    OS_WaitQueue_t * queue = _wait_queue_free;
+    if (queue != 0) {
+        _wait_queue_free = queue->next_free;
+        return queue;
+    }
+    /* Can only run out if more than MAX_TASKS tasks are waiting */
+    ASSERT_DEBUG(_wait_queue_pool_used < MAX_TASKS);
+    return &_wait_queue_pool[_wait_queue_pool_used++];
+}
+
 /**
  * [wait_queueInsert Inserts a task into the wait queue of an unavailable
  *   resource (mutex or semaphore).
- *  Inserts the passed TCB into the wait list, sorted by priority and on a
- *   first-come first-served basis. ]
- * @param tcb_wait_queue_head [double pointer to a OS_TCB_t, the head of
- *   the resource's wait queue]
- * @param tcb                 [pointer to the OS_TCB_t to be added to the queue]
+ *  Appends the passed TCB to the bucket of its priority, so tasks of the same
+ *   priority are served on a first-come first-served basis. ]
+ * @param wait_queue [double pointer to the OS_WaitQueue_t of the resource,
+ *   or to 0 if it has no waiting tasks]
+ * @param tcb        [pointer to the OS_TCB_t to be added to the queue]
  */
-void wait_queueInsert(OS_TCB_t ** volatile tcb_wait_queue_head, OS_TCB_t * tcb) {
+void wait_queueInsert(OS_WaitQueue_t ** volatile wait_queue, OS_TCB_t * tcb) {
+    OS_WaitQueue_t * queue = *wait_queue;
+    uint32_t priority = tcb->priority;
+
     /* Make sure that running tasks are not mistaken for waiting tasks in the
         singly linked list. */
     tcb->next = 0;
 
-    /* Check if the mutex have any waiting tasks. If not, add the TCB and
-        return*/
-    if (*tcb_wait_queue_head == 0) {
-        *tcb_wait_queue_head = tcb;
-        return;
+    /* The first waiting task of the resource needs a queue */
+    if (queue == 0) {
+        queue = wait_queueAllocate();
+        *wait_queue = queue;
     }
 
-    /*  If we are here the mutex has at least 1 waiting task. Make a local
-        pointer to the queued task head so we can traverse the list */
-    OS_TCB_t * tcb_queued = *tcb_wait_queue_head;
-
-    /*  Traverse the list, and insert the task based on priority and
-         first-come first-served basis */
-    if ( tcb->priority > tcb_queued->priority ) {
-        /* The inserted task has higher priority than the head - insert first */
-        tcb->next = tcb_queued;
-        *tcb_wait_queue_head = tcb;
+    /* Append to the bucket of the task's priority */
+    if (queue->head[priority] == 0) {
+        queue->head[priority] = tcb;
+        priorityBitmap_set(&queue->priorities, priority);
     } else {
-        /*   While the traversed task priority is bigger than or equal to the
-             task to be inserted, move to the next waiting task. */
-		while ( tcb_queued->next != 0 && tcb->priority >= (tcb_queued->next)->priority ) {
-            tcb_queued = tcb_queued->next;
-        }
-        /*  Insert the task after the traversed task of equal priority and before
-             the next task of lower priority (or end of list).
-            IMPORTANT: ORDER DEPENDENT */
-        tcb->next = tcb_queued->next;
-		tcb_queued->next = tcb;
+        queue->tail[priority]->next = tcb;
     }
+    queue->tail[priority] = tcb;
 }
 
 
  /**
   * [wait_queueExtract Extracts a task from the wait queue of a now available
-  *   resource (mutex or semaphore), and updates the mutex->wait_queue_head to
-  *   the next waiting task.]
-  * @param  tcb_wait_queue_head [double pointer to a OS_TCB_t, the head of
-  *   the resource's wait queue]
-  * @return                     [pointer to the first OS_TCB_t of the highest
+  *   resource (mutex or semaphore). The queue is returned to the pool, and
+  *   the resource's pointer to it cleared, once it is empty.]
+  * @param  wait_queue [double pointer to the OS_WaitQueue_t of the resource,
+  *   or to 0 if it has no waiting tasks]
+  * @return            [pointer to the first OS_TCB_t of the highest
   *   priority which was added to the queue, which is removed from the queue.
   *  IMPORTANT: The caller of this function must verify the return value:
   *   It will be 0 if there were no queued tasks.]
   */
-OS_TCB_t * wait_queueExtract(OS_TCB_t ** volatile tcb_wait_queue_head) {
-    /* Make a local pointer to the head of the queue which we want to return */
-    OS_TCB_t * extracted_tcb = *tcb_wait_queue_head;
-
-    /*  Update the wait list head as long as the current head is not 0, as this
-         ensures that the queue is not corrupted by 'false'/incorrect 'next'
-         data when the TCB address is 0.
-        If updating, update to the next in queue, which will either be a
-         valid TCB address or 0  */
-    if ( extracted_tcb != 0 ) {
-        *tcb_wait_queue_head = (*tcb_wait_queue_head)->next;
+OS_TCB_t * wait_queueExtract(OS_WaitQueue_t ** volatile wait_queue) {
+    OS_WaitQueue_t * queue = *wait_queue;
+    OS_TCB_t * extracted_tcb;
+    uint32_t priority;
+
+    if (queue == 0) {
+        return 0;
+    }
+
+    /* A queue in use always has at least one waiting task */
+    priority = priorityBitmap_highest(&queue->priorities);
+    extracted_tcb = queue->head[priority];
+    queue->head[priority] = extracted_tcb->next;
+
+    /* Clear the bucket when emptied, and return the queue to the pool when
+        no tasks are left waiting */
+    if (queue->head[priority] == 0) {
+        priorityBitmap_clear(&queue->priorities, priority);
+        if (priorityBitmap_isEmpty(&queue->priorities)) {
+            queue->next_free = _wait_queue_free;
+            _wait_queue_free = queue;
+            *wait_queue = 0;
+        }
+    }
+
+    return extracted_tcb;
+}
+
+
+/**
+ * [wait_queueUnlink Unlinks a waiting task from the bucket of its priority.
+ *  The task is searched for in the bucket, which takes time in the number of
+ *  tasks of that priority waiting in the queue.]
+ * @param queue [pointer to the OS_WaitQueue_t the task is waiting in]
+ * @param tcb   [pointer to the waiting OS_TCB_t]
+ */
+static void wait_queueUnlink(OS_WaitQueue_t * queue, OS_TCB_t * tcb) {
+    uint32_t priority = tcb->priority;
+    OS_TCB_t * previous = 0;
+    OS_TCB_t * queued = queue->head[priority];
+
+    while (queued != tcb) {
+        ASSERT_DEBUG(queued != 0);
+        previous = queued;
+        queued = queued->next;
+    }
+    if (previous == 0) {
+        queue->head[priority] = tcb->next;
+    } else {
+        previous->next = tcb->next;
+    }
+    if (queue->tail[priority] == tcb) {
+        queue->tail[priority] = previous;
+    }
+    if (queue->head[priority] == 0) {
+        priorityBitmap_clear(&queue->priorities, priority);
+    }
+}
+
+
+/**
+ * [wait_queueRemove Removes a task from the wait queue of a resource before it
+ *   has been notified (ie when its wait times out). The queue is returned to
+ *   the pool, and the resource's pointer to it cleared, once it is empty.]
+ * @param wait_queue [double pointer to the OS_WaitQueue_t the task is waiting in]
+ * @param tcb        [pointer to the waiting OS_TCB_t]
+ */
+void wait_queueRemove(OS_WaitQueue_t ** volatile wait_queue, OS_TCB_t * tcb) {
+    OS_WaitQueue_t * queue = *wait_queue;
+
+    wait_queueUnlink(queue, tcb);
+    if (priorityBitmap_isEmpty(&queue->priorities)) {
+        queue->next_free = _wait_queue_free;
+        _wait_queue_free = queue;
+        *wait_queue = 0;
     }
+}
+
 
-    return  extracted_tcb;
+/**
+ * [wait_queueChangePriority Moves a waiting task to the back of the bucket of
+ *   its new priority, before the priority of the task is changed (ie when it
+ *   inherits a priority while waiting).
+ *  The task is searched for in the bucket of its old priority, which takes
+ *   time in the number of tasks of that priority waiting in the queue.]
+ * @param queue    [pointer to the OS_WaitQueue_t the task is waiting in]
+ * @param tcb      [pointer to the waiting OS_TCB_t, with its old priority]
+ * @param priority [the new priority of the task]
+ */
+void wait_queueChangePriority(OS_WaitQueue_t * queue, OS_TCB_t * tcb, uint32_t priority) {
+    /* Unlink the task from its old bucket */
+    wait_queueUnlink(queue, tcb);
+
+    /* Append to the bucket of the new priority */
+    tcb->next = 0;
+    if (queue->head[priority] == 0) {
+        queue->head[priority] = tcb;
+        priorityBitmap_set(&queue->priorities, priority);
+    } else {
+        queue->tail[priority]->next = tcb;
+    }
+    queue->tail[priority] = tcb;
 }
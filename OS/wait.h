@@ -2,28 +2,70 @@
 #define _WAIT_H
 
 #include "task.h"
+#include "priorityBitmap.h"
+
+/*=============================================================================
+**       Type Definitions
+=============================================================================*/
+/* The wait queue of a resource (mutex or semaphore), holding a first-come
+    first-served bucket (singly linked through the TCB next field) for every
+    priority level, and a bitmap of the non-empty buckets.
+   Resources only hold a pointer to a wait queue, which is taken from a pool
+    of MAX_TASKS queues in wait.c when the first task has to wait, and returned
+    when the last waiting task is extracted. */
+struct OS_WaitQueue_t {
+    /* Bit p is set if any task of priority p is waiting */
+    OS_PriorityBitmap_t priorities;
+    /* First and last waiting tasks of each priority */
+    OS_TCB_t * head[PRIORITY_LEVELS];
+    OS_TCB_t * tail[PRIORITY_LEVELS];
+    /* Next queue in the pool's free list, when not in use */
+    struct OS_WaitQueue_t * next_free;
+};
+
 
 /*=============================================================================
  *      Function Prototypes for Internal OS Operation.
- *      Used by wait.c and semaphore.c
+ *      Used by the schedulers, and must only be called in handler mode.
 =============================================================================*/
 /**
  * [wait_queueInsert Inserts a task into the wait queue of an unavailable
- *  resource (mutex or semaphore).]
- * @param tcb_wait_queue_head [double pointer to a OS_TCB_t, the head of
- *   the resource's wait queue]
- * @param tcb                 [pointer to the OS_TCB_t to be added to the queue]
+ *  resource (mutex or semaphore), taking a queue from the pool if the
+ *  resource has no waiting tasks.]
+ * @param wait_queue [double pointer to the OS_WaitQueue_t of the resource,
+ *   or to 0 if it has no waiting tasks]
+ * @param tcb        [pointer to the OS_TCB_t to be added to the queue]
  */
-void wait_queueInsert(OS_TCB_t ** tcb_wait_queue_head, OS_TCB_t * tcb);
+void wait_queueInsert(OS_WaitQueue_t ** wait_queue, OS_TCB_t * tcb);
 
 /**
  * [wait_queueExtract Extracts a task from the wait queue of a now available
- *  resource (mutex or semaphore).]
- * @param  tcb_wait_queue_head [double pointer to a OS_TCB_t, the head of
- *   the resource's wait queue]
- * @return                     [pointer to the first OS_TCB_t of the highest
+ *  resource (mutex or semaphore), returning the queue to the pool if it was
+ *  the last waiting task.]
+ * @param  wait_queue [double pointer to the OS_WaitQueue_t of the resource,
+ *   or to 0 if it has no waiting tasks]
+ * @return            [pointer to the first OS_TCB_t of the highest
  *   priority which was added to the queue, which is removed from the queue]
  */
-OS_TCB_t * wait_queueExtract(OS_TCB_t ** tcb_wait_queue_head);
+OS_TCB_t * wait_queueExtract(OS_WaitQueue_t ** wait_queue);
+
+/**
+ * [wait_queueRemove Removes a task from the wait queue of a resource before it
+ *  has been notified (ie when its wait times out), returning the queue to the
+ *  pool if it was the last waiting task.]
+ * @param wait_queue [double pointer to the OS_WaitQueue_t the task is waiting in]
+ * @param tcb        [pointer to the waiting OS_TCB_t]
+ */
+void wait_queueRemove(OS_WaitQueue_t ** wait_queue, OS_TCB_t * tcb);
+
+/**
+ * [wait_queueChangePriority Moves a waiting task to the back of the bucket of
+ *  its new priority, before the priority of the task is changed (ie when it
+ *  inherits a priority while waiting).]
+ * @param queue    [pointer to the OS_WaitQueue_t the task is waiting in]
+ * @param tcb      [pointer to the waiting OS_TCB_t, with its old priority]
+ * @param priority [the new priority of the task]
+ */
+void wait_queueChangePriority(OS_WaitQueue_t * queue, OS_TCB_t * tcb, uint32_t priority);
 
 #endif /* _WAIT_H */
@@ -0,0 +1,146 @@
+#include "memAlloc.h"
+#include "stm32f4xx.h"
+#include "debug.h"
+
+/*  This file is adding a malloc-like allocator to the OS, serving power-of-two
+     size classes from one memory pool (mempool.c) each.
+    The blocks of all classes are carved from one static block of memory, one
+     class after the other, with every class starting on a granule boundary.
+     No granule holds blocks of two classes, so a pointer is mapped back to
+     its class by indexing a table with the granule it lies in.
+    A size is mapped to its class by counting its leading zeros (CLZ), and then
+     to the smallest class with blocks through a table filled at initialisation. */
+
+/*=============================================================================
+**      Global Variables
+=============================================================================*/
+/* The memory pool of every size class */
+static OS_MemPool_t _mem_alloc_pools[MEM_ALLOC_CLASSES];
+/* The address range table. Blocks of class c lie in [bound[c], bound[c+1]) */
+static uint8_t * _mem_alloc_bound[MEM_ALLOC_CLASSES + 1];
+/* The class of the blocks in every granule of the static memory */
+static uint8_t _mem_alloc_granule_class[MEM_ALLOC_GRANULES];
+/* The class to allocate from for every class, which is the smallest class with
+    blocks that is at least as large, or MEM_ALLOC_CLASSES if there is none */
+static uint8_t _mem_alloc_class[MEM_ALLOC_CLASSES];
+
+
+/*=============================================================================
+**      Functions
+=============================================================================*/
+/**
+ * [OS_memAllocInitialise Initialises the size class pools. Must be done
+ *  prior to starting the OS.]
+ * @param static_memory [pointer to statically declared memory to carve the
+ *   blocks from, in order of increasing class. This must fit
+ *   MEM_ALLOC_CLASS_BYTES(c, blocks[c]) summed over all classes c, at most
+ *   MEM_ALLOC_GRANULES granules, and be aligned to 8 bytes for all blocks to be
+ *   aligned as from malloc().
+ *  This static memory MUST be a valid writable and readable memory address,
+ *   and the allocator will not operate correctly/at all if it isn't.]
+ * @param memory_size   [size in bytes of static_memory]
+ * @param blocks        [number of blocks of each class, which may be 0 for
+ *   classes that are not needed]
+ * @return              [OS_OK, or OS_ERR_INVALID if the blocks do not fit in
+ *   memory_size or MEM_ALLOC_GRANULES granules, in which case no class has
+ *   any blocks and OS_memAlloc always returns 0]
+ */
+OS_Status_t OS_memAllocInitialise(void * const static_memory, const uint32_t memory_size, const uint32_t blocks[MEM_ALLOC_CLASSES]) {
+    static const uint32_t no_blocks[MEM_ALLOC_CLASSES] = {0};
+    uint8_t * memory = (uint8_t *)static_memory;
+    uint32_t block_size, granule = 0, granule_end;
+    uint64_t total_size = 0;
+    uint8_t next_class = MEM_ALLOC_CLASSES;
+    OS_Status_t status = OS_OK;
+
+    /*  Simplistic check for whether the supplied memory location is valid.
+        This will only breakpoint if in a DEBUG mode. */
+    ASSERT_DEBUG(static_memory);
+
+    /*  Blocks past the memory or the granule table can not be handed out, as
+         freeing them would read past the table. This is checked in all builds,
+         and no class is given any blocks instead. */
+    for (uint32_t c = 0; c < MEM_ALLOC_CLASSES; c++) {
+        total_size += (((uint64_t)blocks[c] << (MEM_ALLOC_MIN_SHIFT + c)) + MEM_ALLOC_GRANULE - 1) & ~(uint64_t)(MEM_ALLOC_GRANULE - 1);
+    }
+    if (static_memory == 0 || total_size > memory_size ||
+            total_size > ((uint64_t)MEM_ALLOC_GRANULES << MEM_ALLOC_GRANULE_SHIFT)) {
+        ASSERT_DEBUG(0);
+        blocks = no_blocks;
+        status = OS_ERR_INVALID;
+    }
+
+    /* Carve the blocks of every class from the memory, recording the boundaries
+        and the class of the granules taken */
+    for (uint32_t c = 0; c < MEM_ALLOC_CLASSES; c++) {
+        block_size = 1UL << (MEM_ALLOC_MIN_SHIFT + c);
+        _mem_alloc_bound[c] = memory;
+        OS_memPoolInitialise(&_mem_alloc_pools[c], blocks[c] ? memory : 0, blocks[c], block_size);
+        memory += MEM_ALLOC_CLASS_BYTES(c, blocks[c]);
+        granule_end = (memory - (uint8_t *)static_memory) >> MEM_ALLOC_GRANULE_SHIFT;
+        for (; granule < granule_end; granule++) {
+            _mem_alloc_granule_class[granule] = c;
+        }
+    }
+    _mem_alloc_bound[MEM_ALLOC_CLASSES] = memory;
+
+    /* Map every class to the smallest class with blocks that it fits in */
+    for (uint32_t c = MEM_ALLOC_CLASSES; c > 0; c--) {
+        if (blocks[c - 1] != 0) {
+            next_class = c - 1;
+        }
+        _mem_alloc_class[c - 1] = next_class;
+    }
+
+    return status;
+}
+
+/**
+ * [OS_memAlloc Allocates a block of at least the given size, from the smallest
+ *   size class with blocks that it fits in.
+ *  If that class is exhausted (and never freed to), this function will never
+ *   return. The block should be considered to be uninitialised.]
+ * @param  size [size in bytes of the block to allocate]
+ * @return      [pointer to the allocated block, or 0 if no class has blocks
+ *   of at least size bytes]
+ */
+void * OS_memAlloc(const uint32_t size) {
+    uint32_t size_class = 0;
+
+    /* Round up to a power of two: (size - 1) has its highest bit below the
+        next power of two, ie 32 - CLZ(size - 1) is its shift */
+    if (size > (1UL << MEM_ALLOC_MIN_SHIFT)) {
+        if (size > (1UL << MEM_ALLOC_MAX_SHIFT)) {
+            return 0;
+        }
+        size_class = (32 - __CLZ(size - 1)) - MEM_ALLOC_MIN_SHIFT;
+    }
+
+    size_class = _mem_alloc_class[size_class];
+    if (size_class == MEM_ALLOC_CLASSES) {
+        return 0;
+    }
+    return OS_memPoolAllocate(&_mem_alloc_pools[size_class]);
+}
+
+/**
+ * [OS_memFree Frees a block allocated with OS_memAlloc back to its class.
+ *  Freeing 0 does nothing.]
+ * @param block [pointer to the block to free]
+ */
+void OS_memFree(void * const block) {
+    uint8_t * address = (uint8_t *)block;
+    uint32_t size_class;
+
+    if (block == 0) {
+        return;
+    }
+    ASSERT_DEBUG(address >= _mem_alloc_bound[0] && address < _mem_alloc_bound[MEM_ALLOC_CLASSES]);
+
+    /* The class is that of the granule the block lies in */
+    size_class = _mem_alloc_granule_class[(address - _mem_alloc_bound[0]) >> MEM_ALLOC_GRANULE_SHIFT];
+
+    /* Blocks lie a whole number of blocks into their class */
+    ASSERT_DEBUG(((address - _mem_alloc_bound[size_class]) & ((1UL << (MEM_ALLOC_MIN_SHIFT + size_class)) - 1)) == 0);
+    OS_memPoolDeallocate(&_mem_alloc_pools[size_class], block);
+}
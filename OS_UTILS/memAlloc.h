@@ -0,0 +1,138 @@
+#ifndef _MEM_ALLOC_H_
+#define _MEM_ALLOC_H_
+
+#include <stdint.h>
+#include "mempool.h"
+
+/*=============================================================================
+ *  This file adds a malloc-like allocator on top of the memory pools in
+ *   mempool.h, for when blocks of many different sizes are needed.
+ *  It owns one memory pool per power-of-two size class, from
+ *   (1<<MEM_ALLOC_MIN_SHIFT) bytes up to (1<<MEM_ALLOC_MAX_SHIFT) bytes, all
+ *   carved from a single statically declared block of memory with the number
+ *   of blocks of each class set at initialisation. The blocks of every class
+ *   take a whole number of granules of (1<<MEM_ALLOC_GRANULE_SHIFT) bytes.
+ *  A request is served from the smallest class it fits in (skipping classes
+ *   without blocks), and a freed pointer is mapped back to its class by looking
+ *   up the granule it lies in, so both take constant time and, unlike the C
+ *   library heap, the memory can never fragment.
+ *  As with OS_memPoolAllocate, OS_memAlloc waits until a block of its class is
+ *   freed if the class is exhausted. It does not fall back to larger classes.
+===============================================================================
+**       Example Use
+*******************************************************************************
+#include "memAlloc.h"
+//8, 16, 32, ... byte blocks
+static const uint32_t blocks[MEM_ALLOC_CLASSES] = {16, 16, 8, 8, 4, 2, 0, 1};
+__align(8)
+static uint8_t heap[MEM_ALLOC_CLASS_BYTES(0, 16) + MEM_ALLOC_CLASS_BYTES(1, 16) +
+                    MEM_ALLOC_CLASS_BYTES(2, 8) + MEM_ALLOC_CLASS_BYTES(3, 8) +
+                    MEM_ALLOC_CLASS_BYTES(4, 4) + MEM_ALLOC_CLASS_BYTES(5, 2) +
+                    MEM_ALLOC_CLASS_BYTES(7, 1)];
+OS_memAllocInitialise(&heap, sizeof(heap), blocks);
+//Any task:
+char * text = OS_memAlloc(20); //a 32 byte block
+OS_memFree(text);
+=============================================================================*/
+
+
+/*=============================================================================
+**       Macro Definitions
+=============================================================================*/
+/*****************************************************************************
+**      USER MODIFIABLE CONFIGURATION - START
+**      ONLY MODIFY DEFINITIONS DONE IN BETWEN START AND END TAGS
+******************************************************************************/
+/*  Sets the block size of the smallest size class to (1<<MEM_ALLOC_MIN_SHIFT)
+     bytes. Free blocks hold a pointer, so it must be at least 2 (4 bytes). */
+#define MEM_ALLOC_MIN_SHIFT 3
+
+/*  Sets the number of size classes, each holding blocks twice the size of the
+     previous class. */
+#define MEM_ALLOC_CLASSES 8
+
+/*  Sets the granule size to (1<<MEM_ALLOC_GRANULE_SHIFT) bytes. The blocks of
+     every class are rounded up to a whole number of granules, wasting up to a
+     granule per class, and the class of every granule is held in a table of
+     MEM_ALLOC_GRANULES bytes. */
+#define MEM_ALLOC_GRANULE_SHIFT 7
+
+/*  Sets the largest number of granules the static memory may span, ie the
+     largest static memory is MEM_ALLOC_GRANULES << MEM_ALLOC_GRANULE_SHIFT
+     bytes. */
+#define MEM_ALLOC_GRANULES 64
+/*****************************************************************************
+**      USER MODIFIABLE CONFIGURATION - END
+**      DO NOT MODIFY ANYTHING BELOW THIS LINE
+******************************************************************************/
+
+/*=============================================================================
+**       Error checking of Modifiable Definitions Above, DO NOT EDIT
+=============================================================================*/
+#if MEM_ALLOC_MIN_SHIFT < 2
+# error "MEM_ALLOC_MIN_SHIFT must be at least 2, as free blocks hold a pointer."
+#endif
+
+#if MEM_ALLOC_CLASSES < 1 || (MEM_ALLOC_MIN_SHIFT + MEM_ALLOC_CLASSES) > 31
+# error "MEM_ALLOC_CLASSES must be at least 1, with the largest block below 2 GiB."
+#endif
+
+#if MEM_ALLOC_GRANULE_SHIFT < MEM_ALLOC_MIN_SHIFT || MEM_ALLOC_GRANULE_SHIFT > 31
+# error "MEM_ALLOC_GRANULE_SHIFT must be at least MEM_ALLOC_MIN_SHIFT, and below 32."
+#endif
+
+#if MEM_ALLOC_GRANULES < 1
+# error "MEM_ALLOC_GRANULES must be at least 1."
+#endif
+
+/* The block size of the largest class is (1<<MEM_ALLOC_MAX_SHIFT) bytes */
+#define MEM_ALLOC_MAX_SHIFT (MEM_ALLOC_MIN_SHIFT + MEM_ALLOC_CLASSES - 1)
+
+/* The size in bytes of a granule */
+#define MEM_ALLOC_GRANULE (1UL << MEM_ALLOC_GRANULE_SHIFT)
+
+/* The bytes of static memory taken by n blocks of class c, rounded up to a
+    whole number of granules */
+#define MEM_ALLOC_CLASS_BYTES(c, n) \
+    ((((uint32_t)(n) << (MEM_ALLOC_MIN_SHIFT + (c))) + MEM_ALLOC_GRANULE - 1) & ~(MEM_ALLOC_GRANULE - 1))
+
+
+/*=============================================================================
+**       Function Prototypes
+=============================================================================*/
+/**
+ * [OS_memAllocInitialise Initialises the size class pools. Must be done
+ *  prior to starting the OS.]
+ * @param static_memory [pointer to statically declared memory to carve the
+ *   blocks from, in order of increasing class. This must fit
+ *   MEM_ALLOC_CLASS_BYTES(c, blocks[c]) summed over all classes c, at most
+ *   MEM_ALLOC_GRANULES granules, and be aligned to 8 bytes for all blocks to be
+ *   aligned as from malloc().]
+ * @param memory_size   [size in bytes of static_memory]
+ * @param blocks        [number of blocks of each class, which may be 0 for
+ *   classes that are not needed]
+ * @return              [OS_OK, or OS_ERR_INVALID if the blocks do not fit in
+ *   memory_size or MEM_ALLOC_GRANULES granules, in which case no class has
+ *   any blocks and OS_memAlloc always returns 0]
+ */
+OS_Status_t OS_memAllocInitialise(void * const static_memory, const uint32_t memory_size, const uint32_t blocks[MEM_ALLOC_CLASSES]);
+
+/**
+ * [OS_memAlloc Allocates a block of at least the given size, from the smallest
+ *   size class with blocks that it fits in.
+ *  If that class is exhausted (and never freed to), this function will never
+ *   return. The block should be considered to be uninitialised.]
+ * @param  size [size in bytes of the block to allocate]
+ * @return      [pointer to the allocated block, or 0 if no class has blocks
+ *   of at least size bytes]
+ */
+void * OS_memAlloc(const uint32_t size);
+
+/**
+ * [OS_memFree Frees a block allocated with OS_memAlloc back to its class.
+ *  Freeing 0 does nothing.]
+ * @param block [pointer to the block to free]
+ */
+void OS_memFree(void * const block);
+
+#endif /* _MEM_ALLOC_H_ */
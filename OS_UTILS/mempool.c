@@ -1,20 +1,48 @@
 #include "mempool.h"
+#include "stm32f4xx.h"
+#include "os_internal_def.h"
 
 /*  This file is adding Memory Pool functionality to the OS, where the
 	 user can utilise these as a means of static malloc for a embedded system
-     with predetermined structures /structure sizes. */
+     with predetermined structures /structure sizes.
+    The free blocks form a lock-free stack (a Treiber stack), linked through
+     their first word, which is pushed and popped with LDREX/STREX on the head.
+     The semaphore counts the blocks in the stack, so a task only enters the OS
+     to wait when the pool is exhausted (or to notify a waiting task).
+    The stack is safe from the ABA problem (the head being popped and pushed
+     back by other tasks in between reading it and its next block) without a
+     tag in the head: the exclusive access flag is cleared on every context
+     switch, so the STREX fails if any other task ran since the LDREX. A tag
+     would otherwise need a double-word exclusive access, which the M4 lacks.
+    With MEMPOOL_STATS (see mempool.h), the statistics counters are updated
+     with LDREX/STREX as well, so that keeping them needs no lock either. */
 
 /*=============================================================================
 **      Static Function Prototypes
 =============================================================================*/
 /*   */
 /**
- * [memPool_add Adds or deallocates to the pool, but without mutex or semaphore
- *   protection. SHould only be used in initialisation and only from main().]
+ * [memPool_add Adds or deallocates to the pool, but without exclusive access or
+ *   semaphore protection. SHould only be used in initialisation and only from main().]
  * @param  memory_pool [pointer to the OS_MemPool_t to deallocate to]
  * @return             [pointer to the allocated block of memory]
  */
 static void memPool_add(OS_MemPool_t * memory_pool, void * const item);
+static void * memPool_pop(OS_MemPool_t * memory_pool);
+static void memPool_push(OS_MemPool_t * memory_pool, void * const item);
+#ifdef MEMPOOL_STATS
+static uint32_t memPool_statsAdd(uint32_t * counter, const uint32_t value);
+static void memPool_statsAllocated(OS_MemPool_t * memory_pool);
+static void memPool_statsWaited(OS_MemPool_t * memory_pool, const uint32_t start);
+
+
+/*=============================================================================
+**      Global Variables
+=============================================================================*/
+/* The list of initialised pools, in order of initialisation */
+static OS_MemPool_t * _mempool_registered = 0;
+static OS_MemPool_t ** _mempool_registered_tail = &_mempool_registered;
+#endif
 
 
 /*=============================================================================
@@ -34,9 +62,8 @@ static void memPool_add(OS_MemPool_t * memory_pool, void * const item);
  * @param block_size       [size in bytes of each block]
  */
 void OS_memPoolInitialise(OS_MemPool_t * memory_pool, void * const static_memory, const uint32_t number_of_blocks, const uint32_t block_size) {
-    /* Initialise the pool and its protection mechanisms against simultaneous access and depletion. */
+    /* Initialise the pool and its protection mechanism against depletion. */
     memory_pool->head = 0;
-    OS_mutexInitialise(&memory_pool->mutex_rw);
 
     /*  Simplistic check for if the provided memory is a valid address.
         This can also be used to initialise an empty memory pool by
@@ -45,7 +72,7 @@ void OS_memPoolInitialise(OS_MemPool_t * memory_pool, void * const static_memory
     if (static_memory != 0) {
         /*  Instantiate the semaphore with the full amount of tokens, and
              internally add the blocks to the pool without the overhead of
-             mutex and semaphore acquisition/release/give.
+             exclusive access and semaphore give.
             IMPLIES THAT THIS FUNCTION MUST ONLY RUN WHEN THERE IS ONLY
              ONE TASK RUNNING, ie in main(). */
         OS_semaphoreInitialise(&memory_pool->block_avail, number_of_blocks, number_of_blocks);
@@ -66,32 +93,80 @@ void OS_memPoolInitialise(OS_MemPool_t * memory_pool, void * const static_memory
              start the semaphore on 0 rather than the added number of blocks */
         OS_semaphoreInitialise(&memory_pool->block_avail, number_of_blocks, 0);
     }
+
+#ifdef MEMPOOL_STATS
+    /*  The blocks of a pool started without memory count as in use until they
+         are added, so adding them does not take in_use below 0. The peak is
+         only updated by allocations. */
+    memory_pool->stats.blocks = number_of_blocks;
+    memory_pool->stats.in_use = (static_memory != 0) ? 0 : number_of_blocks;
+    memory_pool->stats.peak_in_use = 0;
+    memory_pool->stats.allocations = 0;
+    memory_pool->stats.deallocations = 0;
+    memory_pool->stats.blocked_allocations = 0;
+    memory_pool->stats.wait_ticks = 0;
+
+    /* Register the pool. Only done from main(), so not protected. */
+    memory_pool->next_registered = 0;
+    *_mempool_registered_tail = memory_pool;
+    _mempool_registered_tail = &memory_pool->next_registered;
+#endif
 }
 
 /**
  * [OS_memPoolAllocate Allocate a block of memory to active use from the pool.
  * 	If the pool is empty (and never deallocated to), this function will never
- * 	 return.
+ * 	 return, see OS_memPoolAllocateTimeout.
  * 	An item that has been in the pool should always be considered to be
  * 	 uninitialised, and will not be the same as when deallocated.]
  * @param  memory_pool [pointer to the OS_MemPool_t to deallocate to]
  * @return             [pointer to the allocated block of memory]
  */
 void * OS_memPoolAllocate(OS_MemPool_t * memory_pool) {
-    /* Take a semaphore to make sure there is a block available.
-        When available, aquire the mutex for protection against concurrent access
-        to the same memory. */
+    /* Take a semaphore token to make sure there is a block available, which
+        only waits if the pool is exhausted, then pop the block */
+#ifdef MEMPOOL_STATS
+    /* Try without waiting first, to know whether the allocation had to wait */
+    if (OS_semaphoreTakeTimeout(&memory_pool->block_avail, 0) != OS_OK) {
+        uint32_t start = OS_elapsedTicks();
+        OS_semaphoreTake(&memory_pool->block_avail);
+        memPool_statsWaited(memory_pool, start);
+    }
+    memPool_statsAllocated(memory_pool);
+#else
     OS_semaphoreTake(&memory_pool->block_avail);
-    OS_mutexAcquire(&memory_pool->mutex_rw);
-
-    /* Set the head pointing to the next available block */
-    void ** pool_block = memory_pool->head;
-    memory_pool->head = * pool_block;
-
-    OS_mutexRelease(&memory_pool->mutex_rw);
+#endif
+    return memPool_pop(memory_pool);
+}
 
-    /* return the previous head to the user */
-    return pool_block;
+/**
+ * [OS_memPoolAllocateTimeout Allocate a block of memory as OS_memPoolAllocate,
+ *   but wait for at most the given number of ticks for a block.]
+ * @param  memory_pool [pointer to the OS_MemPool_t to allocate from]
+ * @param  block       [pointer to where to store the pointer to the allocated block]
+ * @param  ticks       [the maximum number of ticks to wait, or 0 to not wait at all]
+ * @return             [OS_OK if allocated, OS_ERR_TIMEOUT otherwise]
+ */
+OS_Status_t OS_memPoolAllocateTimeout(OS_MemPool_t * memory_pool, void ** block, const uint32_t ticks) {
+#ifdef MEMPOOL_STATS
+    /* As OS_memPoolAllocate, but a timed out wait also counts as blocked */
+    OS_Status_t status = OS_semaphoreTakeTimeout(&memory_pool->block_avail, 0);
+    if (status != OS_OK && ticks != 0) {
+        uint32_t start = OS_elapsedTicks();
+        status = OS_semaphoreTakeTimeout(&memory_pool->block_avail, ticks);
+        memPool_statsWaited(memory_pool, start);
+    }
+    if (status != OS_OK) {
+        return OS_ERR_TIMEOUT;
+    }
+    memPool_statsAllocated(memory_pool);
+#else
+    if (OS_semaphoreTakeTimeout(&memory_pool->block_avail, ticks) != OS_OK) {
+        return OS_ERR_TIMEOUT;
+    }
+#endif
+    *block = memPool_pop(memory_pool);
+    return OS_OK;
 }
 
 /**
@@ -103,30 +178,79 @@ void * OS_memPoolAllocate(OS_MemPool_t * memory_pool) {
  * @param item        [pointer to the block of memory to deallocate]
  */
 void OS_memPoolDeallocate(OS_MemPool_t * memory_pool, void * const item) {
-    /* No semaphore is used to protect against overfilling - this would
-        have to be intentionally done on the users side due to how the initialisation
-        works, and is hence left without protection instead of using 2 semaphores. */
-    OS_mutexAcquire(&memory_pool->mutex_rw);
-
-    memPool_add(memory_pool, item);
-
-    /*  First give the semaphore, then release the mutex. It is done in this order
-        to prioritise potential tasks waiting for the mutex over potential tasks
-        waiting for the semaphore, apart from the statistically few cases where
-        the scheduler performs a context switch in between these two lines, where
-        the opposite effect will be seen. This prioritation is due to how notified
-        waiting tasks are inserted into the next running task. */
+    /*  Push the block before giving the token for it, so a task that takes the
+         token always finds a block in the stack. The give only enters the OS
+         if a task is waiting for a block. */
+    memPool_push(memory_pool, item);
+#ifdef MEMPOOL_STATS
+    memPool_statsAdd(&memory_pool->stats.in_use, (uint32_t)-1);
+    memPool_statsAdd(&memory_pool->stats.deallocations, 1);
+#endif
     OS_semaphoreGive(&memory_pool->block_avail);
-    OS_mutexRelease(&memory_pool->mutex_rw);
+}
+
+#ifdef MEMPOOL_STATS
+/**
+ * [OS_memPoolStatsSnapshot Copies the statistics of every initialised memory
+ *   pool, in the order they were initialised.]
+ * @param  snapshots     [pointer to an array of OS_MemPoolSnapshot_t to copy to]
+ * @param  max_snapshots [the length of the array]
+ * @return               [the number of pools copied]
+ */
+uint32_t OS_memPoolStatsSnapshot(OS_MemPoolSnapshot_t * snapshots, const uint32_t max_snapshots) {
+    uint32_t count = 0;
+    for (OS_MemPool_t * pool = _mempool_registered; pool != 0 && count < max_snapshots; pool = pool->next_registered) {
+        snapshots[count].pool = pool;
+        snapshots[count].stats = pool->stats;
+        count++;
+    }
+    return count;
+}
+#endif
+
+/**
+ * [memPool_pop Pops a block from the free block stack.
+ *  Must only be called with a token of the semaphore taken, as the stack is
+ *   then never empty. The next block is read between the LDREX and STREX of
+ *   the head, so the STREX fails if another task has changed the head (or
+ *   the block) in between, see the top of this file.]
+ * @param  memory_pool [pointer to the OS_MemPool_t to pop from]
+ * @return             [pointer to the popped block]
+ */
+static void * memPool_pop(OS_MemPool_t * memory_pool) {
+    void ** block;
+    while (RESOURCE_NOT_AQUIRED) {
+        block = (void **)__LDREXW((uint32_t *)&memory_pool->head);
+        if (__STREXW((uint32_t)*block, (uint32_t *)&memory_pool->head) == STREXW_SUCCESSFUL) {
+            return block;
+        }
+    }
+}
 
+/**
+ * [memPool_push Pushes a block onto the free block stack.
+ *  A memory barrier (DMB) is used as recommended by ARM before the block is
+ *   made available, although not strictly necessary on the M4.]
+ * @param memory_pool [pointer to the OS_MemPool_t to push to]
+ * @param item        [pointer to the block to push]
+ */
+static void memPool_push(OS_MemPool_t * memory_pool, void * const item) {
+    void ** block = item;
+    __DMB();
+    while (RESOURCE_NOT_RETURNED) {
+        *block = (void *)__LDREXW((uint32_t *)&memory_pool->head);
+        if (__STREXW((uint32_t)block, (uint32_t *)&memory_pool->head) == STREXW_SUCCESSFUL) {
+            return;
+        }
+    }
 }
 
 /**
  * [memPool_add  WARNING, this is not protected from concurrent access, corruption and overfilling.
-     Must only be used through OS_memPoolDeallocate(), or via OS_memPoolInitialise() in
-     the main prior to starting the OS via OS_start()
-     Does exactly what OS_memPoolDeallocate does, but without mutex or semaphore
-      protection for improved initialisation time.]
+     Must only be used via OS_memPoolInitialise() in the main prior to starting
+      the OS via OS_start()
+     Does exactly what OS_memPoolDeallocate does, but without exclusive access
+      or semaphore protection for improved initialisation time.]
  * @param memory_pool [pointe to the memory pool to add to]
  * @param item        [the block to add to the pool]
  */
@@ -137,3 +261,51 @@ void memPool_add(OS_MemPool_t * memory_pool, void * const item) {
     * mem_blocks = memory_pool->head;
     memory_pool->head = item;
 }
+
+#ifdef MEMPOOL_STATS
+/**
+ * [memPool_statsAdd Atomically adds to a statistics counter.]
+ * @param  counter [pointer to the counter]
+ * @param  value   [the value to add, which may be (uint32_t)-1 to subtract 1]
+ * @return         [the new value of the counter]
+ */
+static uint32_t memPool_statsAdd(uint32_t * counter, const uint32_t value) {
+    uint32_t count;
+    while (RESOURCE_NOT_AQUIRED) {
+        count = __LDREXW(counter) + value;
+        if (__STREXW(count, counter) == STREXW_SUCCESSFUL) {
+            return count;
+        }
+    }
+}
+
+/**
+ * [memPool_statsAllocated Counts an allocation, raising the peak if the pool
+ *   has never had as many blocks in use.]
+ * @param memory_pool [pointer to the OS_MemPool_t allocated from]
+ */
+static void memPool_statsAllocated(OS_MemPool_t * memory_pool) {
+    uint32_t in_use = memPool_statsAdd(&memory_pool->stats.in_use, 1);
+    memPool_statsAdd(&memory_pool->stats.allocations, 1);
+    while (RESOURCE_NOT_AQUIRED) {
+        if (__LDREXW(&memory_pool->stats.peak_in_use) >= in_use) {
+            __CLREX();
+            return;
+        }
+        if (__STREXW(in_use, &memory_pool->stats.peak_in_use) == STREXW_SUCCESSFUL) {
+            return;
+        }
+    }
+}
+
+/**
+ * [memPool_statsWaited Counts an allocation that had to wait, and the ticks it
+ *   waited for.]
+ * @param memory_pool [pointer to the OS_MemPool_t allocated from]
+ * @param start       [the tick at which the allocation started to wait]
+ */
+static void memPool_statsWaited(OS_MemPool_t * memory_pool, const uint32_t start) {
+    memPool_statsAdd(&memory_pool->stats.blocked_allocations, 1);
+    memPool_statsAdd(&memory_pool->stats.wait_ticks, OS_elapsedTicks() - start);
+}
+#endif
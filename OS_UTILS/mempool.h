@@ -2,13 +2,20 @@
 #define _MEMPOOL_H_
 
 #include <stdint.h>
-#include "mutex.h"
 #include "semaphore.h"
 
 /*=============================================================================
  * This file is adding Memory Pool functionality to the OS, where the
  *   user can utilise these as a means of static malloc for a embedded system
  *   with predetermined structures /structure sizes.
+ * Usage statistics of every pool are optionally kept by defining the following
+ *   constant in the compiler command line options:
+ *       MEMPOOL_STATS
+ *           Every pool counts its blocks in use (and the peak), allocations and
+ *            deallocations, and the allocations that had to wait and for how
+ *            many ticks in total, for sizing the pools. Pools are registered
+ *            when initialised, and OS_memPoolStatsSnapshot copies the
+ *            statistics of all of them. Without it, none of this is compiled.
 ===============================================================================
 **       Example Use
 *******************************************************************************
@@ -20,15 +27,45 @@
 /*=============================================================================
 **       Type Definitions
 =============================================================================*/
-/* A structure to hold a pointer to the last added memory block to the pool,
-    and a mutex and semaphore for protection against exhaustion and
-    corruption of the pool */
+#ifdef MEMPOOL_STATS
+/* The usage statistics of a memory pool. Every counter is updated atomically,
+    but a copy taken while tasks are using the pool may mix counters from
+    before and after an allocation or deallocation. */
 typedef struct {
+    /* The number of blocks the pool was initialised with */
+    uint32_t blocks;
+    /* Blocks currently allocated, and the most ever allocated at once, ie the
+        lowest number of free blocks is (blocks - peak_in_use) */
+    uint32_t in_use, peak_in_use;
+    /* Completed allocations and deallocations */
+    uint32_t allocations, deallocations;
+    /* Allocations that found the pool exhausted and had to wait (including
+        those that timed out), and the ticks they waited in total */
+    uint32_t blocked_allocations, wait_ticks;
+} OS_MemPoolStats_t;
+#endif /* MEMPOOL_STATS */
+
+/* A structure to hold a pointer to the last added memory block to the pool,
+    the top of a lock-free stack of the free blocks, and a semaphore counting
+    the free blocks for protection against exhaustion of the pool */
+typedef struct OS_MemPool_t {
 	void * volatile head;
-    OS_Mutex_t mutex_rw;
     OS_Semaphore_t block_avail;
+#ifdef MEMPOOL_STATS
+    OS_MemPoolStats_t stats;
+    /* Next pool in the list of initialised pools */
+    struct OS_MemPool_t * next_registered;
+#endif
 } OS_MemPool_t;
 
+#ifdef MEMPOOL_STATS
+/* The statistics of one pool, as copied by OS_memPoolStatsSnapshot */
+typedef struct {
+    const OS_MemPool_t * pool;
+    OS_MemPoolStats_t stats;
+} OS_MemPoolSnapshot_t;
+#endif
+
 
 /*=============================================================================
 **       Function Prototypes
@@ -61,7 +98,7 @@ void OS_memPoolDeallocate(OS_MemPool_t * memory_pool, void * const item);
 /**
  * [OS_memPoolAllocate Allocate a block of memory to active use from the pool.
  * 	If the pool is empty (and never deallocated to), this function will never
- * 	 return.
+ * 	 return, see OS_memPoolAllocateTimeout.
  * 	An item that has been in the pool should always be considered to be
  * 	 uninitialised, and will not be the same as when deallocated.]
  * @param  memory_pool [pointer to the OS_MemPool_t to deallocate to]
@@ -69,4 +106,28 @@ void OS_memPoolDeallocate(OS_MemPool_t * memory_pool, void * const item);
  */
 void * OS_memPoolAllocate(OS_MemPool_t * memory_pool);
 
+/**
+ * [OS_memPoolAllocateTimeout Allocate a block of memory as OS_memPoolAllocate,
+ *   but wait for at most the given number of ticks for a block.]
+ * @param  memory_pool [pointer to the OS_MemPool_t to allocate from]
+ * @param  block       [pointer to where to store the pointer to the allocated
+ *   block of memory, left unchanged on timeout]
+ * @param  ticks       [the maximum number of ticks to wait, or 0 to not wait at all]
+ * @return             [OS_OK if allocated, OS_ERR_TIMEOUT otherwise]
+ */
+OS_Status_t OS_memPoolAllocateTimeout(OS_MemPool_t * memory_pool, void ** block, const uint32_t ticks);
+
+#ifdef MEMPOOL_STATS
+/**
+ * [OS_memPoolStatsSnapshot Copies the statistics of every initialised memory
+ *   pool, in the order they were initialised, which includes the size class
+ *   pools of memAlloc.h.]
+ * @param  snapshots     [pointer to an array of OS_MemPoolSnapshot_t to copy to]
+ * @param  max_snapshots [the length of the array]
+ * @return               [the number of pools copied, which is the number of
+ *   initialised pools if the array was long enough]
+ */
+uint32_t OS_memPoolStatsSnapshot(OS_MemPoolSnapshot_t * snapshots, const uint32_t max_snapshots);
+#endif
+
 #endif /* _MEMPOOL_H_ */
@@ -3,6 +3,7 @@
 #include "wait.h"
 #include "stm32f4xx.h"
 #include "os_internal_def.h"
+#include "debug.h"
 
 /**
  *  This file contains the Mutual Exlusion (MutEx) specific section
@@ -21,7 +22,11 @@
 void OS_mutexInitialise (OS_Mutex_t * mutex) {
     mutex->tcb = 0;
     mutex->counter = 0;
-    mutex->wait_queue_head = 0;
+    mutex->wait_list.queue = 0;
+    mutex->wait_list.sequence = 0;
+    mutex->wait_list.deferred = 0;
+    mutex->wait_list.next_deferred = 0;
+    mutex->next_contended = 0;
 }
 
 /**
@@ -33,8 +38,9 @@ void OS_mutexInitialise (OS_Mutex_t * mutex) {
  *   concurrent access - if successful it will clear the processor exclusive
  *   access flag if set prior to entering this function.
  *  Entering wait state is protected from concurrent notification using a
- *   fail-fast check code incremented in _OS_notify - if not equal in _OS_wait
- *   as in this function, return and try again.
+ *   fail-fast sequence number of the mutex, incremented in _OS_notify - if not equal in _OS_wait
+ *   as in this function, return and try again. _OS_mutexWait also returns if
+ *   the mutex has been released without notifying (see MUTEX_HAND_OFF).
  *  A memory barrier (DMB) is used as recommended by ARM after acquiring the mutex,
  *   although not strictly necessary on the M4 (see
  *   http://infocenter.arm.com/help/topic/com.arm.doc.dai0321a/BIHEJCHB.html)]
@@ -54,9 +60,9 @@ void OS_mutexAcquire(OS_Mutex_t * mutex) {
          exclusive access (PEA) flag in between the two calls.
         The flag is reset every context switch and after use of STREX. */
     while (RESOURCE_NOT_AQUIRED) {
-        /*  Set the fast-fail check counter as early within the loop as possible,
+        /*  Set the fast-fail check sequence as early within the loop as possible,
              to catch any tasks that release the mutex in the middle of this execution */
-        fail_fast_check = OS_currentFastFailCounter();
+        fail_fast_check = mutex->wait_list.sequence;
 
         /*  Atomically load the the mutex owner (LDREX) - will set the PEA flag */
         mutex_tcb = (OS_TCB_t *)__LDREXW((uint32_t *)&mutex->tcb);
@@ -68,7 +74,7 @@ void OS_mutexAcquire(OS_Mutex_t * mutex) {
              and if so increment the recursive counter.
             Otherwise, try to put the current task to wait (will return
              immediately if fail_fast_check does not equal the
-             OS_currentFastFailCounter() within wait). */
+             mutex' sequence within wait). */
         if (mutex_tcb == 0) {
             if (__STREXW((uint32_t)OS_currentTCB(), (uint32_t *)&mutex->tcb) == STREXW_SUCCESSFUL) {
                 /*  Mutex was successfully acquired.
@@ -78,7 +84,7 @@ void OS_mutexAcquire(OS_Mutex_t * mutex) {
                 break;
             }
         } else {
-            if (mutex_tcb == OS_currentTCB() ) {
+            if ((OS_TCB_t *)((uint32_t)mutex_tcb & ~MUTEX_WAITERS_FLAG) == OS_currentTCB() ) {
                 /* Mutex was already acquired. No memory barrier required as
                     it's already in place. */
                 break;
@@ -87,7 +93,7 @@ void OS_mutexAcquire(OS_Mutex_t * mutex) {
                      re-acquire mutex once returned (either due to fail-fast
                      behaviour or available mutex).
                     If mutex is never made available this function will never exit.*/
-                _OS_wait(mutex, (void *)&mutex->wait_queue_head, fail_fast_check);
+                _OS_mutexWait(mutex, fail_fast_check, 0);
             }
         }
     }
@@ -96,6 +102,45 @@ void OS_mutexAcquire(OS_Mutex_t * mutex) {
     mutex->counter++;
 }
 
+/**
+ * [OS_mutexAcquireTimeout Acquires the mutex as OS_mutexAcquire, but waits for
+ *   at most the given number of ticks.
+ *  The remaining ticks are passed to _OS_mutexWait every time the task waits,
+ *   which also puts the task to sleep until then. Whether woken by the release
+ *   or the timeout, the task retries, and only gives up once no ticks remain.]
+ * @param  mutex [pointer to a OS_Mutex_t]
+ * @param  ticks [the maximum number of ticks to wait, or 0 to not wait at all]
+ * @return       [OS_OK if (re)taken, OS_ERR_TIMEOUT otherwise]
+ */
+OS_Status_t OS_mutexAcquireTimeout(OS_Mutex_t * mutex, const uint32_t ticks) {
+    uint32_t fail_fast_check, elapsed;
+    uint32_t start = OS_elapsedTicks();
+    OS_TCB_t * mutex_tcb;
+    /* As OS_mutexAcquire */
+    while (RESOURCE_NOT_AQUIRED) {
+        fail_fast_check = mutex->wait_list.sequence;
+        mutex_tcb = (OS_TCB_t *)__LDREXW((uint32_t *)&mutex->tcb);
+        if (mutex_tcb == 0) {
+            if (__STREXW((uint32_t)OS_currentTCB(), (uint32_t *)&mutex->tcb) == STREXW_SUCCESSFUL) {
+                __DMB();
+                break;
+            }
+        } else if ((OS_TCB_t *)((uint32_t)mutex_tcb & ~MUTEX_WAITERS_FLAG) == OS_currentTCB()) {
+            break;
+        } else {
+            /* Give up if the timeout has passed, or wait for the remaining ticks */
+            elapsed = OS_elapsedTicks() - start;
+            if (elapsed >= ticks) {
+                __CLREX();
+                return OS_ERR_TIMEOUT;
+            }
+            _OS_mutexWait(mutex, fail_fast_check, ticks - elapsed);
+        }
+    }
+    mutex->counter++;
+    return OS_OK;
+}
+
 /**
  * [OS_mutexRelease Release the mutex if the current TCB is the owner
  *   (it always should be).
@@ -106,7 +151,13 @@ void OS_mutexAcquire(OS_Mutex_t * mutex) {
  *    (see http://infocenter.arm.com/help/topic/com.arm.doc.dai0321a/BIHEJCHB.html).
  *  If the recursive count has reached 0, meaning this was the last of a balanced
  *   set of acquire and release calls, notify waiting tasks for the
- *   now available resource. ]
+ *   now available resource.
+ *  With MUTEX_HAND_OFF, the mutex is instead handed over to the first waiting
+ *   task by the OS, if any. Waiting tasks are flagged in bit 0 of the owner
+ *   (MUTEX_WAITERS_FLAG), so the check for waiting tasks and the release are
+ *   a single LDREX/STREX of the owner, which fails if a task has started to
+ *   wait in between (as the exclusive access flag is cleared on context
+ *   switches). The OS is only entered if tasks are waiting. ]
  * @param mutex [pointer to a OS_Mutex_t]
  */
 void OS_mutexRelease(OS_Mutex_t * mutex) {
@@ -114,12 +165,25 @@ void OS_mutexRelease(OS_Mutex_t * mutex) {
         There should never be a case where this occurs unless malignantly placed
          by user.
         If the task no longer holds the mutex, clear the mutex and notify waiting tasks. */
-    if (OS_currentTCB() == mutex->tcb) {
+    if (OS_currentTCB() == MUTEX_OWNER(mutex)) {
         /*  Recommended by ARM, but not necessary on M4.
             Ensure memory operations completed before releasing lock */
         __DMB();
         mutex->counter--;
         if (mutex->counter == 0) {
+#if MUTEX_HAND_OFF
+            while (RESOURCE_NOT_AQUIRED) {
+                if (__LDREXW((uint32_t *)&mutex->tcb) & MUTEX_WAITERS_FLAG) {
+                    /* Tasks are waiting, hand the mutex over to the first */
+                    _OS_mutexHandOff(mutex);
+                    break;
+                }
+                if (__STREXW(0, (uint32_t *)&mutex->tcb) == STREXW_SUCCESSFUL) {
+                    /* Released with no tasks waiting */
+                    break;
+                }
+            }
+#else
             mutex->tcb = 0;
             /*  Potential race condition here if another task that hasn't been
                  waiting concurrently tries to acquire the mutex here,
@@ -130,7 +194,45 @@ void OS_mutexRelease(OS_Mutex_t * mutex) {
                  waiting task runnable and run on the next context switch, only
                  to be set to wait again as the mutex was already acquired by
                  the other task that hadn't waited in the first place.*/
-            _OS_notify( (void *)&mutex->wait_queue_head );
+            _OS_notify( (void *)&mutex->wait_list );
+#endif
+        }
+    }
+}
+
+/**
+ * [OS_mutexAcquireFromISR Acquires the mutex from an interrupt handler if it is
+ *   available, or returns straight away.
+ *  The mutex is only available if it has no owner, which also means no tasks
+ *   are waiting for it (MUTEX_WAITERS_FLAG). As no task can run until the
+ *   interrupt handler returns, no task can start to wait while it is held, so
+ *   it can be released without notifying. The LDREX/STREX only protects from
+ *   nested interrupt handlers acquiring the mutex at the same time.]
+ * @param  mutex [pointer to a OS_Mutex_t]
+ * @return       [OS_OK if acquired, OS_ERR_BUSY otherwise]
+ */
+OS_Status_t OS_mutexAcquireFromISR(OS_Mutex_t * mutex) {
+    while (RESOURCE_NOT_AQUIRED) {
+        if (__LDREXW((uint32_t *)&mutex->tcb) != 0) {
+            __CLREX();
+            return OS_ERR_BUSY;
+        }
+        if (__STREXW((uint32_t)MUTEX_ISR_OWNER, (uint32_t *)&mutex->tcb) == STREXW_SUCCESSFUL) {
+            /* Recommended by ARM, but not necessary on M4, as in OS_mutexAcquire */
+            __DMB();
+            return OS_OK;
         }
     }
 }
+
+/**
+ * [OS_mutexReleaseFromISR Releases the mutex acquired by OS_mutexAcquireFromISR.]
+ * @param mutex [pointer to a OS_Mutex_t]
+ */
+void OS_mutexReleaseFromISR(OS_Mutex_t * mutex) {
+    ASSERT_DEBUG(mutex->tcb == MUTEX_ISR_OWNER);
+    /*  Recommended by ARM, but not necessary on M4.
+        Ensure memory operations completed before releasing lock */
+    __DMB();
+    mutex->tcb = 0;
+}
@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include "task.h"
+#include "os.h"
 
 /*=============================================================================
  *  This file contains tools for Mutual Exlusion (MutEx) supported by the OS.
@@ -14,19 +15,83 @@
 =============================================================================*/
 
 
+/*=============================================================================
+**       Definitions
+=============================================================================*/
+/*****************************************************************************
+**      USER MODIFIABLE CONFIGURATION - START
+**      ONLY MODIFY DEFINITIONS DONE IN BETWEN START AND END TAGS
+******************************************************************************/
+/*  Sets whether a released mutex is handed over directly to the highest
+     priority waiting task (1), or released for any task to take (0).
+    With hand-off, the waiting task owns the mutex before it runs, so it can
+     not be taken in between by another task, at the cost of an SVC on every
+     release with waiting tasks. Without it, the woken task has to compete for
+     the mutex again, and may have to go back to waiting. */
+#define MUTEX_HAND_OFF 1
+
+/*  Sets whether tasks holding a mutex inherit the priority of the highest
+     priority task waiting for it (1), or keep their own priority (0).
+    Inheritance is transitive: if the owner is itself waiting for a mutex, the
+     owner of that mutex inherits the priority too. The original priority is
+     restored when the mutex is handed over (or a waiting task times out), so
+     MUTEX_HAND_OFF is required.
+    This bounds the time a high priority task is blocked by a low priority
+     task holding a mutex to the time the mutex is held, instead of also the
+     time any medium priority tasks run in between. */
+#define MUTEX_PRIORITY_INHERITANCE 1
+/*****************************************************************************
+**      USER MODIFIABLE CONFIGURATION - END
+**      DO NOT MODIFY ANYTHING BELOW THIS LINE
+******************************************************************************/
+
+/*=============================================================================
+**       Error checking of Modifiable Definitions Above, DO NOT EDIT
+=============================================================================*/
+#if MUTEX_HAND_OFF != 0 && MUTEX_HAND_OFF != 1
+# error "MUTEX_HAND_OFF must be either 0 or 1."
+#endif
+
+#if MUTEX_PRIORITY_INHERITANCE != 0 && MUTEX_PRIORITY_INHERITANCE != 1
+# error "MUTEX_PRIORITY_INHERITANCE must be either 0 or 1."
+#endif
+
+#if MUTEX_PRIORITY_INHERITANCE && !MUTEX_HAND_OFF
+# error "MUTEX_PRIORITY_INHERITANCE requires MUTEX_HAND_OFF."
+#endif
+
+/*=============================================================================
+**       Internal Definitions
+=============================================================================*/
+/*  Bit 0 of the owner (tcb) field is set by the OS while tasks are waiting for
+     the mutex, which is free as TCBs are word aligned. With MUTEX_HAND_OFF,
+     the release can then check for waiting tasks and release the mutex in a
+     single LDREX/STREX of the same word, and only enters the OS if it is set. */
+#define MUTEX_WAITERS_FLAG 1U
+/*  The owner of a mutex, with the waiters flag masked out */
+#define MUTEX_OWNER(mutex) ((OS_TCB_t *)((uint32_t)(mutex)->tcb & ~MUTEX_WAITERS_FLAG))
+/*  The owner of a mutex held by an interrupt handler (OS_mutexAcquireFromISR),
+     which is never a valid TCB address */
+#define MUTEX_ISR_OWNER ((OS_TCB_t *)~MUTEX_WAITERS_FLAG)
+
+
 /*=============================================================================
 **       Type Definitions
 =============================================================================*/
-/* A structure to hold the mutex owner, recursive counter, and a pointer
-    to the head of a singly linked list of queued tasks waiting for the mutex*/
-typedef struct {
-    /* Pointer to the task that owns of the mutex, or 0 if available. */
+/* A structure to hold the mutex owner, recursive counter, and the tasks
+    waiting for the mutex*/
+typedef struct OS_Mutex_t {
+    /* Pointer to the task that owns of the mutex, or 0 if available. Bit 0 is
+        set while tasks are waiting (MUTEX_WAITERS_FLAG), see MUTEX_OWNER. */
 	OS_TCB_t * volatile tcb;
     /* Counter to allow for recursive access of mutex from within the same task */
     uint32_t volatile counter;
-    /* Pointer to the first task waiting for this mutex to become available,
-    or 0 if there are no waiting tasks. */
-	OS_TCB_t * volatile wait_queue_head;
+    /* The tasks waiting for this mutex to become available, and the mutex'
+        fail-fast sequence number. */
+	OS_WaitList_t wait_list;
+    /* The next mutex held by the same owner that tasks are waiting for, used to
+        restore the owner's priority (MUTEX_PRIORITY_INHERITANCE). */
+    struct OS_Mutex_t * volatile next_contended;
 } OS_Mutex_t;
 
 
@@ -45,13 +110,25 @@ void OS_mutexInitialise (OS_Mutex_t * mutex);
  * [OS_mutexAcquire Aquires the mutex if it is not acquired already,
  *   or waits until it is released if it was not.
  * 	If the mutex is already acquired, this will wait until it is released.
- *  If the mutex is never released elsewhere, this function will never return.
+ *  If the mutex is never released elsewhere, this function will never return,
+ *   see OS_mutexAcquireTimeout.
  *  Once this function returns, the mutex has been successfully (re)taken.
  *  CIMSIS compiler-specific primitives for LDREX and STREX are used within]
  * @param mutex [pointer to the OS_Mutex_t to be acquired]
  */
 void OS_mutexAcquire(OS_Mutex_t * mutex);
 
+/**
+ * [OS_mutexAcquireTimeout Acquires the mutex as OS_mutexAcquire, but waits for
+ *   at most the given number of ticks for it to be released.
+ *  The waiting task is also put to sleep, and is woken by whichever of the
+ *   release and the timeout comes first.]
+ * @param  mutex [pointer to the OS_Mutex_t to be acquired]
+ * @param  ticks [the maximum number of ticks to wait, or 0 to not wait at all]
+ * @return       [OS_OK if (re)taken, OS_ERR_TIMEOUT otherwise]
+ */
+OS_Status_t OS_mutexAcquireTimeout(OS_Mutex_t * mutex, const uint32_t ticks);
+
 /**
  * [OS_mutexRelease Releases the mutex if the task that calls this holds
  * 	 the mutex, and the recursive count is 0. If the recursive count > 0,
@@ -59,10 +136,29 @@ void OS_mutexAcquire(OS_Mutex_t * mutex);
  * 	When this function returns, the mutex' recursive count has been
  * 	 decremented, and depending if the call was the final call of a balanced
  * 	 set of acquire/release calls (count = 0) the mutex will be released and
- * 	 waiting tasks to be notified of its availability.
+ * 	 waiting tasks to be notified of its availability (or, with
+ * 	 MUTEX_HAND_OFF, the mutex to be handed over to the first waiting task).
  *  CIMSIS compiler-specific primitives for LDREX and STREX are used within]
  * @param mutex [pointer to the OS_Mutex_t to be released]
  */
 void OS_mutexRelease(OS_Mutex_t * mutex);
 
+/**
+ * [OS_mutexAcquireFromISR Acquires the mutex from an interrupt handler if it is
+ *   not held by any task (or other interrupt handler), failing instead of
+ *   waiting otherwise. The mutex is not recursive when acquired this way.
+ *  Must be released by OS_mutexReleaseFromISR before the interrupt handler
+ *   returns, so no task ever finds it held by an interrupt handler.]
+ * @param  mutex [pointer to the OS_Mutex_t to be acquired]
+ * @return       [OS_OK if acquired, OS_ERR_BUSY otherwise]
+ */
+OS_Status_t OS_mutexAcquireFromISR(OS_Mutex_t * mutex);
+
+/**
+ * [OS_mutexReleaseFromISR Releases a mutex acquired by OS_mutexAcquireFromISR
+ *   in the same interrupt handler.]
+ * @param mutex [pointer to the OS_Mutex_t to be released]
+ */
+void OS_mutexReleaseFromISR(OS_Mutex_t * mutex);
+
 #endif /* _MUTEX_H_ */
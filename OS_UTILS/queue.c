@@ -4,7 +4,14 @@
 
 /*  This file is adding Inter Task Communication functionality to the OS via
     a simple circular buffer implementation protected by mutexes and 2 semaphores
-    to eliminate any race conditions. */
+    to eliminate any race conditions.
+    Producers reserve the slot at the head, holding the write mutex until the
+    item is committed, and consumers peek at the slot at the tail, holding the
+    read mutex until it is released. Enqueue and dequeue copy the item in and
+    out of these slots.
+    Interrupt handlers can not wait, so OS_queueEnqueueFromISR and
+    OS_queueDequeueFromISR only try to acquire the mutex and take the token,
+    and return a status instead. */
 /*=============================================================================
 **      Functions
 =============================================================================*/
@@ -30,40 +37,44 @@ void OS_queueInitialise(OS_Queue_t * queue, void * const static_memory, const ui
         This will only breakpoint if in a DEBUG mode. s*/
     ASSERT_DEBUG(static_memory);
     queue->start = (uint8_t * )static_memory;
-    queue->end = queue->start + ( (queue->length * queue->item_size) - 1); //this points to the last byte in the given static memory
+    queue->end = queue->start + (queue->length * queue->item_size); //this points to the byte after the given static memory
     queue->head = queue->tail = queue->start;
 
-    OS_mutexInitialise( &queue->mutex_rw );
+    OS_mutexInitialise( &queue->mutex_w );
+    OS_mutexInitialise( &queue->mutex_r );
     OS_semaphoreInitialise( &queue->sem_r, queue->length, 0 );
     OS_semaphoreInitialise( &queue->sem_w, queue->length, queue->length );
 }
 
 /**
- * [OS_queueEnqueue Enqueue an item to the back of the queue if there is
- *   sufficient space, or wait until there is space to enqueue the item.
- *  If the queue is full and no elements ever get removed,
- *   this function will never return.]
- * @param queue [pointer to the OS_Queue_t to enqueue an item to]
- * @param item  [pointer to desired item to enqueue]
+ * [OS_queueReserve Reserves the slot at the back of the queue, waiting until
+ *   there is space if the queue is full, so that an item can be built in
+ *   place without copying. Other producers wait until the item is committed.
+ *  Must be followed by OS_queueCommit from the same task.]
+ * @param  queue [pointer to the OS_Queue_t to reserve a slot in]
+ * @return       [pointer to the reserved slot]
  */
-void OS_queueEnqueue(OS_Queue_t * queue, const void * const potentially_unaligned_item) {
+void * OS_queueReserve(OS_Queue_t * queue) {
     /* Take a token to make sure there is awailable space to write to the queue,
-        the once taken, acquire the mutex for full write access to the queue */
+        the once taken, acquire the mutex for write access to the head */
     OS_semaphoreTake(&queue->sem_w);
-    OS_mutexAcquire(&queue->mutex_rw);
-
-    /* Casting to single byte pointer for safer operation of potentially unaligned
-        items in exchange for performance, see
-        http://infocenter.arm.com/help/index.jsp?topic=/com.arm.doc.faqs/ka3934.html*/
-    uint8_t * single_byte_type_ptr = (uint8_t *)potentially_unaligned_item;
-    memcpy((void *)queue->head, (void *)single_byte_type_ptr, (size_t)queue->item_size);
+    OS_mutexAcquire(&queue->mutex_w);
+    return (void *)queue->head;
+}
 
+/**
+ * [OS_queueCommit Adds the item built in the slot returned by OS_queueReserve
+ *   to the queue, making it available to consumers.]
+ * @param queue [pointer to the OS_Queue_t to commit the reserved slot to]
+ */
+void OS_queueCommit(OS_Queue_t * queue) {
     /* Use uint8_t head to navigate N bytes along the queue, and make sure we
         stay within the memory start and end addresses */
-    queue->head += queue->item_size;
-    if (queue->head >= queue->end) {
-        queue->head = queue->start;
+    uint8_t * head = queue->head + queue->item_size;
+    if (head >= queue->end) {
+        head = queue->start;
     }
+    queue->head = head;
 
     /*  First give the semaphore, then release the mutex. It is done in this order
         to prioritise potential tasks waiting for the mutex over potential tasks
@@ -72,7 +83,62 @@ void OS_queueEnqueue(OS_Queue_t * queue, const void * const potentially_unaligne
         the opposite effect will be seen. This prioritation is due to how notified
         waiting tasks are inserted into the next running task. */
     OS_semaphoreGive(&queue->sem_r);
-    OS_mutexRelease(&queue->mutex_rw);
+    OS_mutexRelease(&queue->mutex_w);
+}
+
+/**
+ * [OS_queuePeek Returns the item at the front of the queue without copying it,
+ *   waiting until there is an item if the queue is empty. The item stays in
+ *   the queue, and other consumers wait, until it is released.
+ *  Must be followed by OS_queueRelease from the same task.]
+ * @param  queue [pointer to the OS_Queue_t to peek at]
+ * @return       [pointer to the item at the front of the queue]
+ */
+void const * OS_queuePeek(OS_Queue_t * queue) {
+    /* Take a token to make sure there is awailable elements to read from the queue,
+        the once taken, acquire the mutex for read access to the tail */
+    OS_semaphoreTake(&queue->sem_r);
+    OS_mutexAcquire(&queue->mutex_r);
+    return (void const *)queue->tail;
+}
+
+/**
+ * [OS_queueRelease Removes the item returned by OS_queuePeek from the queue,
+ *   making its slot available to producers.]
+ * @param queue [pointer to the OS_Queue_t to release the front item of]
+ */
+void OS_queueRelease(OS_Queue_t * queue) {
+    /* Use uint8_t tail to navigate N bytes along the queue, and make sure we
+        stay within the memory start and end addresses */
+    uint8_t * tail = queue->tail + queue->item_size;
+    if (tail >= queue->end) {
+        tail = queue->start;
+    }
+    queue->tail = tail;
+
+    /* Give the semaphore, then release the mutex, as in OS_queueCommit */
+    OS_semaphoreGive(&queue->sem_w);
+    OS_mutexRelease(&queue->mutex_r);
+}
+
+/**
+ * [OS_queueEnqueue Enqueue an item to the back of the queue if there is
+ *   sufficient space, or wait until there is space to enqueue the item.
+ *  If the queue is full and no elements ever get removed,
+ *   this function will never return, see OS_queueEnqueueTimeout.]
+ * @param queue [pointer to the OS_Queue_t to enqueue an item to]
+ * @param item  [pointer to desired item to enqueue]
+ */
+void OS_queueEnqueue(OS_Queue_t * queue, const void * const potentially_unaligned_item) {
+    void * slot = OS_queueReserve(queue);
+
+    /* Casting to single byte pointer for safer operation of potentially unaligned
+        items in exchange for performance, see
+        http://infocenter.arm.com/help/index.jsp?topic=/com.arm.doc.faqs/ka3934.html*/
+    uint8_t * single_byte_type_ptr = (uint8_t *)potentially_unaligned_item;
+    memcpy(slot, (void *)single_byte_type_ptr, (size_t)queue->item_size);
+
+    OS_queueCommit(queue);
 }
 
 
@@ -80,35 +146,238 @@ void OS_queueEnqueue(OS_Queue_t * queue, const void * const potentially_unaligne
  * [OS_queueDequeue Dequeue an item from the front of the queue if it is
  *   not empty, or wait until there is an element to dequeue.
  *  If there no elements are in (or get added to) the queue, this function will
- *    never return.]
+ *    never return, see OS_queueDequeueTimeout.]
  * @param queue       [pointer to the OS_Queue_t to dequeue an item from]
  * @param item_buffer [pointer to desired item_buffer to dequeue to]
  */
 void OS_queueDequeue(OS_Queue_t * queue, void * potentially_unaligned_item_buffer) {
-    /* Take a token to make sure there is awailable elements to read from the queue,
-        the once taken, acquire the mutex for full read access to the queue */
-    OS_semaphoreTake(&queue->sem_r);
-    OS_mutexAcquire(&queue->mutex_rw);
+    void const * item = OS_queuePeek(queue);
 
     /* Casting to single byte pointer for safer operation of potentially unaligned
         items in exchange for performance, see
         http://infocenter.arm.com/help/index.jsp?topic=/com.arm.doc.faqs/ka3934.html*/
     uint8_t * single_byte_type_ptr = (uint8_t *)potentially_unaligned_item_buffer;
-    memcpy((void *)single_byte_type_ptr, (void *)queue->tail, (size_t)queue->item_size);
+    memcpy((void *)single_byte_type_ptr, item, (size_t)queue->item_size);
 
-    /* Use uint8_t teail to navigate N bytes along the queue, and make sure we
-        stay within the memory start and end addresses */
-    queue->tail += queue->item_size;
-    if (queue->tail >= queue->end) {
-        queue->tail = queue->start;
+    OS_queueRelease(queue);
+}
+
+
+/**
+ * [OS_queueEnqueueTimeout Enqueue an item as OS_queueEnqueue, but wait for at
+ *   most the given number of ticks.
+ *  The ticks are shared between taking the token and acquiring the write
+ *   mutex, and the token is given back if the mutex is not acquired in time.]
+ * @param  queue [pointer to the OS_Queue_t to enqueue an item to]
+ * @param  item  [pointer to desired item to enqueue]
+ * @param  ticks [the maximum number of ticks to wait, or 0 to not wait at all]
+ * @return       [OS_OK if enqueued, OS_ERR_TIMEOUT otherwise]
+ */
+OS_Status_t OS_queueEnqueueTimeout(OS_Queue_t * queue, const void * const potentially_unaligned_item, const uint32_t ticks) {
+    uint32_t start = OS_elapsedTicks(), elapsed;
+
+    if (OS_semaphoreTakeTimeout(&queue->sem_w, ticks) != OS_OK) {
+        return OS_ERR_TIMEOUT;
+    }
+    elapsed = OS_elapsedTicks() - start;
+    if (OS_mutexAcquireTimeout(&queue->mutex_w, (elapsed < ticks) ? ticks - elapsed : 0) != OS_OK) {
+        OS_semaphoreGive(&queue->sem_w);
+        return OS_ERR_TIMEOUT;
     }
 
-    /*  First give the semaphore, then release the mutex. It is done in this order
-        to prioritise potential tasks waiting for the mutex over potential tasks
-        waiting for the semaphore, apart from the statistically few cases where
-        the scheduler performs a context switch in between these two lines, where
-        the opposite effect will be seen. This prioritation is due to how notified
-        waiting tasks are inserted into the next running task. */
-    OS_semaphoreGive(&queue->sem_w);
-    OS_mutexRelease(&queue->mutex_rw);
+    /* Copy byte-wise for potentially unaligned items, as in OS_queueEnqueue */
+    memcpy((void *)queue->head, potentially_unaligned_item, (size_t)queue->item_size);
+    OS_queueCommit(queue);
+    return OS_OK;
+}
+
+/**
+ * [OS_queueDequeueTimeout Dequeue an item as OS_queueDequeue, but wait for at
+ *   most the given number of ticks, as OS_queueEnqueueTimeout.]
+ * @param  queue       [pointer to the OS_Queue_t to dequeue an item from]
+ * @param  item_buffer [pointer to desired item_buffer to dequeue to]
+ * @param  ticks       [the maximum number of ticks to wait, or 0 to not wait at all]
+ * @return             [OS_OK if dequeued, OS_ERR_TIMEOUT otherwise]
+ */
+OS_Status_t OS_queueDequeueTimeout(OS_Queue_t * queue, void * potentially_unaligned_item_buffer, const uint32_t ticks) {
+    uint32_t start = OS_elapsedTicks(), elapsed;
+
+    if (OS_semaphoreTakeTimeout(&queue->sem_r, ticks) != OS_OK) {
+        return OS_ERR_TIMEOUT;
+    }
+    elapsed = OS_elapsedTicks() - start;
+    if (OS_mutexAcquireTimeout(&queue->mutex_r, (elapsed < ticks) ? ticks - elapsed : 0) != OS_OK) {
+        OS_semaphoreGive(&queue->sem_r);
+        return OS_ERR_TIMEOUT;
+    }
+
+    /* Copy byte-wise for potentially unaligned items, as in OS_queueDequeue */
+    memcpy(potentially_unaligned_item_buffer, (void const *)queue->tail, (size_t)queue->item_size);
+    OS_queueRelease(queue);
+    return OS_OK;
+}
+
+
+/**
+ * [OS_queueEnqueueN Enqueue up to count items to the back of the queue at once,
+ *   as many as there is space for, or wait until there is space for at least
+ *   one item.
+ *  The items are copied under a single acquisition of the write mutex, with
+ *   at most two copies when wrapping around the end of the queue.]
+ * @param  queue [pointer to the OS_Queue_t to enqueue items to]
+ * @param  items [pointer to the array of items to enqueue]
+ * @param  count [the maximum number of items to enqueue, at least 1]
+ * @return       [the number of items enqueued, the first ones of the array]
+ */
+uint32_t OS_queueEnqueueN(OS_Queue_t * queue, const void * const potentially_unaligned_items, const uint32_t count) {
+    uint32_t enqueued, bytes, first_bytes;
+    uint8_t * head;
+    uint8_t const * single_byte_type_ptr = (uint8_t const *)potentially_unaligned_items;
+
+    /* Take as many tokens as there is space, then acquire the mutex for write
+        access to the head */
+    enqueued = OS_semaphoreTakeUpTo(&queue->sem_w, count);
+    OS_mutexAcquire(&queue->mutex_w);
+
+    /* Copy up to the end of the queue memory, and the rest to the start */
+    head = queue->head;
+    bytes = enqueued * queue->item_size;
+    first_bytes = (uint32_t)(queue->end - head);
+    if (bytes < first_bytes) {
+        first_bytes = bytes;
+    }
+    memcpy((void *)head, (void *)single_byte_type_ptr, (size_t)first_bytes);
+    memcpy((void *)queue->start, (void *)(single_byte_type_ptr + first_bytes), (size_t)(bytes - first_bytes));
+
+    head += bytes;
+    if (head >= queue->end) {
+        head -= queue->length * queue->item_size;
+    }
+    queue->head = head;
+
+    /* Give the semaphore, then release the mutex, as in OS_queueCommit */
+    OS_semaphoreGiveN(&queue->sem_r, enqueued);
+    OS_mutexRelease(&queue->mutex_w);
+    return enqueued;
+}
+
+
+/**
+ * [OS_queueDequeueN Dequeue up to count items from the front of the queue at
+ *   once, as many as there are in the queue, or wait until there is at least
+ *   one item.
+ *  The items are copied under a single acquisition of the read mutex, with
+ *   at most two copies when wrapping around the end of the queue.]
+ * @param  queue        [pointer to the OS_Queue_t to dequeue items from]
+ * @param  items_buffer [pointer to the array to dequeue the items to, which
+ *   must fit count items]
+ * @param  count        [the maximum number of items to dequeue, at least 1]
+ * @return              [the number of items dequeued]
+ */
+uint32_t OS_queueDequeueN(OS_Queue_t * queue, void * potentially_unaligned_items_buffer, const uint32_t count) {
+    uint32_t dequeued, bytes, first_bytes;
+    uint8_t * tail;
+    uint8_t * single_byte_type_ptr = (uint8_t *)potentially_unaligned_items_buffer;
+
+    /* Take as many tokens as there are items, then acquire the mutex for read
+        access to the tail */
+    dequeued = OS_semaphoreTakeUpTo(&queue->sem_r, count);
+    OS_mutexAcquire(&queue->mutex_r);
+
+    /* Copy up to the end of the queue memory, and the rest from the start */
+    tail = queue->tail;
+    bytes = dequeued * queue->item_size;
+    first_bytes = (uint32_t)(queue->end - tail);
+    if (bytes < first_bytes) {
+        first_bytes = bytes;
+    }
+    memcpy((void *)single_byte_type_ptr, (void *)tail, (size_t)first_bytes);
+    memcpy((void *)(single_byte_type_ptr + first_bytes), (void *)queue->start, (size_t)(bytes - first_bytes));
+
+    tail += bytes;
+    if (tail >= queue->end) {
+        tail -= queue->length * queue->item_size;
+    }
+    queue->tail = tail;
+
+    /* Give the semaphore, then release the mutex, as in OS_queueCommit */
+    OS_semaphoreGiveN(&queue->sem_w, dequeued);
+    OS_mutexRelease(&queue->mutex_r);
+    return dequeued;
+}
+
+/**
+ * [OS_queueEnqueueFromISR Enqueue an item to the back of the queue from an
+ *   interrupt handler, if there is space, without waiting.
+ *  The write mutex is acquired first (OS_mutexAcquireFromISR), so the
+ *   interrupt handler never takes a token it can not use. A task holding the
+ *   write mutex has been interrupted in the middle of enqueueing, and the
+ *   interrupt handler can not wait for it to finish. Tasks waiting for an item
+ *   are notified once the interrupt handler returns.]
+ * @param  queue [pointer to the OS_Queue_t to enqueue an item to]
+ * @param  item  [pointer to desired item to enqueue]
+ * @return       [OS_OK if enqueued, OS_ERR_FULL if the queue is full, or
+ *   OS_ERR_BUSY if a task was enqueueing]
+ */
+OS_Status_t OS_queueEnqueueFromISR(OS_Queue_t * queue, const void * const potentially_unaligned_item) {
+    uint8_t * head;
+    if (OS_mutexAcquireFromISR(&queue->mutex_w) != OS_OK) {
+        return OS_ERR_BUSY;
+    }
+    if (OS_semaphoreTakeFromISR(&queue->sem_w) != OS_OK) {
+        OS_mutexReleaseFromISR(&queue->mutex_w);
+        return OS_ERR_FULL;
+    }
+
+    /* Copy byte-wise for potentially unaligned items, as in OS_queueEnqueue */
+    memcpy((void *)queue->head, potentially_unaligned_item, (size_t)queue->item_size);
+    head = queue->head + queue->item_size;
+    if (head >= queue->end) {
+        head = queue->start;
+    }
+    queue->head = head;
+
+    /* Give the semaphore, then release the mutex, as in OS_queueCommit. The
+        token taken from sem_w guarantees there is room in sem_r. */
+    if (OS_semaphoreGiveFromISR(&queue->sem_r) != OS_OK) {
+        ASSERT_DEBUG(0);
+    }
+    OS_mutexReleaseFromISR(&queue->mutex_w);
+    return OS_OK;
+}
+
+/**
+ * [OS_queueDequeueFromISR Dequeue an item from the front of the queue from an
+ *   interrupt handler, if there is one, without waiting.
+ *  The read mutex is acquired first, as in OS_queueEnqueueFromISR, and tasks
+ *   waiting for space are notified once the interrupt handler returns.]
+ * @param  queue       [pointer to the OS_Queue_t to dequeue an item from]
+ * @param  item_buffer [pointer to desired item_buffer to dequeue to]
+ * @return             [OS_OK if dequeued, OS_ERR_EMPTY if the queue is empty,
+ *   or OS_ERR_BUSY if a task was dequeueing]
+ */
+OS_Status_t OS_queueDequeueFromISR(OS_Queue_t * queue, void * potentially_unaligned_item_buffer) {
+    uint8_t * tail;
+    if (OS_mutexAcquireFromISR(&queue->mutex_r) != OS_OK) {
+        return OS_ERR_BUSY;
+    }
+    if (OS_semaphoreTakeFromISR(&queue->sem_r) != OS_OK) {
+        OS_mutexReleaseFromISR(&queue->mutex_r);
+        return OS_ERR_EMPTY;
+    }
+
+    /* Copy byte-wise for potentially unaligned items, as in OS_queueDequeue */
+    memcpy(potentially_unaligned_item_buffer, (void *)queue->tail, (size_t)queue->item_size);
+    tail = queue->tail + queue->item_size;
+    if (tail >= queue->end) {
+        tail = queue->start;
+    }
+    queue->tail = tail;
+
+    /* Give the semaphore, then release the mutex, as in OS_queueRelease */
+    if (OS_semaphoreGiveFromISR(&queue->sem_w) != OS_OK) {
+        ASSERT_DEBUG(0);
+    }
+    OS_mutexReleaseFromISR(&queue->mutex_r);
+    return OS_OK;
 }
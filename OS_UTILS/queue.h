@@ -9,14 +9,27 @@
  *  This file adds inter-task communication to the OS, and can be used
  *   to exchange data between tasks as long as each task has a reference to the
  *   queue and knowledge about what goes in it.
- *  The queue can technically store arbitrarily sized values, given at initialisation,
- *   but should for performance only be used for copying of very small structure,
- *   otherwise pointers to structures will be much more efficient.
+ *  The queue can technically store arbitrarily sized values, given at initialisation.
+ *   OS_queueEnqueue and OS_queueDequeue copy the items in and out of the queue,
+ *   so should for performance only be used for very small structures. Larger
+ *   items can instead be built and read in place in the queue, using
+ *   OS_queueReserve/OS_queueCommit and OS_queuePeek/OS_queueRelease.
 ===============================================================================
 **       Example Use
 *******************************************************************************
 #include "queue.h"
-//TODO
+static OS_Queue_t queue;
+__align(4)
+static Message_t queue_store[8];
+OS_queueInitialise(&queue, &queue_store, 8, sizeof(Message_t));
+//Producer task, building the message in place:
+Message_t * message = OS_queueReserve(&queue);
+message->id = 1;
+OS_queueCommit(&queue);
+//Consumer task, reading the message in place:
+Message_t const * received = OS_queuePeek(&queue);
+process(received->id);
+OS_queueRelease(&queue);
 =============================================================================*/
 
 
@@ -25,13 +38,15 @@
 =============================================================================*/
 /* A structure containing the necessary variables for the queue implemented as
     a ring/circular buffer, including and all required mutexes and semaphores
-    for protection against corruption (mutex preventing simultaneous access) as
+    for protection against corruption (mutexes preventing simultaneous access
+    by several producers to the head, or several consumers to the tail) as
     well as overfilling and exhaustion of the queue (semaphores for access
-    to write and read) */
+    to write and read). As the semaphores keep producers and consumers on
+    different slots, a producer and a consumer can use the queue at once. */
 typedef struct  {
     uint32_t length, item_size;
     uint8_t * start, * end, * volatile head, * volatile tail;
-    OS_Mutex_t mutex_rw;
+    OS_Mutex_t mutex_w, mutex_r;
     OS_Semaphore_t sem_r, sem_w;
 } OS_Queue_t;
 
@@ -60,7 +75,7 @@ void OS_queueInitialise(OS_Queue_t * queue, void * const static_memory, const ui
  * [OS_queueEnqueue Enqueue an item to the back of the queue if there is
  *   sufficient space, or wait until there is space to enqueue the item.
  *  If the queue is full and no elements ever get removed,
- *   this function will never return.]
+ *   this function will never return, see OS_queueEnqueueTimeout.]
  * @param queue [pointer to the OS_Queue_t to enqueue an item to]
  * @param item  [pointer to desired item to enqueue]
  */
@@ -70,10 +85,125 @@ void OS_queueEnqueue(OS_Queue_t * queue, const void * item);
  * [OS_queueDequeue Dequeue an item from the front of the queue if it is
  *   not empty, or wait until there is an element to dequeue.
  *  If there no elements are in (or get added to) the queue, this function will
- *    never return.]
+ *    never return, see OS_queueDequeueTimeout.]
  * @param queue       [pointer to the OS_Queue_t to dequeue an item from]
  * @param item_buffer [pointer to desired item_buffer to dequeue to]
  */
 void OS_queueDequeue(OS_Queue_t * queue, void * item_buffer);
 
+/**
+ * [OS_queueEnqueueTimeout Enqueue an item as OS_queueEnqueue, but wait for at
+ *   most the given number of ticks for space (and for other producers).]
+ * @param  queue [pointer to the OS_Queue_t to enqueue an item to]
+ * @param  item  [pointer to desired item to enqueue]
+ * @param  ticks [the maximum number of ticks to wait, or 0 to not wait at all]
+ * @return       [OS_OK if enqueued, OS_ERR_TIMEOUT otherwise]
+ */
+OS_Status_t OS_queueEnqueueTimeout(OS_Queue_t * queue, const void * item, const uint32_t ticks);
+
+/**
+ * [OS_queueDequeueTimeout Dequeue an item as OS_queueDequeue, but wait for at
+ *   most the given number of ticks for an item (and for other consumers).]
+ * @param  queue       [pointer to the OS_Queue_t to dequeue an item from]
+ * @param  item_buffer [pointer to desired item_buffer to dequeue to]
+ * @param  ticks       [the maximum number of ticks to wait, or 0 to not wait at all]
+ * @return             [OS_OK if dequeued, OS_ERR_TIMEOUT otherwise]
+ */
+OS_Status_t OS_queueDequeueTimeout(OS_Queue_t * queue, void * item_buffer, const uint32_t ticks);
+
+/**
+ * [OS_queueReserve Reserves the slot at the back of the queue, waiting until
+ *   there is space if the queue is full, so that an item can be built in
+ *   place without copying. Other producers wait until the item is committed.
+ *  Must be followed by OS_queueCommit from the same task.]
+ * @param  queue [pointer to the OS_Queue_t to reserve a slot in]
+ * @return       [pointer to the reserved slot, of the queue's item size and
+ *   word aligned if the static memory and item size are]
+ */
+void * OS_queueReserve(OS_Queue_t * queue);
+
+/**
+ * [OS_queueCommit Adds the item built in the slot returned by OS_queueReserve
+ *   to the queue, making it available to consumers. The slot must not be
+ *   accessed after this call.]
+ * @param queue [pointer to the OS_Queue_t to commit the reserved slot to]
+ */
+void OS_queueCommit(OS_Queue_t * queue);
+
+/**
+ * [OS_queuePeek Returns the item at the front of the queue without copying it,
+ *   waiting until there is an item if the queue is empty. The item stays in
+ *   the queue, and other consumers wait, until it is released.
+ *  Must be followed by OS_queueRelease from the same task.]
+ * @param  queue [pointer to the OS_Queue_t to peek at]
+ * @return       [pointer to the item at the front of the queue]
+ */
+void const * OS_queuePeek(OS_Queue_t * queue);
+
+/**
+ * [OS_queueRelease Removes the item returned by OS_queuePeek from the queue,
+ *   making its slot available to producers. The item must not be accessed
+ *   after this call.]
+ * @param queue [pointer to the OS_Queue_t to release the front item of]
+ */
+void OS_queueRelease(OS_Queue_t * queue);
+
+/**
+ * [OS_queueEnqueueN Enqueue up to count items to the back of the queue at
+ *   once, as many as there is space for, or wait until there is space for at
+ *   least one item. Much cheaper per item than OS_queueEnqueue, as the queue is
+ *   only locked once and the items are copied as one block.
+ *  If the queue is full and no elements ever get removed,
+ *   this function will never return.]
+ * @param  queue [pointer to the OS_Queue_t to enqueue items to]
+ * @param  items [pointer to the array of items to enqueue]
+ * @param  count [the maximum number of items to enqueue, at least 1]
+ * @return       [the number of items enqueued, the first ones of the array.
+ *  The caller must enqueue the rest again if fewer than count.]
+ */
+uint32_t OS_queueEnqueueN(OS_Queue_t * queue, const void * items, const uint32_t count);
+
+/**
+ * [OS_queueDequeueN Dequeue up to count items from the front of the queue at
+ *   once, as many as there are in the queue, or wait until there is at least
+ *   one item. Much cheaper per item than OS_queueDequeue, as the queue is
+ *   only locked once and the items are copied as one block.
+ *  If there no elements are in (or get added to) the queue, this function will
+ *    never return.]
+ * @param  queue        [pointer to the OS_Queue_t to dequeue items from]
+ * @param  items_buffer [pointer to the array to dequeue the items to, which
+ *   must fit count items]
+ * @param  count        [the maximum number of items to dequeue, at least 1]
+ * @return              [the number of items dequeued]
+ */
+uint32_t OS_queueDequeueN(OS_Queue_t * queue, void * items_buffer, const uint32_t count);
+
+/**
+ * [OS_queueEnqueueFromISR Enqueue an item to the back of the queue if there is
+ *   sufficient space, for use in interrupt handlers. Never waits, and tasks
+ *   waiting for an item are only notified once the interrupt handler returns.
+ *  Fails with OS_ERR_BUSY if the interrupt handler interrupted a task (or
+ *   another interrupt handler) enqueueing to the same queue, so the queue is
+ *   best only enqueued to by interrupt handlers.]
+ * @param  queue [pointer to the OS_Queue_t to enqueue an item to]
+ * @param  item  [pointer to desired item to enqueue]
+ * @return       [OS_OK if enqueued, OS_ERR_FULL if the queue is full, or
+ *   OS_ERR_BUSY if the queue was being enqueued to]
+ */
+OS_Status_t OS_queueEnqueueFromISR(OS_Queue_t * queue, const void * item);
+
+/**
+ * [OS_queueDequeueFromISR Dequeue an item from the front of the queue if it is
+ *   not empty, for use in interrupt handlers. Never waits, and tasks waiting
+ *   for space are only notified once the interrupt handler returns.
+ *  Fails with OS_ERR_BUSY if the interrupt handler interrupted a task (or
+ *   another interrupt handler) dequeueing from the same queue, so the queue is
+ *   best only dequeued from by interrupt handlers.]
+ * @param  queue       [pointer to the OS_Queue_t to dequeue an item from]
+ * @param  item_buffer [pointer to desired item_buffer to dequeue to]
+ * @return             [OS_OK if dequeued, OS_ERR_EMPTY if the queue is empty,
+ *   or OS_ERR_BUSY if the queue was being dequeued from]
+ */
+OS_Status_t OS_queueDequeueFromISR(OS_Queue_t * queue, void * item_buffer);
+
 #endif /* _QUEUE_H_ */
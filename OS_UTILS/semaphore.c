@@ -12,6 +12,12 @@
  *  with deep appreciation of the OS and potential race conditions.
  */
 
+/*=============================================================================
+**      Static Function Prototypes
+=============================================================================*/
+static void semaphore_notify(OS_Semaphore_t * semaphore, uint32_t count);
+
+
 /*=============================================================================
 **      Functions
 =============================================================================*/
@@ -38,7 +44,10 @@ void OS_semaphoreInitialise (OS_Semaphore_t * semaphore, const uint32_t size, co
         _init_tokens = size;
     }
     semaphore->tokens = _init_tokens;
-    semaphore->wait_queue_head = 0;
+    semaphore->wait_list.queue = 0;
+    semaphore->wait_list.sequence = 0;
+    semaphore->wait_list.deferred = 0;
+    semaphore->wait_list.next_deferred = 0;
 }
 
 
@@ -60,7 +69,10 @@ void OS_semaphoreInitialiseBinary(OS_Semaphore_t * semaphore, const uint32_t ini
         _init_full = semaphore->max_tokens;
     }
     semaphore->tokens = _init_full;
-    semaphore->wait_queue_head = 0;
+    semaphore->wait_list.queue = 0;
+    semaphore->wait_list.sequence = 0;
+    semaphore->wait_list.deferred = 0;
+    semaphore->wait_list.next_deferred = 0;
 }
 
 
@@ -76,7 +88,10 @@ void OS_semaphoreInitialiseBinary(OS_Semaphore_t * semaphore, const uint32_t ini
 void OS_semaphoreInitialiseCounting(OS_Semaphore_t * semaphore) {
     semaphore->max_tokens = 0;
     semaphore->tokens = 0;
-    semaphore->wait_queue_head = 0;
+    semaphore->wait_list.queue = 0;
+    semaphore->wait_list.sequence = 0;
+    semaphore->wait_list.deferred = 0;
+    semaphore->wait_list.next_deferred = 0;
 }
 
 /**
@@ -89,8 +104,11 @@ void OS_semaphoreInitialiseCounting(OS_Semaphore_t * semaphore) {
  *   concurrent access - if successful it will clear the processor exclusive
  *   access flag if set prior to entering this function.
  *  Entering wait state is protected from concurrent notification using a
- *   fail-fast check code incremented in _OS_notify - if not equal in _OS_wait
- *   as in this function, return and try again.]
+ *   fail-fast sequence number of the semaphore, incremented in _OS_notify - if not equal in
+ *   _OS_semaphoreWait as in this function, return and try again.
+ *  Waiting tasks are only notified if there are any, so when uncontended the
+ *   token is taken without entering the OS. _OS_semaphoreWait therefore also
+ *   returns if a token has been given in between without notifying.]
  * @param semaphore [pointer to the OS_Semaphore_t to take a token from]
  */
 void OS_semaphoreTake(OS_Semaphore_t * semaphore) {
@@ -107,32 +125,38 @@ void OS_semaphoreTake(OS_Semaphore_t * semaphore) {
          exclusive access (PEA) flag in between the two calls.
         The flag is reset every context switch and after use of STREX. */
     while (RESOURCE_NOT_AQUIRED) {
-        /*  Set the fast-fail check counter as early within the loop as possible,
+        /*  Set the fast-fail check sequence as early within the loop as possible,
              to catch any tasks that give a token in the middle of this execution */
-        fail_fast_check = OS_currentFastFailCounter();
+        fail_fast_check = semaphore->wait_list.sequence;
 
         /*  Atomically load the the semaphore token (LDREX) - will set the PEA flag */
         token_counter = __LDREXW(&semaphore->tokens);
 
         /*  If the semaphore has available tokens, try to atomically take one (STREX):
             If successfully taken, set a memory barrier and notify other tasks
-             that a token was taken.
+             that a token was taken, if any are waiting.
             STREX requires the PEA flag to be set to be successful, and will clear it.
             If no tokens are available, try to put the current task to wait
              (will return immediately if fail_fast_check does not equal the
-             OS_currentFastFailCounter() within wait). */
+             semaphore's sequence within wait). */
         if (token_counter > 0) {
             if (__STREXW(--token_counter, &semaphore->tokens) == STREXW_SUCCESSFUL) {
-                /* Token was successfully taken. Notify tasks waiting to give a token.*/
-                _OS_notify( (void *)&semaphore->wait_queue_head );
+                /* Token was successfully taken. Notify tasks waiting to give a token.
+                    The barrier makes sure the token is taken before checking for
+                    waiting tasks, as a task can only start to wait while the
+                    semaphore is full (see _OS_semaphoreWait). */
+                __DMB();
+                if (semaphore->wait_list.queue != 0) {
+                    _OS_notify( (void *)&semaphore->wait_list );
+                }
                 return;
             }
         } else {
-            /*  There were no token navailable - call fail-fast _OS_wait, and try
+            /*  There were no token navailable - call fail-fast _OS_semaphoreWait, and try
                  to re-acquire a token once returned (either due to fail-fast
                  behaviour or available token).
                 If token is never made available this function will never exit.*/
-			_OS_wait(semaphore, (void *)&semaphore->wait_queue_head, fail_fast_check);
+			_OS_semaphoreWait(semaphore, fail_fast_check, 0, 0);
         }
     }
 }
@@ -148,15 +172,18 @@ void OS_semaphoreTake(OS_Semaphore_t * semaphore) {
  *   concurrent access - if successful it will clear the processor exclusive
  *   access flag if set prior to entering this function.
  *  Entering wait state is protected from concurrent notification using a
- *   fail-fast check code incremented in _OS_notify - if not equal in _OS_wait
- *   as in this function, return and try again.]
+ *   fail-fast sequence number of the semaphore, incremented in _OS_notify - if not equal in
+ *   _OS_semaphoreWait as in this function, return and try again.
+ *  Waiting tasks are only notified if there are any, so when uncontended the
+ *   token is given without entering the OS. _OS_semaphoreWait therefore also
+ *   returns if a token has been taken in between without notifying.]
  * @param semaphore [pointer to the OS_Semaphore_t to take a token from]
  */
 void OS_semaphoreGive(OS_Semaphore_t * semaphore) {
     uint32_t token_counter, fail_fast_check;
 
-    /* Give back a semaphore token, and notify any waiting tasks regardless of if there are any,
-        that there is a token available. */
+    /* Give back a semaphore token, and notify any waiting tasks that there is
+        a token available. */
 
     /*  Try to give a semaphore token until either:
             a) the semaphore is not full - give the token.
@@ -169,9 +196,9 @@ void OS_semaphoreGive(OS_Semaphore_t * semaphore) {
          exclusive access (PEA) flag in between the two calls.
         The flag is reset every context switch and after use of STREX. */
     while (RESOURCE_NOT_RETURNED) {
-        /*  Set the fast-fail check counter as early within the loop as possible,
+        /*  Set the fast-fail check sequence as early within the loop as possible,
              to catch any tasks that give a token in the middle of this execution */
-        fail_fast_check = OS_currentFastFailCounter();
+        fail_fast_check = semaphore->wait_list.sequence;
 
         /*  Atomically load the the semaphore token (LDREX) - will set the PEA flag */
         token_counter = __LDREXW(&semaphore->tokens);
@@ -179,24 +206,213 @@ void OS_semaphoreGive(OS_Semaphore_t * semaphore) {
         /*  If the semaphore is not full or if this is an un-capped
              semaphore (max_tokens == 0), try to atomically give one token (STREX):
             If successfully given, set a memory barrier and notify other tasks
-             that a token was taken.
+             that a token was given, if any are waiting.
             STREX requires the PEA flag to be set to be successful, and will clear it.
             If the semaphore is full, try to put the current task to wait
              (will return immediately if fail_fast_check does not equal the
-             OS_currentFastFailCounter() within wait). */
+             semaphore's sequence within wait). */
         if (token_counter < semaphore->max_tokens || semaphore->max_tokens == 0 ) {
             /* Token was successfully taken. Notify tasks waiting to give a token. */
             if (__STREXW(++token_counter, &semaphore->tokens) == STREXW_SUCCESSFUL) {
-                _OS_notify( (void *)&semaphore->wait_queue_head );
+                /* The barrier makes sure the token is given before checking for
+                    waiting tasks, as a task can only start to wait while the
+                    semaphore is empty (see _OS_semaphoreWait). */
+                __DMB();
+                if (semaphore->wait_list.queue != 0) {
+                    _OS_notify( (void *)&semaphore->wait_list );
+                }
                 return;
             }
         } else {
             /*  The semaphore was full and we could not give a token - call
-                 fail-fast _OS_wait, and try to give a token once
+                 fail-fast _OS_semaphoreWait, and try to give a token once
                  returned (either due to fail-fast behaviour or that the
                  semaphore is no longer full).
                 If semaphore is never emptied, this function will never exit.*/
-            _OS_wait(semaphore, (void *)&semaphore->wait_queue_head, fail_fast_check);
+            _OS_semaphoreWait(semaphore, fail_fast_check, 1, 0);
+        }
+    }
+}
+
+/**
+ * [OS_semaphoreTakeUpTo Takes up to max_count tokens from a semaphore at once,
+ *   waiting until at least one token is available.
+ *  Tokens are taken through atomic LDREX/STREX operations, and waiting is
+ *   protected from concurrent notification as in OS_semaphoreTake.]
+ * @param  semaphore [pointer to the OS_Semaphore_t to take tokens from]
+ * @param  max_count [the maximum number of tokens to take, at least 1]
+ * @return           [the number of tokens taken, between 1 and max_count]
+ */
+uint32_t OS_semaphoreTakeUpTo(OS_Semaphore_t * semaphore, const uint32_t max_count) {
+    uint32_t token_counter, count, fail_fast_check;
+    ASSERT_DEBUG(max_count > 0);
+
+    while (RESOURCE_NOT_AQUIRED) {
+        /*  Set the fast-fail check sequence as early within the loop as possible,
+             to catch any tasks that give a token in the middle of this execution */
+        fail_fast_check = semaphore->wait_list.sequence;
+
+        /*  Atomically load the the semaphore token (LDREX) - will set the PEA flag */
+        token_counter = __LDREXW(&semaphore->tokens);
+
+        /*  If the semaphore has available tokens, try to atomically take as many
+             as available up to max_count (STREX), and notify tasks waiting to give. */
+        if (token_counter > 0) {
+            count = (token_counter < max_count) ? token_counter : max_count;
+            if (__STREXW(token_counter - count, &semaphore->tokens) == STREXW_SUCCESSFUL) {
+                __DMB();
+                semaphore_notify(semaphore, count);
+                return count;
+            }
+        } else {
+            _OS_semaphoreWait(semaphore, fail_fast_check, 0, 0);
+        }
+    }
+}
+
+/**
+ * [OS_semaphoreGiveN Gives count tokens to a semaphore at once, waiting until
+ *   there is room for all of them if the semaphore would overflow.
+ *  Tokens are given through atomic LDREX/STREX operations, and waiting is
+ *   protected from concurrent notification as in OS_semaphoreGive.]
+ * @param semaphore [pointer to the OS_Semaphore_t to give tokens to]
+ * @param count     [the number of tokens to give, at most the size of the
+ *   semaphore unless it has no upper bound]
+ */
+void OS_semaphoreGiveN(OS_Semaphore_t * semaphore, const uint32_t count) {
+    uint32_t token_counter, fail_fast_check;
+    ASSERT_DEBUG(count <= semaphore->max_tokens || semaphore->max_tokens == 0);
+    if (count == 0) {
+        return;
+    }
+
+    while (RESOURCE_NOT_RETURNED) {
+        /*  Set the fast-fail check sequence as early within the loop as possible,
+             to catch any tasks that take a token in the middle of this execution */
+        fail_fast_check = semaphore->wait_list.sequence;
+
+        /*  Atomically load the the semaphore token (LDREX) - will set the PEA flag */
+        token_counter = __LDREXW(&semaphore->tokens);
+
+        /*  If there is room for all tokens or if this is an un-capped semaphore,
+             try to atomically give them (STREX), and notify tasks waiting to take. */
+        if (token_counter + count <= semaphore->max_tokens || semaphore->max_tokens == 0) {
+            if (__STREXW(token_counter + count, &semaphore->tokens) == STREXW_SUCCESSFUL) {
+                __DMB();
+                semaphore_notify(semaphore, count);
+                return;
+            }
+        } else {
+            _OS_semaphoreWait(semaphore, fail_fast_check, count, 0);
+        }
+    }
+}
+
+/**
+ * [OS_semaphoreTakeTimeout Takes a semaphore token as OS_semaphoreTake, but
+ *   waits for at most the given number of ticks.
+ *  The remaining ticks are passed to _OS_semaphoreWait every time the task
+ *   waits, as in OS_mutexAcquireTimeout.]
+ * @param  semaphore [pointer to the OS_Semaphore_t to take a token from]
+ * @param  ticks     [the maximum number of ticks to wait, or 0 to not wait at all]
+ * @return           [OS_OK if a token was taken, OS_ERR_TIMEOUT otherwise]
+ */
+OS_Status_t OS_semaphoreTakeTimeout(OS_Semaphore_t * semaphore, const uint32_t ticks) {
+    uint32_t token_counter, fail_fast_check, elapsed;
+    uint32_t start = OS_elapsedTicks();
+
+    /* As OS_semaphoreTake */
+    while (RESOURCE_NOT_AQUIRED) {
+        fail_fast_check = semaphore->wait_list.sequence;
+        token_counter = __LDREXW(&semaphore->tokens);
+        if (token_counter > 0) {
+            if (__STREXW(--token_counter, &semaphore->tokens) == STREXW_SUCCESSFUL) {
+                __DMB();
+                if (semaphore->wait_list.queue != 0) {
+                    _OS_notify( (void *)&semaphore->wait_list );
+                }
+                return OS_OK;
+            }
+        } else {
+            /* Give up if the timeout has passed, or wait for the remaining ticks */
+            elapsed = OS_elapsedTicks() - start;
+            if (elapsed >= ticks) {
+                __CLREX();
+                return OS_ERR_TIMEOUT;
+            }
+            _OS_semaphoreWait(semaphore, fail_fast_check, 0, ticks - elapsed);
+        }
+    }
+}
+
+/**
+ * [OS_semaphoreTakeFromISR Takes a semaphore token from an interrupt handler,
+ *   failing instead of waiting if none is available.
+ *  The token is taken through atomic LDREX/STREX operations as in
+ *   OS_semaphoreTake, and tasks waiting to give a token are notified by
+ *   PendSV once the interrupt handler returns (see _OS_notifyFromISR).]
+ * @param  semaphore [pointer to the OS_Semaphore_t to take a token from]
+ * @return           [OS_OK if a token was taken, OS_ERR_EMPTY otherwise]
+ */
+OS_Status_t OS_semaphoreTakeFromISR(OS_Semaphore_t * semaphore) {
+    uint32_t token_counter;
+    while (RESOURCE_NOT_AQUIRED) {
+        token_counter = __LDREXW(&semaphore->tokens);
+        if (token_counter == 0) {
+            __CLREX();
+            return OS_ERR_EMPTY;
         }
+        if (__STREXW(token_counter - 1, &semaphore->tokens) == STREXW_SUCCESSFUL) {
+            /* The barrier makes sure the token is taken before checking for
+                waiting tasks, as in OS_semaphoreTake */
+            __DMB();
+            if (semaphore->wait_list.queue != 0) {
+                _OS_notifyFromISR(&semaphore->wait_list);
+            }
+            return OS_OK;
+        }
+    }
+}
+
+/**
+ * [OS_semaphoreGiveFromISR Gives a semaphore token from an interrupt handler,
+ *   failing instead of waiting if the semaphore is full.
+ *  The token is given through atomic LDREX/STREX operations as in
+ *   OS_semaphoreGive, and tasks waiting to take a token are notified by
+ *   PendSV once the interrupt handler returns (see _OS_notifyFromISR).]
+ * @param  semaphore [pointer to the OS_Semaphore_t to give a token to]
+ * @return           [OS_OK if a token was given, OS_ERR_FULL otherwise]
+ */
+OS_Status_t OS_semaphoreGiveFromISR(OS_Semaphore_t * semaphore) {
+    uint32_t token_counter;
+    while (RESOURCE_NOT_RETURNED) {
+        token_counter = __LDREXW(&semaphore->tokens);
+        if (token_counter >= semaphore->max_tokens && semaphore->max_tokens != 0) {
+            __CLREX();
+            return OS_ERR_FULL;
+        }
+        if (__STREXW(token_counter + 1, &semaphore->tokens) == STREXW_SUCCESSFUL) {
+            /* The barrier makes sure the token is given before checking for
+                waiting tasks, as in OS_semaphoreGive */
+            __DMB();
+            if (semaphore->wait_list.queue != 0) {
+                _OS_notifyFromISR(&semaphore->wait_list);
+            }
+            return OS_OK;
+        }
+    }
+}
+
+/**
+ * [semaphore_notify Notifies up to count waiting tasks after count tokens have
+ *   been taken or given at once, as each of them may be able to continue.
+ *  Stops as soon as no tasks are left waiting, so does not enter the OS when
+ *   uncontended.]
+ * @param semaphore [pointer to the OS_Semaphore_t tokens were taken or given]
+ * @param count     [the number of tokens taken or given]
+ */
+static void semaphore_notify(OS_Semaphore_t * semaphore, uint32_t count) {
+    while (count-- > 0 && semaphore->wait_list.queue != 0) {
+        _OS_notify( (void *)&semaphore->wait_list );
     }
 }
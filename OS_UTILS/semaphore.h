@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include "task.h"
+#include "os.h"
 
 /*=============================================================================
  *  This file contains tools for task synchronisation (semaphores) supported
@@ -19,16 +20,15 @@
 **       Type Definitions
 =============================================================================*/
 /*  A structure to hold the available semaphore tokens, the size of
-	 the semaphore, and and a pointer to the head of a singly linked list
-     of queued tasks waiting to give/tokens. */
+	 the semaphore, and and the tasks waiting to give/take tokens. */
 typedef struct {
     /* The current number of tokens held by the semaphore */
     uint32_t volatile tokens;
     /* The max number of tokens held by the semaphore */
     uint32_t volatile max_tokens;
-    /* Pointer to the first task waiting for this semaphore to become available,
-    or 0 if there are no waiting tasks. */
-	OS_TCB_t * volatile wait_queue_head;
+    /* The tasks waiting for this semaphore to become available, and the
+        semaphore's fail-fast sequence number. */
+	OS_WaitList_t wait_list;
 } OS_Semaphore_t;
 
 
@@ -72,7 +72,8 @@ void OS_semaphoreInitialiseCounting(OS_Semaphore_t * semaphore);
 /**
  * [OS_semaphoreTake Takes a semaphore token if available.
  *  If a token is not  available, this will wait until it is made available.
- *  If a token is never returned elsewhere, this function will never return.
+ *  If a token is never returned elsewhere, this function will never return,
+ *   see OS_semaphoreTakeTimeout.
  *  Once this function returns, a token has been successfully taken.
  *  CIMSIS compiler-specific primitives for LDREX and STREX are used within.]
  * @param semaphore [pointer to the OS_Semaphore_t to take a token from]
@@ -89,4 +90,55 @@ void OS_semaphoreTake(OS_Semaphore_t * semaphore);
  */
 void OS_semaphoreGive(OS_Semaphore_t * semaphore);
 
+/**
+ * [OS_semaphoreTakeUpTo Takes up to max_count tokens at once if any are
+ *  available, or waits until at least one is made available.
+ *  If a token is never returned elsewhere, this function will never return.
+ *  CIMSIS compiler-specific primitives for LDREX and STREX are used within.]
+ * @param  semaphore [pointer to the OS_Semaphore_t to take tokens from]
+ * @param  max_count [the maximum number of tokens to take, at least 1]
+ * @return           [the number of tokens taken, between 1 and max_count]
+ */
+uint32_t OS_semaphoreTakeUpTo(OS_Semaphore_t * semaphore, const uint32_t max_count);
+
+/**
+ * [OS_semaphoreGiveN Gives count tokens at once if there is room for all of
+ *  them, or waits until enough tokens are taken.
+ *  If enough tokens are never taken elsewhere, this function will never return.
+ *  CIMSIS compiler-specific primitives for LDREX and STREX are used within]
+ * @param semaphore [pointer to the OS_Semaphore_t to give tokens to]
+ * @param count     [the number of tokens to give, at most the size of the
+ *   semaphore unless it has no upper bound]
+ */
+void OS_semaphoreGiveN(OS_Semaphore_t * semaphore, const uint32_t count);
+
+/**
+ * [OS_semaphoreTakeTimeout Takes a semaphore token as OS_semaphoreTake, but
+ *   waits for at most the given number of ticks for one to be given.
+ *  The waiting task is also put to sleep, and is woken by whichever of the
+ *   give and the timeout comes first.]
+ * @param  semaphore [pointer to the OS_Semaphore_t to take a token from]
+ * @param  ticks     [the maximum number of ticks to wait, or 0 to not wait at all]
+ * @return           [OS_OK if a token was taken, OS_ERR_TIMEOUT otherwise]
+ */
+OS_Status_t OS_semaphoreTakeTimeout(OS_Semaphore_t * semaphore, const uint32_t ticks);
+
+/**
+ * [OS_semaphoreTakeFromISR Takes a semaphore token if available, for use in
+ *  interrupt handlers. Never waits, and tasks waiting to give a token are only
+ *  notified once the interrupt handler has returned.]
+ * @param  semaphore [pointer to the OS_Semaphore_t to take a token from]
+ * @return           [OS_OK if a token was taken, OS_ERR_EMPTY otherwise]
+ */
+OS_Status_t OS_semaphoreTakeFromISR(OS_Semaphore_t * semaphore);
+
+/**
+ * [OS_semaphoreGiveFromISR Gives a semaphore token if the semaphore is not
+ *  full, for use in interrupt handlers. Never waits, and tasks waiting to take
+ *  a token are only notified once the interrupt handler has returned.]
+ * @param  semaphore [pointer to the OS_Semaphore_t to give a token to]
+ * @return           [OS_OK if a token was given, OS_ERR_FULL otherwise]
+ */
+OS_Status_t OS_semaphoreGiveFromISR(OS_Semaphore_t * semaphore);
+
 #endif /* _SEMAPHORE_H_ */
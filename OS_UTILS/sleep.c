@@ -1,7 +1,6 @@
 #include "sleep.h"
 #include "task.h"
 #include "roundRobin.h"
-#include "mutex.h"
 #include "os_internal.h"
 #include "os_internal_def.h"
 #include "debug.h"
@@ -14,38 +13,25 @@
     The sleep functionality is not affected by an overflowing SysTick counter,
      but as a result can only work with a maximum sleeping duration of
      (31^2 -1) ticks, around 24.95 days instead of (32^2 -1) or 49.9 days.
+    With SLEEP_TIMER_WHEEL, only OS_sleepUntil is compiled from this file, and
+     the sleeping tasks are held in the timer wheel of sleepWheel.c instead.
+    The heap is only ever modified in handler mode (SVC and PendSV, which can not
+     preempt each other), and only read by the SysTick handler: tasks are inserted by the sleep SVC handler (OS_sleep), and
+     extracted or removed by the scheduler and the notifying handlers. Tasks
+     waiting for a resource with a timeout are in both a wait queue and the
+     heap, and are removed from whichever they are not woken by.
 
     This increases the static memory requirements of the OS by
         +   MAX_TASKS * 4 bytes     -   Minimum Binary Heap Array)
         +   4 bytes                 -   Heap length
-        +   4 bytes                 -   Fail-Fast Counter
-        +   12 bytes                -   Protective Mutex
-        =   MAX_TASKS * 4 bytes + 20 bytes                  */
-
-/*=============================================================================
-**      Internal Macro Definitions
-=============================================================================*/
-/**
-* [sleep_time1IsAfterTime2 Macro funtion calculates whether time1 is after time2
-*    while taking into account potential overflows, based on modular arithmetic
-*    on uint32_t.
-*   This limits the sleep check to HALF_OF_UINT32_T_MAX, where any differences
-*    equal to or over this (31^2 -1) will cause undefined behavour.]
-* @param  time_1 [the time to check if is after 'time2']
-* @param  time_2 [the second time to compare against]
-* @param  ref_time  [the reference time to calculate time intervals from/to]
-* @return uint32_t  [   1 if time_1 is after time_2 (including after overflow),
-*                       0 if time_1 is equal to or before time_2]
-*/
-#define sleep_time1IsAfterTime2(time_1,time_2,ref_time) ( ( (uint32_t)( (uint32_t)(time_1)-(uint32_t)(ref_time) ) > \
-                                                        (uint32_t)( (uint32_t)(time_2)-(uint32_t)(ref_time) )) )
+        =   MAX_TASKS * 4 bytes + 4 bytes                  */
 
+#ifndef SLEEP_TIMER_WHEEL
 /*=============================================================================
 **      Static Function Prototypes
 =============================================================================*/
-static void sleep_heapUp(void);
-static void sleep_heapDown(void);
-static void sleep_heapInsert(OS_TCB_t * tcb);
+static void sleep_heapUp(uint32_t tcb_index);
+static void sleep_heapDown(uint32_t tcb_index);
 static void sleep_heapSwapElements(uint32_t * elementIndexMain, uint32_t elementIndexSub);
 
 /*=============================================================================
@@ -58,61 +44,45 @@ static void sleep_heapSwapElements(uint32_t * elementIndexMain, uint32_t element
 static OS_TCB_t * volatile _heap_store[MAX_TASKS];
 /* The length of the heap */
 static uint32_t volatile _heap_length = 0;
-/*  Fail-Fast counter check to make sure non-protected removal of sleeping tasks
-     by the scheduler interrupts protected insertion of a task.
-    This cannot be protected with mutexes as the scheduler cannot be waiting and
-     hence should never be held by a mutex. */
-static uint32_t volatile _sleep_fail_fast_counter = 0;
-/* A mutex to protect simultaneous attempts at modification of the heap.
-    To reduce any overhead, mutexes only surround the actual modifications,
-    inside heapInsert and heapRemove. */
-static OS_Mutex_t _sleep_mutex = {
-    .tcb = 0,
-    .counter = 0,
-    .wait_queue_head = 0
-};
+#endif
 
 /*=============================================================================
 **      Functions
 =============================================================================*/
 /**
- * [OS_sleep Put the current task to sleep for at least the provided value (ms).
- *  The task is guaranteed to be set to be set runnable again after the provided
- *   value of ticks, but the time until it actually runs after the sleep might be
- *   longer than this and depends on other tasks in the system.
- *  Must never be called outside a task.
- *  Overflow of the SysTick is dealt with by comparing the difference of the
- *   two signed integers, and will work as long as the tasks are not set to sleep
- *   for more than half the full duration of the SysTick - maximum (2^32-1)/2 ticks.
- *  If this is adhered to, overflow of the SysTick should not cause
- *   erronous task awakenings. ]
- * @param sleep_in_ms [time to wait in milliseconds - must not be bigger than
-    (31^2 -1) ticks (around 24.95 days) as behaviour will be unpredictable ]
+ * [OS_sleepUntil Put the current task to sleep until one period after its
+ *   last awakening time, skipping any periods that have already passed.
+ *  The awakening time is passed to the OS as an absolute time (_OS_sleepUntil),
+ *   so being preempted before sleeping does not delay it. A time that passes
+ *   in between is already due once inserted, and the task is awoken on the
+ *   next scheduler run.
+ *  Overflow of the SysTick is dealt with by comparing the times with
+ *   sleep_time1IsAfterTime2, as long as the period and any overrun are less
+ *   than half the full duration of the SysTick.]
+ * @param  last_wake [pointer to the last awakening time, updated to the next]
+ * @param  period    [the period in ticks]
+ * @return           [the number of periods missed since the last awakening]
  */
-void OS_sleep(const uint32_t sleep_in_ms) {
-    /* Get the current time as soon as possible to make the sleep as accurate
-        as possible, not taking into account the extra scheduler overhead */
+uint32_t OS_sleepUntil(uint32_t * const last_wake, const uint32_t period) {
     uint32_t current_time = OS_elapsedTicks();
-
-    /* Local pointer to the TCB to not call OS_currentTCB() multiple times */
-    OS_TCB_t * tcb = OS_currentTCB();
-
-    /* Store the time the tasks should be awoken in the tasks' data field.
-        Overflow of this is handled in the internal functions when comparing
-        awakening times. */
-    tcb->data = current_time + sleep_in_ms;
-
-    /*  Finally, insert the TCB and call _OS_removeTask(tcb) which will remove
-         the TCB from the runnable tasks in the scheduler and trigger a task change.
-        Checking the length of the queue to see if there is space is not necessary
-         as we know the queue can hold all tasks in the system.
-        These two statements must not be switched - the task must run until it
-         has palced itself fully into the sleep heap. */
-    sleep_heapInsert(tcb);
-    _OS_removeTask(tcb);
+    uint32_t next_wake = *last_wake + period;
+    uint32_t overruns = 0;
+    ASSERT_DEBUG(period != 0 && period < HALF_OF_UINT32_T_MAX);
+
+    /*  The task is awoken once the ticks are after next_wake, so that awakening
+         has been missed if the current time is already after it. Skip the
+         missed periods, up to the first awakening still to come. */
+    if (sleep_time1IsAfterTime2(current_time, next_wake, current_time + HALF_OF_UINT32_T_MAX)) {
+        overruns = (current_time - next_wake - 1) / period + 1;
+        next_wake += overruns * period;
+    }
+    *last_wake = next_wake;
+    _OS_sleepUntil(next_wake);
+    return overruns;
 }
 
 
+#ifndef SLEEP_TIMER_WHEEL
 /**
  * [sleep_taskNeedsAwakening Check whether the top element, if any,
  *  requires awakening.]
@@ -144,71 +114,101 @@ uint32_t sleep_taskNeedsAwakening(void) {
 
 
 /**
- * [sleep_heapInsert Internal function which inserts a task pointer into the
- *   sleep heap and maintains the partial ordering of the heap.
- *  This function is protecting against simultaneous modification to the heap
- *   by other tasks via a mutex.
- *  A potential race condition has been located, where the scheduler can feely
- *   context switch anywhere within this function, and if the top task is to be
- *   awoken it will perform sleep_heapExtract and modify the heap.
- *  This cannot be protected by mutexes as the scheduler should never not be able
- *   to perform its tasks. I have found no good way of dealing with this race condition.
+ * [sleep_tickMayNeedAwakening Checks whether the top element, if any, requires
+ *  awakening, as sleep_taskNeedsAwakening does, which only reads the heap.]
+ * @return  [   1 if a top task exists and it requires awakening,
+ *              0 otherwise]
+ */
+uint32_t sleep_tickMayNeedAwakening(void) {
+    return sleep_taskNeedsAwakening();
+}
+
+
+/**
+ * [sleep_ticksUntilAwakening Calculates the number of ticks until the top
+ *   element, if any, requires awakening.]
+ * @return  [   ticks until the top task requires awakening, or 0 if it is
+ *               already due,
+ *              UINT32_MAX if no tasks are sleeping]
+ */
+uint32_t sleep_ticksUntilAwakening(void) {
+    if (!_heap_length) {
+        return UINT32_MAX;
+    }
+    uint32_t current_ticks = OS_elapsedTicks();
+
+    /* Awakening times in the past are due now, see sleep_taskNeedsAwakening */
+    if (sleep_time1IsAfterTime2(current_ticks, _heap_store[0]->data, current_ticks + HALF_OF_UINT32_T_MAX) ) {
+        return 0;
+    }
+    return _heap_store[0]->data - current_ticks;
+}
+
+
+/**
+ * [sleep_insert Inserts a task pointer into the sleep heap and maintains
+ *   the partial ordering of the heap.
+ *  Must only be called in handler mode, see the top of this file.
  *  Protection against filling past the heap store allocated memory
  *   is not necessary as we know it cannot overflow due to the allocated space
  *   of MAX_TASKS.]
- * @param tcb [pointer to a OS_TCB_t to insert]
+ * @param tcb [pointer to a OS_TCB_t to insert, with its awakening time in
+ *   the data field]
  */
-static void sleep_heapInsert(OS_TCB_t * tcb) {
-    OS_mutexAcquire(&_sleep_mutex);
-    /*  The new element is always added to the end and sorted using heapUp.
-        A potential race condition has been located where the scheduler can feely
-         context switch anywhere within this function and sleep_heapUp, and if
-         the top task is to be awoken it will perform sleep_heapExtract
-         and modify the heap that this function already is modifying.
-        This cannot be protected by mutexes as the scheduler should never not be
-         able to perform its tasks. I have found no good way of dealing with
-         this race condition.
-        A worst case scenario would be that the scheduler preempts in between
-         the two lines, where the tcb to be heapified was last, then moved up,
-         and when returned here we would have a non-existent tcb to move up.
-        As the heap and its length is volatile, this should still be fine,
-         but it could also lead to heap corruption.
-        To postulate, some sort of fail fast behaviour for the below two lines
-         could work, but would still mean that the scheduler could potentially
-         modify the currently modyfied heap.
-        My best solution to this was to utilise a fail-fast counter checked prior
-         to each actual swap in the heap internally in sleep_heapUp.
-        This means that a scheduler modifying the heap will make it restart the
-         current part of the do-while loop without making any changes that can
-         now be wrong with the modified heap.*/
+void sleep_insert(OS_TCB_t * tcb) {
+    /* The new element is always added to the end and sorted using heapUp */
     _heap_store[_heap_length++] = tcb;
-	sleep_heapUp();
+    sleep_heapUp(_heap_length - 1);
+    tcb->state |= TASK_STATE_SLEEP;
+}
+
 
-    OS_mutexRelease(&_sleep_mutex);
+/**
+ * [sleep_remove Removes a task pointer from anywhere in the sleep heap,
+ *   when a task waiting with a timeout is notified before its timeout.
+ *  The task is searched for, which takes time in the number of sleeping tasks.
+ *  Must only be called in handler mode.]
+ * @param tcb [pointer to the sleeping OS_TCB_t to remove]
+ */
+void sleep_remove(OS_TCB_t * tcb) {
+    uint32_t tcb_index = 0;
+    while (_heap_store[tcb_index] != tcb) {
+        tcb_index++;
+        ASSERT_DEBUG(tcb_index < _heap_length);
+    }
+
+    /*  The end element is moved into the gap, and sorted up or down, as it
+         can wake before its new parent or after its new children */
+    _heap_store[tcb_index] = _heap_store[--_heap_length];
+    if (tcb_index < _heap_length) {
+        sleep_heapUp(tcb_index);
+        sleep_heapDown(tcb_index);
+    }
+    tcb->state &= ~TASK_STATE_SLEEP;
 }
 
 
 /**
- * [sleep_heapExtract Extracts the root task pointer from the sleep heap.
+ * [sleep_extract Extracts the root task pointer from the sleep heap.
     If the heap is empty, this will return arbitrary values, and should always be
      executed after a sleep_taskNeedsAwakening() check which also checks the
      heap is empty or not.
-    As this will be run from within the scheduler, this cannot be protected
-     by mutexes, and hence fail-fast behaviour has been added to
-     sleep_heapInsert.]
+    A task still waiting for a resource has timed out, and is taken out of
+     the resource's wait queue before it is returned (see _OS_waitTimeout).]
  * @return  [a pointer to the task to be re-inserted in the scheduler]
  */
-OS_TCB_t * sleep_heapExtract(void) {
+OS_TCB_t * sleep_extract(void) {
 	/*  The root element is extracted, and the end element is moved to root.
         The new root element is then sorted using heapDown */
 	OS_TCB_t * tcb = _heap_store[0];
 	_heap_store[0] = _heap_store[--_heap_length];
-	sleep_heapDown();
-
-    /* Increment the fail-fast counter so any potential tasks performing
-        sleep_heapInsert knows the heap has been modified */
-    _sleep_fail_fast_counter++;
+	sleep_heapDown(0);
 
+    /* The task is no longer sleeping, and is made runnable by the caller */
+    tcb->state &= ~TASK_STATE_SLEEP;
+    if (tcb->state & TASK_STATE_WAIT) {
+        _OS_waitTimeout(tcb);
+    }
 	return tcb;
 }
 
@@ -233,30 +233,23 @@ static void sleep_heapSwapElements(uint32_t * elementIndexMain, uint32_t element
 
 
 /**
- * [sleep_heapUp Internal function to sort an added element in its branch.
+ * [sleep_heapUp Internal function to sort an element up its branch.
  *  Will swap elemement with its parent element until the awakening time of
- *   the parent is smaller the inserted element.
- *  This function has no arguments and returns nothing, but requires the new
- *   element to be partially sorted to have been added to the end/bottom of the heap.]
+ *   the parent is smaller the element, ie after it has been added to the
+ *   end/bottom of the heap.]
+ * @param tcb_index [heap index of the element to sort]
  */
-static void sleep_heapUp(void) {
-    /* Indexes for current TCB and Potential Parent TCBs.
-        Additionally the current_time used for comparing time intervals,
-        and the fast-fail-count to catch heap modifications made by the scheduler */
-    uint32_t tcb_index, parent_tcb_index, current_time, fail_fast_count;
+static void sleep_heapUp(uint32_t tcb_index) {
+    /* Index for Potential Parent TCBs, and the current_time used for
+        comparing time intervals */
+    uint32_t parent_tcb_index, current_time;
 
     /* Loop Control Variable */
     uint32_t element_is_bigger_than_parent = 1;
 
-    /* Start with the last element of the heap, and proceed with heap up
-        until parent awakening time is smaller than the current awakening time */
-    tcb_index = _heap_length - 1;
+    /* Proceed with heap up until parent awakening time is smaller than the
+        current awakening time */
     do {
-        /*  Set the fast fail cont as early as possible within the loop - it has
-            to be within the loop as if not it can never exit if the scheuler
-            interrupts*/
-        fail_fast_count = _sleep_fail_fast_counter;
-
         /* Check if root element and return if this is the case */
         if (tcb_index == 0){
             return;
@@ -283,37 +276,30 @@ static void sleep_heapUp(void) {
         if (sleep_time1IsAfterTime2(_heap_store[tcb_index]->data, _heap_store[parent_tcb_index]->data, current_time + HALF_OF_UINT32_T_MAX) ) {
             element_is_bigger_than_parent = 0;
         } else {
-            /* Do the swap between element and parent and update tcb_index only
-                if the local fail-fast counter set at the start of the loop is
-                the same as the current one incremented by the scheduler if it
-                has edited the heap. */
-            if (fail_fast_count == _sleep_fail_fast_counter) {
-                sleep_heapSwapElements(&tcb_index, parent_tcb_index);
-            }
+            sleep_heapSwapElements(&tcb_index, parent_tcb_index);
         }
     } while (element_is_bigger_than_parent);
 }
 
 
 /**
- * [sleep_heapDown Internal function to sort the heap after extraction of the
- *   top element. This will swap the current elemement with the
+ * [sleep_heapDown Internal function to sort the heap after extraction or
+ *   removal of an element. This will swap the current elemement with the
      smallest of its children until the awakening time of the children
      are bigger than current element.
-    This requires the last element to have been moved to the top prior to
+    This requires the last element to have been moved to the gap prior to
      being called.]
+ * @param tcb_index [heap index of the element to sort]
  */
-static void sleep_heapDown(void) {
-	 /* Indexes for current TCB and Potential Children TCBs */
-    uint32_t tcb_index, child_1_tcb_index, child_2_tcb_index, current_time;
+static void sleep_heapDown(uint32_t tcb_index) {
+	 /* Indexes for Potential Children TCBs */
+    uint32_t child_1_tcb_index, child_2_tcb_index, current_time;
 
      /* Control Variable and Loop Control Variable */
     uint32_t element_has_two_children, element_is_bigger_than_children = 1;
 
-    /* Start with the root element, and proceed with heap down
-        until child awakening time is bigger than or equal to
-        the current tcb awakening time  */
-    tcb_index = 0;
+    /* Proceed with heap down until child awakening time is bigger than or
+        equal to the current tcb awakening time  */
     do {
         /* Calculate the position of a potential first child using
             Child 1: child_1 = 2n , where n is (tcb_index+1).
@@ -363,3 +349,4 @@ static void sleep_heapDown(void) {
         }
     } while (element_is_bigger_than_children);
 }
+#endif /* SLEEP_TIMER_WHEEL */
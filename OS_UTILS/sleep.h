@@ -3,19 +3,73 @@
 
 #include <stdint.h>
 #include "task.h"
+#include "os.h"
 
 /*=============================================================================
  *  This file is adding sleep functionality to the OS.
  *   The maximum amount a single task can sleep in a single interval is
- *   (31^2 -1) ticks, or around 24.95 days.
+ *   (31^2 -1) ticks, or around 24.95 days, unless SLEEP_TIMER_WHEEL is defined.
+ *  Sleeping tasks are held in a binary heap (sleep.c), or in a hierarchical
+ *   timer wheel by defining the following constant in the compiler command
+ *   line options:
+ *       SLEEP_TIMER_WHEEL
+ *           Sleeping tasks are inserted into and removed from the timer wheel
+ *            (sleepWheel.c) in constant time regardless of how many tasks are
+ *            sleeping, instead of time in log2 of the number of tasks. The
+ *            scheduler advances the wheel by one slot for every tick that has
+ *            passed. Tasks can sleep for up to
+ *            (2^32 - 1 - SLEEP_WHEEL_LATE_TICKS) ticks, around 49.7 days.
 ===============================================================================
 **       Example Use
 *******************************************************************************
-#include "mempool.h"
-//TODO
+#include "sleep.h"
+//Any task:
+OS_sleep(100);
+//A task running every 10 ticks, in phase with its first awakening:
+uint32_t last_wake = OS_elapsedTicks(), overruns = 0;
+while (1) {
+    overruns += OS_sleepUntil(&last_wake, 10);
+    // Do the periodic work
+}
 =============================================================================*/
 
 
+/*=============================================================================
+**       Macro Definitions
+=============================================================================*/
+/*****************************************************************************
+**      USER MODIFIABLE CONFIGURATION - START
+**      ONLY MODIFY DEFINITIONS DONE IN BETWEN START AND END TAGS
+******************************************************************************/
+/*  Sets the number of slots in each level of the timer wheel to
+     (1<<SLEEP_WHEEL_SLOT_BITS), only used with SLEEP_TIMER_WHEEL. Each level
+     spans (1<<SLEEP_WHEEL_SLOT_BITS) times the ticks of the level below, and
+     as many levels are used as needed to span 2^32 ticks: 6 levels of 64
+     slots (1536 bytes) by default. */
+#define SLEEP_WHEEL_SLOT_BITS 6
+
+/*  Sets how many ticks a wake time may have passed by the time the task is
+     inserted into the timer wheel (ie when the wake time was calculated by a
+     task that was then preempted), for the task to be woken straight away
+     rather than in 2^32 ticks. Only used with SLEEP_TIMER_WHEEL. */
+#define SLEEP_WHEEL_LATE_TICKS 0x10000
+/*****************************************************************************
+**      USER MODIFIABLE CONFIGURATION - END
+**      DO NOT MODIFY ANYTHING BELOW THIS LINE
+******************************************************************************/
+
+/*=============================================================================
+**       Error checking of Modifiable Definitions Above, DO NOT EDIT
+=============================================================================*/
+#if SLEEP_WHEEL_SLOT_BITS < 1 || SLEEP_WHEEL_SLOT_BITS > 16
+# error "SLEEP_WHEEL_SLOT_BITS must be between 1 and 16."
+#endif
+
+#if SLEEP_WHEEL_LATE_TICKS < 1 || SLEEP_WHEEL_LATE_TICKS > 0x7FFFFFFF
+# error "SLEEP_WHEEL_LATE_TICKS must be between 1 and (2^31 - 1)."
+#endif
+
+
 /*=============================================================================
 **      Function Prototypes
 =============================================================================*/
@@ -24,28 +78,90 @@
  *  The task is guaranteed to be set to be set runnable again after the provided
  *   value of ticks, but the time until it actually runs after the sleep might be
  *   longer than this and depends on other tasks in the system.
+ *  This is a single SVC, which reads the time and puts the task to sleep in
+ *   handler mode, so the task can not be preempted in between.
  *  Must never be called outside a task.]
  * @param sleep_in_ms [time to wait in milliseconds  - must not be bigger than
-    (31^2 -1) ticks (around 24.95 days) as behaviour will be unpredictable]
+    (31^2 -1) ticks (around 24.95 days) as behaviour will be unpredictable,
+    or the limit given at the top of this file with SLEEP_TIMER_WHEEL]
+ */
+void __svc(OS_SVC_SLEEP) OS_sleep(const uint32_t sleep_in_ms);
+
+/**
+ * [OS_sleepUntil Put the current task to sleep until one period after its
+ *   last awakening time, for tasks that must run periodically without
+ *   drifting by their execution time and scheduling latency.
+ *  The awakening times are calculated from the previous one rather than the
+ *   current time, and are always a whole number of periods after the first.
+ *   If the next awakening time has already passed (an overrun), the missed
+ *   periods are skipped so the task stays in phase, and are returned.
+ *  As with OS_sleep, the task is awoken once the ticks are after the
+ *   awakening time.
+ *  Must never be called outside a task.]
+ * @param  last_wake [pointer to the last awakening time, which should be set
+ *   to OS_elapsedTicks() before the first call, and is updated to the next]
+ * @param  period    [the period in ticks, between 1 and (31^2 -1) ticks]
+ * @return           [the number of periods missed since the last awakening,
+ *   0 if the task has not overrun]
  */
-void OS_sleep(const uint32_t sleep_in_ms);
+uint32_t OS_sleepUntil(uint32_t * const last_wake, const uint32_t period);
 
 
 /*=============================================================================
 **      Internal Function Prototypes for OS Operation
+**      These must only be called in handler mode, from the SVC and PendSV
+**       handlers, which can not preempt each other. The SysTick handler can be
+**       preempted by PendSV, so must only call sleep_tickMayNeedAwakening.
 =============================================================================*/
 /**
- * [sleep_heapExtract Extracts the task which is to be awoken soonest]
+ * [sleep_insert Inserts a task into the sleeping tasks, flagging it as
+ *   sleeping (TASK_STATE_SLEEP)]
+ * @param tcb [pointer to the OS_TCB_t to insert, with its awakening time in
+ *   the data field]
+ */
+void sleep_insert(OS_TCB_t * tcb);
+
+/**
+ * [sleep_remove Removes a sleeping task from the sleeping tasks before it
+ *   is due to be awoken (ie a task notified before its wait timed out)]
+ * @param tcb [pointer to the sleeping OS_TCB_t to remove]
+ */
+void sleep_remove(OS_TCB_t * tcb);
+
+/**
+ * [sleep_extract Extracts a task which is due to be awoken (the soonest, with
+ *   the heap). A task still waiting for a resource is taken out of its wait
+ *   queue (timed out).]
  * @return  OS_TCB_t * [the pointer to the OS_TCB_t that was extracted]
  */
-OS_TCB_t * sleep_heapExtract(void);
+OS_TCB_t * sleep_extract(void);
 
 /**
- * [sleep_taskNeedsAwakening Returns whether the task at the top of the heap
- *   should be awoken or not]
- * @return  uint32_t [  1 if the top task should be awoken
- *                      0 if the top task should NOT be awoken]
+ * [sleep_taskNeedsAwakening Returns whether any sleeping task should be
+ *   awoken or not. With SLEEP_TIMER_WHEEL, this advances the wheel to the
+ *   current tick.]
+ * @return  uint32_t [  1 if a task should be awoken
+ *                      0 if no task should be awoken]
  */
 uint32_t sleep_taskNeedsAwakening(void);
 
+/**
+ * [sleep_tickMayNeedAwakening Returns whether the scheduler should run on
+ *   this tick to awaken sleeping tasks, without modifying the sleeping tasks.
+ *   With SLEEP_TIMER_WHEEL, this may also be because the wheel needs advancing.]
+ * @return  uint32_t [  1 if the scheduler should run
+ *                      0 otherwise]
+ */
+uint32_t sleep_tickMayNeedAwakening(void);
+
+/**
+ * [sleep_ticksUntilAwakening Returns the number of ticks until the next
+ *   sleeping task should be awoken, used by the tickless idle mode. With
+ *   SLEEP_TIMER_WHEEL, this may be the ticks until the wheel next moves tasks
+ *   down a level instead, which is earlier.]
+ * @return  uint32_t [  ticks until the next awakening, 0 if it is already due,
+ *                      or UINT32_MAX if no tasks are sleeping]
+ */
+uint32_t sleep_ticksUntilAwakening(void);
+
 #endif /* _SLEEP_H_ */
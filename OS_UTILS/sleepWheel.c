@@ -0,0 +1,327 @@
+#include "sleep.h"
+#include "task.h"
+#include "os_internal.h"
+#include "stm32f4xx.h"
+#include "debug.h"
+
+/*  This file is adding the hierarchical timer wheel alternative to the sleep
+     heap of sleep.c, compiled instead of it with SLEEP_TIMER_WHEEL (see sleep.h).
+    Level 0 of the wheel has a slot for each of the next SLEEP_WHEEL_SLOTS ticks,
+     and each level above has a slot for each of the next SLEEP_WHEEL_SLOTS
+     whole slot rounds of the level below it. A task is linked into the slot of
+     the lowest level that reaches its awakening time, found from the number of
+     ticks until then using CLZ, so inserting and removing take constant time.
+    The wheel is advanced by one level 0 slot for every tick that has passed when
+     the scheduler runs, moving the tasks of that slot to the list of due tasks,
+     which are extracted by the scheduler. Every time level 0 has been gone
+     round, the tasks of the next slot of level 1 are moved down into level 0
+     (and so on up the levels), each task moving down at most once per level.
+    Slots only hold wake times relative to the wheel, so sleeps are not limited
+     to half the range of the ticks like the heap, but tasks can not be told
+     apart from tasks whose wake time has already passed by up to
+     SLEEP_WHEEL_LATE_TICKS when inserted, which are woken straight away.
+    The wheel is only ever modified by the SVC handlers and the scheduler
+     (PendSV), which can not preempt each other as they share the same priority.
+     The SysTick handler has a lower priority, so PendSV can preempt it (ie when
+     pended by an interrupt that preempted the SysTick), and it only reads the
+     tick at which the wheel next has to be advanced. That tick is kept up to
+     date from a bitmap of the occupied level 0 slots, and is no later than the
+     first occupied level 0 slot or the next time level 0 has been gone round.
+
+    This increases the static memory requirements of the OS by
+        +   SLEEP_WHEEL_LEVELS * SLEEP_WHEEL_SLOTS * 4 bytes    -   Wheel slots
+        +   SLEEP_WHEEL_WORDS * 4 bytes                         -   Level 0 bitmap
+        +   16 bytes                                            -   Due list, wheel time, next tick and count
+        +   8 bytes per TCB                                     -   Slot links
+    which is 1560 bytes with 64 slots, for any number of sleeping tasks. */
+
+#ifdef SLEEP_TIMER_WHEEL
+/*=============================================================================
+**      Definitions
+=============================================================================*/
+#define SLEEP_WHEEL_SLOTS   (1UL << SLEEP_WHEEL_SLOT_BITS)
+#define SLEEP_WHEEL_MASK    (SLEEP_WHEEL_SLOTS - 1)
+/* Enough levels to span all 32 bits of the ticks */
+#define SLEEP_WHEEL_LEVELS  ((32 + SLEEP_WHEEL_SLOT_BITS - 1) / SLEEP_WHEEL_SLOT_BITS)
+/* Words in the bitmap of occupied level 0 slots */
+#define SLEEP_WHEEL_WORDS   ((SLEEP_WHEEL_SLOTS + 31) / 32)
+
+/*=============================================================================
+**      Static Function Prototypes
+=============================================================================*/
+static void sleep_wheelAdvance(void);
+static uint32_t sleep_wheelNextSlot(uint32_t slot);
+static void sleep_wheelPlace(OS_TCB_t * tcb);
+static void sleep_wheelLink(OS_TCB_t ** list, OS_TCB_t * tcb);
+static void sleep_wheelUnlink(OS_TCB_t * tcb);
+
+/*=============================================================================
+**      Static Variables
+=============================================================================*/
+/* The slots of every level, each holding a list of tasks linked through their
+    sleep_next field */
+static OS_TCB_t * _wheel[SLEEP_WHEEL_LEVELS][SLEEP_WHEEL_SLOTS];
+/* A bit for every level 0 slot, set when a task is placed in it, and cleared
+    when the wheel advances past it. Bits of slots whose tasks were removed may
+    remain set until then, which only advances the wheel needlessly. */
+static uint32_t _wheel_occupied[SLEEP_WHEEL_WORDS];
+/* The tasks due to be awoken, moved out of the wheel as it advances */
+static OS_TCB_t * _wheel_due = 0;
+/* The next tick the wheel is to advance to */
+static uint32_t _wheel_time = 0;
+/* The tick at which the wheel next has to be advanced, read by the SysTick */
+static uint32_t _wheel_next = 0;
+/* The number of sleeping tasks, including due tasks */
+static uint32_t _wheel_count = 0;
+
+/*=============================================================================
+**      Functions
+=============================================================================*/
+/**
+ * [sleep_taskNeedsAwakening Advances the wheel to the current tick, and checks
+ *  whether any task is due to be awoken.]
+ * @return  [   1 if a task requires awakening,
+ *              0 otherwise]
+ */
+uint32_t sleep_taskNeedsAwakening(void) {
+    sleep_wheelAdvance();
+    return (_wheel_due != 0);
+}
+
+
+/**
+ * [sleep_tickMayNeedAwakening Checks without modifying the wheel whether a task
+ *  is due, or the current tick has reached the tick at which the wheel next has
+ *  to be advanced, which may or may not make a task due.]
+ * @return  [   1 if the scheduler should run to advance the wheel,
+ *              0 otherwise]
+ */
+uint32_t sleep_tickMayNeedAwakening(void) {
+    if (_wheel_due != 0) {
+        return 1;
+    }
+    /* The next tick is never more than a round of level 0 ahead of the wheel
+        while there are sleeping tasks */
+    return (_wheel_count != 0 && (int32_t)(OS_elapsedTicks() - _wheel_next) >= 0);
+}
+
+
+/**
+ * [sleep_ticksUntilAwakening Calculates the number of ticks until the next
+ *   task in level 0 of the wheel is due, or until the wheel next moves tasks
+ *   down from level 1 if there is none before that, which may or may not make
+ *   a task due.]
+ * @return  [   ticks until the wheel next needs advancing, or 0 if a task is
+ *               already due,
+ *              UINT32_MAX if no tasks are sleeping]
+ */
+uint32_t sleep_ticksUntilAwakening(void) {
+    sleep_wheelAdvance();
+    if (_wheel_due != 0) {
+        return 0;
+    }
+    if (_wheel_count == 0) {
+        return UINT32_MAX;
+    }
+
+    /* The wheel has been advanced to (current_ticks + 1), so the next tick
+        is after the current tick */
+    return _wheel_next - OS_elapsedTicks();
+}
+
+
+/**
+ * [sleep_insert Inserts a task into the wheel in constant time.
+ *  Must only be called in handler mode, see the top of this file.]
+ * @param tcb [pointer to a OS_TCB_t to insert, with its awakening time in
+ *   the data field]
+ */
+void sleep_insert(OS_TCB_t * tcb) {
+    /* Catch up first, so the wheel time is the current tick even if the wheel
+        has not been advanced for a while */
+    sleep_wheelAdvance();
+    _wheel_count++;
+    sleep_wheelPlace(tcb);
+    tcb->state |= TASK_STATE_SLEEP;
+}
+
+
+/**
+ * [sleep_remove Removes a task from the wheel (or the due tasks) in constant
+ *   time, when a task waiting with a timeout is notified before its timeout.
+ *  Must only be called in handler mode.]
+ * @param tcb [pointer to the sleeping OS_TCB_t to remove]
+ */
+void sleep_remove(OS_TCB_t * tcb) {
+    sleep_wheelUnlink(tcb);
+    _wheel_count--;
+    tcb->state &= ~TASK_STATE_SLEEP;
+}
+
+
+/**
+ * [sleep_extract Extracts a due task.
+    Should always be executed after a sleep_taskNeedsAwakening() check, which
+     also checks whether any tasks are due.
+    A task still waiting for a resource has timed out, and is taken out of
+     the resource's wait queue before it is returned (see _OS_waitTimeout).]
+ * @return  [a pointer to the task to be re-inserted in the scheduler]
+ */
+OS_TCB_t * sleep_extract(void) {
+    OS_TCB_t * tcb = _wheel_due;
+    ASSERT_DEBUG(tcb != 0);
+    sleep_wheelUnlink(tcb);
+    _wheel_count--;
+
+    /* The task is no longer sleeping, and is made runnable by the caller */
+    tcb->state &= ~TASK_STATE_SLEEP;
+    if (tcb->state & TASK_STATE_WAIT) {
+        _OS_waitTimeout(tcb);
+    }
+    return tcb;
+}
+
+
+/**
+ * [sleep_wheelAdvance Advances the wheel one tick at a time up to and including
+ *   the current tick. On every tick the slots of the higher levels that have
+ *   come round are moved down, and the tasks in the level 0 slot of the tick
+ *   are moved to the due tasks.
+ *  An empty wheel is moved straight to the current tick. Either way, the tick
+ *   at which the wheel next has to be advanced is updated.]
+ */
+static void sleep_wheelAdvance(void) {
+    uint32_t next_time = OS_elapsedTicks() + 1;
+    uint32_t slot;
+    OS_TCB_t * tcb, * next_tcb;
+
+    if (_wheel_count == 0) {
+        _wheel_time = next_time;
+    }
+    while (_wheel_time != next_time) {
+        /*  Move down the tasks of the next slot of each level whose levels below
+             have all been gone round, from the lowest level up. Tasks of a
+             higher level can not be moved into the slot just emptied below it,
+             as that would have to be in level 0. */
+        for (uint32_t level = 1; level < SLEEP_WHEEL_LEVELS; level++) {
+            if ((_wheel_time & ((1UL << (level * SLEEP_WHEEL_SLOT_BITS)) - 1)) != 0) {
+                break;
+            }
+            tcb = _wheel[level][(_wheel_time >> (level * SLEEP_WHEEL_SLOT_BITS)) & SLEEP_WHEEL_MASK];
+            _wheel[level][(_wheel_time >> (level * SLEEP_WHEEL_SLOT_BITS)) & SLEEP_WHEEL_MASK] = 0;
+            while (tcb != 0) {
+                next_tcb = tcb->sleep_next;
+                sleep_wheelPlace(tcb);
+                tcb = next_tcb;
+            }
+        }
+
+        /* All tasks in the level 0 slot of this tick are due */
+        slot = _wheel_time & SLEEP_WHEEL_MASK;
+        tcb = _wheel[0][slot];
+        _wheel[0][slot] = 0;
+        _wheel_occupied[slot / 32] &= ~(1UL << (slot % 32));
+        while (tcb != 0) {
+            next_tcb = tcb->sleep_next;
+            sleep_wheelLink(&_wheel_due, tcb);
+            tcb = next_tcb;
+        }
+        _wheel_time++;
+    }
+
+    /* The next tick is that of the first occupied level 0 slot from the wheel
+        time, or the start of the next round of level 0, whichever is first */
+    slot = _wheel_time & SLEEP_WHEEL_MASK;
+    if (slot == 0) {
+        _wheel_next = _wheel_time;
+    } else {
+        _wheel_next = _wheel_time - slot + sleep_wheelNextSlot(slot);
+    }
+}
+
+
+/**
+ * [sleep_wheelNextSlot Finds the first occupied level 0 slot at or after a slot,
+ *   from the bitmap of occupied slots.]
+ * @param  slot [the level 0 slot to start from]
+ * @return      [the first occupied slot, or SLEEP_WHEEL_SLOTS if there is none]
+ */
+static uint32_t sleep_wheelNextSlot(uint32_t slot) {
+    uint32_t word = slot / 32;
+    uint32_t bits = _wheel_occupied[word] & ~((1UL << (slot % 32)) - 1);
+
+    while (bits == 0) {
+        if (++word == SLEEP_WHEEL_WORDS) {
+            return SLEEP_WHEEL_SLOTS;
+        }
+        bits = _wheel_occupied[word];
+    }
+    /* The lowest set bit is isolated by (bits & -bits) */
+    return (word * 32) + (31 - __CLZ(bits & (0UL - bits)));
+}
+
+
+/**
+ * [sleep_wheelPlace Links a task into the slot of the lowest level of the wheel
+ *   that reaches its awakening time from the wheel time, or into the due tasks
+ *   if its awakening time has already passed.
+ *  A task is due once the ticks are after its awakening time, as with the heap,
+ *   so it is placed by the tick after it.]
+ * @param tcb [pointer to a OS_TCB_t to place, with its awakening time in
+ *   the data field]
+ */
+static void sleep_wheelPlace(OS_TCB_t * tcb) {
+    uint32_t due_time = tcb->data + 1;
+    uint32_t ticks = due_time - _wheel_time;
+    uint32_t level = 0;
+
+    if (ticks > UINT32_MAX - SLEEP_WHEEL_LATE_TICKS) {
+        sleep_wheelLink(&_wheel_due, tcb);
+        return;
+    }
+
+    /* The level is the position of the highest set bit of the ticks until the
+        task is due, in units of the slot bits of a level */
+    if (ticks != 0) {
+        level = (31 - __CLZ(ticks)) / SLEEP_WHEEL_SLOT_BITS;
+    }
+    sleep_wheelLink(&_wheel[level][(due_time >> (level * SLEEP_WHEEL_SLOT_BITS)) & SLEEP_WHEEL_MASK], tcb);
+
+    /* Mark the level 0 slot as occupied, bringing the next tick forward if
+        it is due before it */
+    if (level == 0) {
+        _wheel_occupied[(due_time & SLEEP_WHEEL_MASK) / 32] |= 1UL << ((due_time & SLEEP_WHEEL_MASK) % 32);
+        if (ticks < _wheel_next - _wheel_time) {
+            _wheel_next = due_time;
+        }
+    }
+}
+
+
+/**
+ * [sleep_wheelLink Links a task to the front of a slot or the due tasks.]
+ * @param list [pointer to the first task of the slot or the due tasks]
+ * @param tcb  [pointer to the OS_TCB_t to link]
+ */
+static void sleep_wheelLink(OS_TCB_t ** list, OS_TCB_t * tcb) {
+    tcb->sleep_next = *list;
+    if (*list != 0) {
+        (*list)->sleep_pprev = &tcb->sleep_next;
+    }
+    tcb->sleep_pprev = list;
+    *list = tcb;
+}
+
+
+/**
+ * [sleep_wheelUnlink Unlinks a task from whichever slot (or the due tasks) it
+ *   is in, through the pointer to it that it holds.]
+ * @param tcb [pointer to the OS_TCB_t to unlink]
+ */
+static void sleep_wheelUnlink(OS_TCB_t * tcb) {
+    *tcb->sleep_pprev = tcb->sleep_next;
+    if (tcb->sleep_next != 0) {
+        tcb->sleep_next->sleep_pprev = tcb->sleep_pprev;
+    }
+}
+#endif /* SLEEP_TIMER_WHEEL */
@@ -0,0 +1,137 @@
+#include "spscQueue.h"
+#include <string.h>
+#include "stm32f4xx.h"
+#include "debug.h"
+
+/*  This file is adding single-producer single-consumer Inter Task Communication
+    functionality to the OS via a circular buffer, where the producer only
+    modifies the head and the consumer only modifies the tail. The 2 semaphores
+    count the filled and free slots, so the producer and consumer never access
+    the same slot at once, and no mutex is required. */
+/*=============================================================================
+**      Functions
+=============================================================================*/
+/**
+ * [OS_spscQueueInitialise Initialises the queue. Must be done
+ *  prior to starting the OS.]
+ * @param queue           [pointer to the OS_SPSCQueue_t to initialise]
+ * @param static_memory   [pointer to statically declared memory to use with
+ *   the queue. This must fit [queue_length*queue_item_size] bytes, and be at
+ *   least word aligned (4 bytes).
+ *  This static memory MUST be a valid writable and readable memory address,
+ *   and the queue will not operate correctly/at all if it isn't.]
+ * @param queue_length    [the size of the queue (number of elements it can hold)]
+ * @param queue_item_size [the size in bytes of one element. All elements
+ *   in the queue must be of the same type.]
+ */
+void OS_spscQueueInitialise(OS_SPSCQueue_t * queue, void * const static_memory, const uint32_t queue_length, const uint32_t queue_item_size) {
+    queue->length = queue_length;
+    queue->item_size = queue_item_size;
+    /*  Simplistic check for whether the supplied memory location is valid.
+        This will only breakpoint if in a DEBUG mode. */
+    ASSERT_DEBUG(static_memory);
+    queue->start = (uint8_t * )static_memory;
+    queue->end = queue->start + (queue->length * queue->item_size); //this points to the byte after the given static memory
+    queue->head = queue->tail = queue->start;
+
+    OS_semaphoreInitialise( &queue->sem_r, queue->length, 0 );
+    OS_semaphoreInitialise( &queue->sem_w, queue->length, queue->length );
+}
+
+/**
+ * [OS_spscQueueReserve Reserves the slot at the back of the queue, waiting
+ *   until there is space if the queue is full, so that an item can be built
+ *   in place without copying.
+ *  Must only be called by the single producer task of the queue, and be
+ *   followed by OS_spscQueueCommit.]
+ * @param  queue [pointer to the OS_SPSCQueue_t to reserve a slot in]
+ * @return       [pointer to the reserved slot]
+ */
+void * OS_spscQueueReserve(OS_SPSCQueue_t * queue) {
+    /* Take a token to make sure there is a free slot at the head. Only the
+        consumer can free slots, and it never reads a slot without a token. */
+    OS_semaphoreTake(&queue->sem_w);
+    return (void *)queue->head;
+}
+
+/**
+ * [OS_spscQueueCommit Adds the item built in the slot returned by
+ *   OS_spscQueueReserve to the queue, making it available to the consumer.]
+ * @param queue [pointer to the OS_SPSCQueue_t to commit the reserved slot to]
+ */
+void OS_spscQueueCommit(OS_SPSCQueue_t * queue) {
+    uint8_t * head = queue->head + queue->item_size;
+    if (head >= queue->end) {
+        head = queue->start;
+    }
+    queue->head = head;
+
+    /*  Make sure the item is written before the consumer is given the token to
+         read it. Recommended by ARM, but not necessary on M4. */
+    __DMB();
+    OS_semaphoreGive(&queue->sem_r);
+}
+
+/**
+ * [OS_spscQueuePeek Returns the item at the front of the queue without copying
+ *   it, waiting until there is an item if the queue is empty.
+ *  Must only be called by the single consumer task of the queue, and be
+ *   followed by OS_spscQueueRelease.]
+ * @param  queue [pointer to the OS_SPSCQueue_t to peek at]
+ * @return       [pointer to the item at the front of the queue]
+ */
+void const * OS_spscQueuePeek(OS_SPSCQueue_t * queue) {
+    /* Take a token to make sure there is a filled slot at the tail. Only the
+        producer can fill slots, and it never writes a slot without a token. */
+    OS_semaphoreTake(&queue->sem_r);
+    return (void const *)queue->tail;
+}
+
+/**
+ * [OS_spscQueueRelease Removes the item returned by OS_spscQueuePeek from the
+ *   queue, making its slot available to the producer.]
+ * @param queue [pointer to the OS_SPSCQueue_t to release the front item of]
+ */
+void OS_spscQueueRelease(OS_SPSCQueue_t * queue) {
+    uint8_t * tail = queue->tail + queue->item_size;
+    if (tail >= queue->end) {
+        tail = queue->start;
+    }
+    queue->tail = tail;
+
+    /*  Make sure the item is read before the producer is given the token to
+         overwrite it. Recommended by ARM, but not necessary on M4. */
+    __DMB();
+    OS_semaphoreGive(&queue->sem_w);
+}
+
+/**
+ * [OS_spscQueueEnqueue Enqueue an item to the back of the queue if there is
+ *   sufficient space, or wait until there is space to enqueue the item.
+ *  Must only be called by the single producer task of the queue.
+ *  If the queue is full and no elements ever get removed,
+ *   this function will never return.]
+ * @param queue [pointer to the OS_SPSCQueue_t to enqueue an item to]
+ * @param item  [pointer to desired item to enqueue]
+ */
+void OS_spscQueueEnqueue(OS_SPSCQueue_t * queue, const void * const potentially_unaligned_item) {
+    /* Copy byte-wise for potentially unaligned items, as in queue.c */
+    memcpy(OS_spscQueueReserve(queue), potentially_unaligned_item, (size_t)queue->item_size);
+    OS_spscQueueCommit(queue);
+}
+
+
+/**
+ * [OS_spscQueueDequeue Dequeue an item from the front of the queue if it is
+ *   not empty, or wait until there is an element to dequeue.
+ *  Must only be called by the single consumer task of the queue.
+ *  If there no elements are in (or get added to) the queue, this function will
+ *    never return.]
+ * @param queue       [pointer to the OS_SPSCQueue_t to dequeue an item from]
+ * @param item_buffer [pointer to desired item_buffer to dequeue to]
+ */
+void OS_spscQueueDequeue(OS_SPSCQueue_t * queue, void * potentially_unaligned_item_buffer) {
+    /* Copy byte-wise for potentially unaligned items, as in queue.c */
+    memcpy(potentially_unaligned_item_buffer, OS_spscQueuePeek(queue), (size_t)queue->item_size);
+    OS_spscQueueRelease(queue);
+}
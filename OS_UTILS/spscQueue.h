@@ -0,0 +1,121 @@
+#ifndef _SPSC_QUEUE_H_
+#define _SPSC_QUEUE_H_
+
+#include <stdint.h>
+#include "semaphore.h"
+
+/*=============================================================================
+ *  This file adds a single-producer single-consumer variant of the queue in
+ *   queue.h, for the common case where exactly one task enqueues and exactly
+ *   one other task dequeues.
+ *  With only one task writing the head and only one task writing the tail,
+ *   no mutex is needed: each index is only ever updated by its own task.
+ *   The two semaphores count the filled and free slots, and only enter the OS
+ *   when the consumer has to wait for an item, or the producer for space.
+ *  IMPORTANT: Using the same queue from more than one producer, or more than
+ *   one consumer, will corrupt it. Use OS_Queue_t (queue.h) in that case.
+===============================================================================
+**       Example Use
+*******************************************************************************
+#include "spscQueue.h"
+static OS_SPSCQueue_t queue;
+__align(4)
+static uint32_t queue_store[8];
+OS_spscQueueInitialise(&queue, &queue_store, 8, sizeof(uint32_t));
+//Producer task:
+OS_spscQueueEnqueue(&queue, &value);
+//Consumer task:
+OS_spscQueueDequeue(&queue, &value);
+=============================================================================*/
+
+
+/*=============================================================================
+**       Type Definitions
+=============================================================================*/
+/* A structure containing the necessary variables for the queue implemented as
+    a ring/circular buffer, with semaphores preventing overfilling and
+    exhaustion of the queue (semaphores for access to write and read). The
+    head is only modified by the producer, and the tail only by the consumer. */
+typedef struct  {
+    uint32_t length, item_size;
+    uint8_t * start, * end, * volatile head, * volatile tail;
+    OS_Semaphore_t sem_r, sem_w;
+} OS_SPSCQueue_t;
+
+
+/*=============================================================================
+**       Function Prototypes
+=============================================================================*/
+/**
+ * [OS_spscQueueInitialise Initialises the queue. Must be done
+ *  prior to starting the OS.]
+ * @param queue           [pointer to the OS_SPSCQueue_t to initialise]
+ * @param static_memory   [pointer to statically declared memory to use with
+ *   the queue. This must fit [queue_length*queue_item_size] bytes, and be at
+ *   least word aligned (4 bytes), see the example at the top of this file.]
+ * @param queue_length    [the size of the queue (number of elements it can hold)]
+ * @param queue_item_size [the size in bytes of one element. All elements
+ *   in the queue must be of the same type.]
+ */
+void OS_spscQueueInitialise(OS_SPSCQueue_t * queue, void * const static_memory, const uint32_t queue_length, const uint32_t queue_item_size);
+
+/**
+ * [OS_spscQueueEnqueue Enqueue an item to the back of the queue if there is
+ *   sufficient space, or wait until there is space to enqueue the item.
+ *  Must only be called by the single producer task of the queue.
+ *  If the queue is full and no elements ever get removed,
+ *   this function will never return.]
+ * @param queue [pointer to the OS_SPSCQueue_t to enqueue an item to]
+ * @param item  [pointer to desired item to enqueue]
+ */
+void OS_spscQueueEnqueue(OS_SPSCQueue_t * queue, const void * item);
+
+/**
+ * [OS_spscQueueDequeue Dequeue an item from the front of the queue if it is
+ *   not empty, or wait until there is an element to dequeue.
+ *  Must only be called by the single consumer task of the queue.
+ *  If there no elements are in (or get added to) the queue, this function will
+ *    never return.]
+ * @param queue       [pointer to the OS_SPSCQueue_t to dequeue an item from]
+ * @param item_buffer [pointer to desired item_buffer to dequeue to]
+ */
+void OS_spscQueueDequeue(OS_SPSCQueue_t * queue, void * item_buffer);
+
+/**
+ * [OS_spscQueueReserve Reserves the slot at the back of the queue, waiting
+ *   until there is space if the queue is full, so that an item can be built
+ *   in place without copying (see OS_queueReserve in queue.h).
+ *  Must only be called by the single producer task of the queue, and be
+ *   followed by OS_spscQueueCommit.]
+ * @param  queue [pointer to the OS_SPSCQueue_t to reserve a slot in]
+ * @return       [pointer to the reserved slot]
+ */
+void * OS_spscQueueReserve(OS_SPSCQueue_t * queue);
+
+/**
+ * [OS_spscQueueCommit Adds the item built in the slot returned by
+ *   OS_spscQueueReserve to the queue, making it available to the consumer.
+ *  The slot must not be accessed after this call.]
+ * @param queue [pointer to the OS_SPSCQueue_t to commit the reserved slot to]
+ */
+void OS_spscQueueCommit(OS_SPSCQueue_t * queue);
+
+/**
+ * [OS_spscQueuePeek Returns the item at the front of the queue without copying
+ *   it, waiting until there is an item if the queue is empty.
+ *  Must only be called by the single consumer task of the queue, and be
+ *   followed by OS_spscQueueRelease.]
+ * @param  queue [pointer to the OS_SPSCQueue_t to peek at]
+ * @return       [pointer to the item at the front of the queue]
+ */
+void const * OS_spscQueuePeek(OS_SPSCQueue_t * queue);
+
+/**
+ * [OS_spscQueueRelease Removes the item returned by OS_spscQueuePeek from the
+ *   queue, making its slot available to the producer. The item must not be
+ *   accessed after this call.]
+ * @param queue [pointer to the OS_SPSCQueue_t to release the front item of]
+ */
+void OS_spscQueueRelease(OS_SPSCQueue_t * queue);
+
+#endif /* _SPSC_QUEUE_H_ */
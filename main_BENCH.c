@@ -0,0 +1,526 @@
+#include "os.h"
+#include "stm32f4xx.h"
+#include <stdio.h>
+#include "utils/serial.h"
+#include "roundRobin.h"
+#include "mutex.h"
+#include "semaphore.h"
+#include "queue.h"
+#include "spscQueue.h"
+#include "mempool.h"
+
+/*=============================================================================
+ *  Kernel benchmark suite, measuring the cost of the OS primitives in CPU cycles
+ *   and printing min/avg/max tables over serial. Used in place of main_TEST.c or
+ *   main_DEMO.c.
+ *  Three cases are measured:
+ *       Uncontended       Each primitive called by a single task, which never
+ *                          has to wait.
+ *       Same priority     A second task of equal priority blocks on a resource
+ *                          held by the benchmark task, measuring the time until
+ *                          the benchmark task runs again, and the time from the
+ *                          resource being released until the waiting task runs.
+ *       Cross priority    As above, with a waiting task of higher priority that
+ *                          preempts the benchmark task on being notified.
+ *  The throughput of OS_Queue_t and OS_SPSCQueue_t is then measured in cycles
+ *   per item, with the benchmark task enqueueing into a short queue and a
+ *   consumer task of equal priority dequeueing, each blocking when the queue
+ *   is full or empty. OS_Queue_t is measured both one item at a time, and in
+ *   batches of up to the queue length (OS_queueEnqueueN/DequeueN).
+ *  Cycles are counted by DWT->CYCCNT. Where it is not available, ie on QEMU's
+ *   STM32F4 machines (netduinoplus2), the SysTick current value and the elapsed
+ *   ticks are used instead, at the resolution of the SysTick clock. With QEMU,
+ *   -icount shift=0 gives one count per instruction instead of wall time.
+ *  The DWT and SysTick are not accessible from unprivileged tasks, so the OS
+ *   must be built with OS_PRIVILEGED_TASKS (see os.h).
+=============================================================================*/
+
+#ifndef OS_PRIVILEGED_TASKS
+# error "main_BENCH.c must be built with OS_PRIVILEGED_TASKS, see os.h"
+#endif
+
+/*=============================================================================
+**       Definitions
+=============================================================================*/
+/* Number of measurements of each uncontended and contended primitive */
+#define BENCH_RUNS              1000
+#define BENCH_CONTENDED_RUNS    100
+/* Number of items passed through, and length of, the queues for throughput */
+#define BENCH_THROUGHPUT_ITEMS  1000
+#define BENCH_THROUGHPUT_LENGTH 8
+
+/* Queues and calls measured by the throughput benchmark */
+typedef enum {
+    BENCH_THROUGHPUT_QUEUE,
+    BENCH_THROUGHPUT_SPSC,
+    BENCH_THROUGHPUT_BATCH
+} Bench_Throughput_t;
+
+/* Priorities of the benchmark task, and the tasks waiting for its resources */
+#define BENCH_PRIORITY          1
+#define BENCH_PRIORITY_HIGH     2
+
+/* Contended cases run by the waiting tasks, set by the benchmark task */
+typedef enum {
+    BENCH_CASE_MUTEX,
+    BENCH_CASE_SEMAPHORE,
+    BENCH_CASE_QUEUE,
+    BENCH_CASE_YIELD
+} Bench_Case_e;
+
+/* Results of one measured operation */
+typedef struct {
+    char const * name;
+    uint32_t min, max, runs;
+    uint64_t total;
+} Bench_Result_t;
+
+/* A task waiting for the resources of the benchmark task */
+typedef struct {
+    /* Given by the benchmark task to run the current case once */
+    OS_Semaphore_t go;
+    /* Results of the time from blocking until the benchmark task ran, and from
+        the resource being released until this task ran */
+    Bench_Result_t * block, * wake;
+} Bench_Waiter_t;
+
+
+/*=============================================================================
+**       Function Prototypes
+=============================================================================*/
+void task_bench(void const * const args);
+void task_bench_waiter(void const * const args);
+void task_bench_consumer(void const * const args);
+
+static uint32_t bench_cycles(void);
+static void bench_record(Bench_Result_t * result, uint32_t start, uint32_t end);
+static void bench_print(Bench_Result_t const * result);
+static void bench_uncontended(void);
+static void bench_contended(Bench_Waiter_t * waiter, uint32_t same_priority);
+static uint32_t bench_throughput(Bench_Throughput_t throughput);
+
+
+/*=============================================================================
+**       Global Variables
+=============================================================================*/
+/* Whether DWT->CYCCNT counts cycles, or the SysTick must be used instead */
+static uint32_t _bench_use_dwt = 0;
+/* Cycles measured by an empty measurement, removed from every result */
+static uint32_t _bench_overhead = 0;
+
+/* The case currently run by the waiting tasks */
+static Bench_Case_e volatile _bench_case;
+/* The time at which the benchmark task released a resource, or yielded */
+static uint32_t volatile _bench_release_time;
+
+/* Primitives under test */
+static OS_Mutex_t _bench_mutex;
+static OS_Semaphore_t _bench_semaphore;
+static OS_Queue_t _bench_queue;
+__align(4)
+static uint32_t _bench_queue_store[1];
+static OS_SPSCQueue_t _bench_spsc_queue;
+__align(4)
+static uint32_t _bench_spsc_queue_store[1];
+static OS_MemPool_t _bench_mempool;
+__align(4)
+static uint32_t _bench_mempool_store[4][2];
+
+/* Queues for the throughput benchmark, the queue currently used by the consumer
+    task, and the semaphores starting the consumer and signalling it is done */
+static OS_Queue_t _bench_throughput_queue;
+static OS_SPSCQueue_t _bench_throughput_spsc_queue;
+__align(4)
+static uint32_t _bench_throughput_store[BENCH_THROUGHPUT_LENGTH];
+__align(4)
+static uint32_t _bench_throughput_spsc_store[BENCH_THROUGHPUT_LENGTH];
+static Bench_Throughput_t volatile _bench_throughput;
+static OS_Semaphore_t _bench_consumer_go, _bench_consumer_done;
+
+/* Results */
+static Bench_Result_t _results[] = {
+    { "mutexAcquire" },
+    { "mutexRelease" },
+    { "semaphoreTake" },
+    { "semaphoreGive" },
+    { "queueEnqueue" },
+    { "queueDequeue" },
+    { "spscQueueEnqueue" },
+    { "spscQueueDequeue" },
+    { "memPoolAllocate" },
+    { "memPoolDeallocate" },
+    { "yield (switch to equal priority)" },
+    { "mutex block (equal priority)" },
+    { "mutex hand-over (equal priority)" },
+    { "semaphore block (equal priority)" },
+    { "semaphore hand-over (equal priority)" },
+    { "queue block (equal priority)" },
+    { "queue hand-over (equal priority)" },
+    { "mutex block (higher priority)" },
+    { "mutex hand-over (higher priority)" },
+    { "semaphore block (higher priority)" },
+    { "semaphore hand-over (higher priority)" },
+    { "queue block (higher priority)" },
+    { "queue hand-over (higher priority)" }
+};
+enum {
+    RESULT_MUTEX_ACQUIRE, RESULT_MUTEX_RELEASE, RESULT_SEMAPHORE_TAKE, RESULT_SEMAPHORE_GIVE,
+    RESULT_QUEUE_ENQUEUE, RESULT_QUEUE_DEQUEUE, RESULT_SPSC_ENQUEUE, RESULT_SPSC_DEQUEUE, RESULT_MEMPOOL_ALLOCATE, RESULT_MEMPOOL_DEALLOCATE,
+    RESULT_YIELD, RESULT_EQUAL, RESULT_HIGHER = RESULT_EQUAL + 6, RESULT_COUNT = RESULT_HIGHER + 6
+};
+
+static Bench_Waiter_t _waiter_equal = { .block = &_results[RESULT_EQUAL], .wake = &_results[RESULT_EQUAL + 1] };
+static Bench_Waiter_t _waiter_high = { .block = &_results[RESULT_HIGHER], .wake = &_results[RESULT_HIGHER + 1] };
+
+
+/* MAIN FUNCTION */
+int main(void) {
+    /* Reserve memory for stacks and TCBs. Stacks must be 8-byte aligned. */
+    __align(8)
+    static uint32_t stack_bench[256], stack_waiter_equal[64], stack_waiter_high[64], stack_consumer[64];
+    static OS_TCB_t tcb_bench, tcb_waiter_equal, tcb_waiter_high, tcb_consumer;
+    uint32_t start;
+
+	/* Initialise the serial port so printf() works */
+	serial_init();
+    printf("\n\r\n\rDocetOS Kernel Benchmarks\n\r");
+
+    /* Enable the DWT cycle counter, and check that it counts */
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    start = DWT->CYCCNT;
+    for (uint32_t volatile i = 0; i < 100; i++);
+    _bench_use_dwt = (DWT->CYCCNT != start);
+    printf("BENCH\tCounting %s\n\r", _bench_use_dwt ? "DWT cycles" : "SysTick clocks (no DWT cycle counter)");
+
+	/* Initialise TCBs */
+    OS_initialiseTCB(&tcb_bench, stack_bench+256, task_bench, BENCH_PRIORITY, NULL);
+    OS_initialiseTCB(&tcb_waiter_equal, stack_waiter_equal+64, task_bench_waiter, BENCH_PRIORITY, &_waiter_equal);
+    OS_initialiseTCB(&tcb_waiter_high, stack_waiter_high+64, task_bench_waiter, BENCH_PRIORITY_HIGH, &_waiter_high);
+    OS_initialiseTCB(&tcb_consumer, stack_consumer+64, task_bench_consumer, BENCH_PRIORITY, NULL);
+
+	/* Initialise the scheduler and primitives under test */
+	OS_init(&round_robin_scheduler);
+    OS_mutexInitialise(&_bench_mutex);
+    OS_semaphoreInitialise(&_bench_semaphore, 1, 1);
+    OS_semaphoreInitialise(&_waiter_equal.go, 1, 0);
+    OS_semaphoreInitialise(&_waiter_high.go, 1, 0);
+    OS_queueInitialise(&_bench_queue, &_bench_queue_store, 1, sizeof(_bench_queue_store[0]));
+    OS_spscQueueInitialise(&_bench_spsc_queue, &_bench_spsc_queue_store, 1, sizeof(_bench_spsc_queue_store[0]));
+    OS_queueInitialise(&_bench_throughput_queue, &_bench_throughput_store, BENCH_THROUGHPUT_LENGTH, sizeof(uint32_t));
+    OS_spscQueueInitialise(&_bench_throughput_spsc_queue, &_bench_throughput_spsc_store, BENCH_THROUGHPUT_LENGTH, sizeof(uint32_t));
+    OS_semaphoreInitialise(&_bench_consumer_go, 1, 0);
+    OS_semaphoreInitialise(&_bench_consumer_done, 1, 0);
+    OS_memPoolInitialise(&_bench_mempool, &_bench_mempool_store, 4, sizeof(_bench_mempool_store[0]));
+
+    OS_addTask(&tcb_bench);
+    OS_addTask(&tcb_waiter_equal);
+    OS_addTask(&tcb_waiter_high);
+    OS_addTask(&tcb_consumer);
+
+    /* Finally start the OS */
+	OS_start();
+}
+
+/*=============================================================================
+**       Benchmark Tasks
+=============================================================================*/
+/**
+ * [task_bench The benchmark task, running every benchmark once and printing
+ *   the results.]
+ * @param args [unused]
+ */
+void task_bench(void const * const args) {
+    uint32_t start;
+
+    /* Calibrate the cost of the measurement itself */
+    _bench_overhead = UINT32_MAX;
+    for (uint32_t i = 0; i < BENCH_RUNS; i++) {
+        start = bench_cycles();
+        start = bench_cycles() - start;
+        if (start < _bench_overhead) {
+            _bench_overhead = start;
+        }
+    }
+
+    bench_uncontended();
+    bench_contended(&_waiter_equal, 1);
+    bench_contended(&_waiter_high, 0);
+
+    printf("BENCH\t%-40s %8s %8s %8s\n\r", "Operation", "min", "avg", "max");
+    for (uint32_t i = 0; i < RESULT_COUNT; i++) {
+        bench_print(&_results[i]);
+    }
+    printf("BENCH\tThroughput of %u items through a queue of %u (cycles per item)\n\r",
+            BENCH_THROUGHPUT_ITEMS, BENCH_THROUGHPUT_LENGTH);
+    printf("BENCH\t%-40s %8u\n\r", "OS_Queue_t", bench_throughput(BENCH_THROUGHPUT_QUEUE));
+    printf("BENCH\t%-40s %8u\n\r", "OS_SPSCQueue_t", bench_throughput(BENCH_THROUGHPUT_SPSC));
+    printf("BENCH\t%-40s %8u\n\r", "OS_Queue_t (EnqueueN/DequeueN)", bench_throughput(BENCH_THROUGHPUT_BATCH));
+    printf("BENCH\tDone (measurement overhead of %u removed)\n\r", _bench_overhead);
+}
+
+/**
+ * [task_bench_waiter A task waiting for the resources of the benchmark task.
+ *  Runs the current case each time its go semaphore is given.]
+ * @param args [pointer to the Bench_Waiter_t of the task]
+ */
+void task_bench_waiter(void const * const args) {
+    Bench_Waiter_t * waiter = (Bench_Waiter_t *)args;
+    uint32_t start, item;
+    while (1) {
+        OS_semaphoreTake(&waiter->go);
+        /* Block on the resource held (or emptied) by the benchmark task, which
+            measures the time until it runs again from start */
+        start = bench_cycles();
+        _bench_release_time = start;
+        switch (_bench_case) {
+        case BENCH_CASE_MUTEX:
+            OS_mutexAcquire(&_bench_mutex);
+            bench_record(waiter->wake, _bench_release_time, bench_cycles());
+            OS_mutexRelease(&_bench_mutex);
+            break;
+        case BENCH_CASE_SEMAPHORE:
+            OS_semaphoreTake(&_bench_semaphore);
+            bench_record(waiter->wake, _bench_release_time, bench_cycles());
+            OS_semaphoreGive(&_bench_semaphore);
+            break;
+        case BENCH_CASE_QUEUE:
+            OS_queueDequeue(&_bench_queue, &item);
+            bench_record(waiter->wake, _bench_release_time, bench_cycles());
+            break;
+        case BENCH_CASE_YIELD:
+            OS_yield();
+            bench_record(&_results[RESULT_YIELD], _bench_release_time, bench_cycles());
+            break;
+        }
+    }
+}
+
+/**
+ * [task_bench_consumer The consumer of the throughput benchmark. Dequeues
+ *   BENCH_THROUGHPUT_ITEMS items from the current queue each time its go
+ *   semaphore is given, then signals that it is done.]
+ * @param args [unused]
+ */
+void task_bench_consumer(void const * const args) {
+    uint32_t items[BENCH_THROUGHPUT_LENGTH];
+    while (1) {
+        OS_semaphoreTake(&_bench_consumer_go);
+        for (uint32_t i = 0; i < BENCH_THROUGHPUT_ITEMS; ) {
+            switch (_bench_throughput) {
+                case BENCH_THROUGHPUT_QUEUE:
+                    OS_queueDequeue(&_bench_throughput_queue, items);
+                    i++;
+                    break;
+                case BENCH_THROUGHPUT_SPSC:
+                    OS_spscQueueDequeue(&_bench_throughput_spsc_queue, items);
+                    i++;
+                    break;
+                case BENCH_THROUGHPUT_BATCH:
+                    i += OS_queueDequeueN(&_bench_throughput_queue, items, BENCH_THROUGHPUT_LENGTH);
+                    break;
+            }
+        }
+        OS_semaphoreGive(&_bench_consumer_done);
+    }
+}
+
+/**
+ * [bench_uncontended Measures each primitive without any other task waiting]
+ */
+static void bench_uncontended(void) {
+    uint32_t start, item = 0;
+    void * block;
+    for (uint32_t i = 0; i < BENCH_RUNS; i++) {
+        start = bench_cycles();
+        OS_mutexAcquire(&_bench_mutex);
+        bench_record(&_results[RESULT_MUTEX_ACQUIRE], start, bench_cycles());
+        start = bench_cycles();
+        OS_mutexRelease(&_bench_mutex);
+        bench_record(&_results[RESULT_MUTEX_RELEASE], start, bench_cycles());
+
+        start = bench_cycles();
+        OS_semaphoreTake(&_bench_semaphore);
+        bench_record(&_results[RESULT_SEMAPHORE_TAKE], start, bench_cycles());
+        start = bench_cycles();
+        OS_semaphoreGive(&_bench_semaphore);
+        bench_record(&_results[RESULT_SEMAPHORE_GIVE], start, bench_cycles());
+
+        start = bench_cycles();
+        OS_queueEnqueue(&_bench_queue, &item);
+        bench_record(&_results[RESULT_QUEUE_ENQUEUE], start, bench_cycles());
+        start = bench_cycles();
+        OS_queueDequeue(&_bench_queue, &item);
+        bench_record(&_results[RESULT_QUEUE_DEQUEUE], start, bench_cycles());
+
+        start = bench_cycles();
+        OS_spscQueueEnqueue(&_bench_spsc_queue, &item);
+        bench_record(&_results[RESULT_SPSC_ENQUEUE], start, bench_cycles());
+        start = bench_cycles();
+        OS_spscQueueDequeue(&_bench_spsc_queue, &item);
+        bench_record(&_results[RESULT_SPSC_DEQUEUE], start, bench_cycles());
+
+        start = bench_cycles();
+        block = OS_memPoolAllocate(&_bench_mempool);
+        bench_record(&_results[RESULT_MEMPOOL_ALLOCATE], start, bench_cycles());
+        start = bench_cycles();
+        OS_memPoolDeallocate(&_bench_mempool, block);
+        bench_record(&_results[RESULT_MEMPOOL_DEALLOCATE], start, bench_cycles());
+    }
+}
+
+/**
+ * [bench_contended Measures a task blocking on each resource held by the
+ *   benchmark task, and being handed the resource when it is released.]
+ * @param waiter         [the waiting task]
+ * @param same_priority  [1 if the waiting task has the same priority as the
+ *   benchmark task, which then has to yield to let it run, 0 if it preempts]
+ */
+static void bench_contended(Bench_Waiter_t * waiter, uint32_t same_priority) {
+    uint32_t item = 0;
+    for (uint32_t bench_case = BENCH_CASE_MUTEX; bench_case <= BENCH_CASE_YIELD; bench_case++) {
+        /* Yield is only measured between tasks of equal priority */
+        if (bench_case == BENCH_CASE_YIELD && !same_priority) {
+            break;
+        }
+        _bench_case = (Bench_Case_e)bench_case;
+        for (uint32_t i = 0; i < BENCH_CONTENDED_RUNS; i++) {
+            /* Hold (or empty) the resource, and let the waiter block on it */
+            switch (_bench_case) {
+            case BENCH_CASE_MUTEX:
+                OS_mutexAcquire(&_bench_mutex);
+                break;
+            case BENCH_CASE_SEMAPHORE:
+                OS_semaphoreTake(&_bench_semaphore);
+                break;
+            default:
+                break;
+            }
+            OS_semaphoreGive(&waiter->go);
+            if (same_priority) {
+                OS_yield();
+            }
+            if (_bench_case == BENCH_CASE_YIELD) {
+                /* The waiter has yielded back, having recorded the switch time */
+                _bench_release_time = bench_cycles();
+                OS_yield();
+                continue;
+            }
+            bench_record(waiter->block, _bench_release_time, bench_cycles());
+
+            /* Hand the resource over to the waiter */
+            _bench_release_time = bench_cycles();
+            switch (_bench_case) {
+            case BENCH_CASE_MUTEX:
+                OS_mutexRelease(&_bench_mutex);
+                break;
+            case BENCH_CASE_SEMAPHORE:
+                OS_semaphoreGive(&_bench_semaphore);
+                break;
+            case BENCH_CASE_QUEUE:
+                OS_queueEnqueue(&_bench_queue, &item);
+                break;
+            default:
+                break;
+            }
+            if (same_priority) {
+                OS_yield();
+            }
+        }
+        /* Move on to the results of the next case */
+        waiter->block += 2;
+        waiter->wake += 2;
+    }
+}
+
+/**
+ * [bench_throughput Measures the time to pass BENCH_THROUGHPUT_ITEMS items from
+ *   the benchmark task to the consumer task through a queue, including the
+ *   context switches as each blocks on the queue being full or empty.]
+ * @param throughput [the queue and calls to measure]
+ * @return           [the average number of cycles per item]
+ */
+static uint32_t bench_throughput(Bench_Throughput_t throughput) {
+    /* Static, as it does not fit the stack of the benchmark task */
+    static uint32_t items[BENCH_THROUGHPUT_ITEMS];
+    uint32_t start, end;
+    for (uint32_t i = 0; i < BENCH_THROUGHPUT_ITEMS; i++) {
+        items[i] = i;
+    }
+    _bench_throughput = throughput;
+    OS_semaphoreGive(&_bench_consumer_go);
+    start = bench_cycles();
+    for (uint32_t i = 0; i < BENCH_THROUGHPUT_ITEMS; ) {
+        switch (throughput) {
+            case BENCH_THROUGHPUT_QUEUE:
+                OS_queueEnqueue(&_bench_throughput_queue, &items[i]);
+                i++;
+                break;
+            case BENCH_THROUGHPUT_SPSC:
+                OS_spscQueueEnqueue(&_bench_throughput_spsc_queue, &items[i]);
+                i++;
+                break;
+            case BENCH_THROUGHPUT_BATCH:
+                i += OS_queueEnqueueN(&_bench_throughput_queue, &items[i],
+                        (BENCH_THROUGHPUT_ITEMS - i < BENCH_THROUGHPUT_LENGTH) ? BENCH_THROUGHPUT_ITEMS - i : BENCH_THROUGHPUT_LENGTH);
+                break;
+        }
+    }
+    OS_semaphoreTake(&_bench_consumer_done);
+    end = bench_cycles();
+    return (end - start) / BENCH_THROUGHPUT_ITEMS;
+}
+
+
+/*=============================================================================
+**       Measurement
+=============================================================================*/
+/**
+ * [bench_cycles Returns the current time in cycles, from the DWT cycle counter
+ *   or the SysTick. The SysTick time is read until the tick count is consistent
+ *   with the SysTick current value.]
+ * @return [the current time in cycles (modulo 2^32)]
+ */
+static uint32_t bench_cycles(void) {
+    uint32_t ticks, value;
+    if (_bench_use_dwt) {
+        return DWT->CYCCNT;
+    }
+    do {
+        ticks = OS_elapsedTicks();
+        value = SysTick->VAL;
+    } while (ticks != OS_elapsedTicks());
+    return (ticks * (SysTick->LOAD + 1)) + (SysTick->LOAD - value);
+}
+
+/**
+ * [bench_record Records a single measurement]
+ * @param result [the result to add the measurement to]
+ * @param start  [the time at the start of the measurement]
+ * @param end    [the time at the end of the measurement]
+ */
+static void bench_record(Bench_Result_t * result, uint32_t start, uint32_t end) {
+    uint32_t cycles = end - start;
+    cycles = (cycles > _bench_overhead) ? (cycles - _bench_overhead) : 0;
+    if (result->runs == 0 || cycles < result->min) {
+        result->min = cycles;
+    }
+    if (cycles > result->max) {
+        result->max = cycles;
+    }
+    result->total += cycles;
+    result->runs++;
+}
+
+/**
+ * [bench_print Prints a line of the results table]
+ * @param result [the result to print]
+ */
+static void bench_print(Bench_Result_t const * result) {
+    if (result->runs == 0) {
+        return;
+    }
+    printf("BENCH\t%-40s %8u %8u %8u\n\r", result->name, result->min,
+            (uint32_t)(result->total / result->runs), result->max);
+}
@@ -6,7 +6,7 @@
 #include "mutex.h"
 #include "semaphore.h"
 #include "queue.h"
-#include "mempool.h"
+#include "spscQueue.h"
 
 /**
  *  This file contains the demonstration code that shows the created OS' features
@@ -18,12 +18,10 @@
 /*=============================================================================
 **      Definitions
 =============================================================================*/
-#define NUMBER_OF_SENSORS 2
 #define SENSOR_1_FREQUENCY 50
 #define SENSOR_1_NUMBER_OF_AVERAGES 100
 
 #define SENSOR_QUEUE_SIZE 4
-#define SENSOR_PACKET_MEMORY_POOL_SIZE (2 * NUMBER_OF_SENSORS)
 #define SENSOR_PACKET_DATA_LENGTH 3
 
 /*=============================================================================
@@ -61,16 +59,19 @@ void task_low_pri_print(void const * const args);
 /*=============================================================================
 **      Global Variables , including mutexes, semaphores, queues, mempools, etc.
 =============================================================================*/
-/* Queues that the sensors can rapidly transmit readings over to other tasks */
-static OS_Queue_t   queue_sensor_1,
-                    queue_sensor_2_3;
-
-/* A memory pool for sensor packet blocks to be allocated and deallocated when needed */
-static OS_MemPool_t mempool_sensor_packet;
+/* Queues that the sensors can rapidly transmit readings over to other tasks.
+    Sensor 1 is the only producer of its queue, and task_compile_print_sens_1 the
+    only consumer, so it can use the lighter single-producer single-consumer queue.
+    Sensor packets are built and read in place in the queue, without copying. */
+static OS_SPSCQueue_t queue_sensor_1;
+static OS_Queue_t   queue_sensor_2_3;
 
 
 static OS_Mutex_t serial_mutex;
 
+/* Number of sensor 1 periods missed as the sensor task was not run in time */
+static volatile uint32_t sensor_1_overruns = 0;
+
 
 /*=============================================================================
 **      Main Function
@@ -118,14 +119,9 @@ int main(void) {
     static uint32_t queue_store_sensor_2_3[SENSOR_QUEUE_SIZE];
 
     /* Initialise queues for sharing sensor data */
-    OS_queueInitialise(&queue_sensor_1, &queue_store_sensor_1, SENSOR_QUEUE_SIZE, sizeof(SensorPacket_t));
+    OS_spscQueueInitialise(&queue_sensor_1, &queue_store_sensor_1, SENSOR_QUEUE_SIZE, sizeof(SensorPacket_t));
     OS_queueInitialise(&queue_sensor_2_3, &queue_store_sensor_2_3, SENSOR_QUEUE_SIZE, sizeof(uint32_t));
 
-    /* Memory for sensor and compile packet memory pools */
-    static SensorPacket_t mempool_sensor_packets_mem[SENSOR_PACKET_MEMORY_POOL_SIZE];
-    /* Initialise memory pools */
-    OS_memPoolInitialise(&mempool_sensor_packet, &mempool_sensor_packets_mem , SENSOR_PACKET_MEMORY_POOL_SIZE, sizeof(SensorPacket_t));
-
     /* Add tasks to the scheduler */
 	OS_addTask(&tcb_sensor_1);
 	OS_addTask(&tcb_sensor_2);
@@ -144,57 +140,58 @@ int main(void) {
 /**
  * [task_sensor_1 Sends "sensor" data over queue_sensor_1 to
  *   task_compile_print_sens_1 every 1/SENSOR_1_FREQUENCY ms.
- *  Utilises a memory pool for allocation of packets.]
+ *  Builds the packets in place in the queue. Sleeps until the next period
+ *   rather than for a period, so the samples do not drift by the time taken
+ *   to build and send them.]
  * @param args [NA]
  */
 void task_sensor_1(void const * const args) {
-    /*  A pointer to a packet, memory to be allocated from a memory pool */
+    /*  A pointer to a packet, in a slot reserved in the queue */
     SensorPacket_t * packet;
     uint32_t sensor_data_counter = 0;
+    uint32_t last_wake = OS_elapsedTicks();
     while(1) {
-        /* Allocate memory for the senor packet */
-        packet = OS_memPoolAllocate(&mempool_sensor_packet);
+        /* Reserve a slot in the queue for the sensor packet */
+        packet = OS_spscQueueReserve(&queue_sensor_1);
         /* Fill the packet with data from peripheral */
         packet->id = ACCELEROMETER;
         for(uint_fast8_t i = 1; i <=SENSOR_PACKET_DATA_LENGTH; i++) {
             /* "Read" Sensor peripheral */
             packet->data[i-1] = i * sensor_data_counter++;
         }
-        /* Send the pointer to the allocated block via the queue -
-            it will be deallocated by the receiving task */
-        OS_queueEnqueue(&queue_sensor_1, &packet);
-        OS_sleep(1000 / SENSOR_1_FREQUENCY);
+        /* Send the packet to the receiving task */
+        OS_spscQueueCommit(&queue_sensor_1);
+        sensor_1_overruns += OS_sleepUntil(&last_wake, 1000 / SENSOR_1_FREQUENCY);
     }
 }
 
 
 /**
  * [task_compile_print_sens_1 Dequeues, compiles, averages and prints the
- *  received data from task_sensor_1 over queue_sensor_1. After use it
- *  deallocates the sensor packets so they can be reused by the sensor.]
+ *  received data from task_sensor_1 over queue_sensor_1. The packets are
+ *  read in place, and released after use so the sensor can reuse their slots.]
  * @param args [NA]
  */
 void task_compile_print_sens_1(void const * const args) {
-    /*  A pointer to a packet to be received from queue and deallocated
-        to a memory pool after data processing, as well as the new compiled packet
-        to create and send further */
-    SensorPacket_t * packet_r;
+    /*  A pointer to a packet at the front of the queue, released from the
+        queue after data processing */
+    SensorPacket_t const * packet_r;
     uint32_t num_averages, sensor_id;
     while(1) {
         uint32_t data_average[SENSOR_PACKET_DATA_LENGTH] = {0};
         /* Retrieve a packet from the queue */
         num_averages = 0;
-        /* For a set number of averages, deqeue sensor data and add to avarages,
-            then deallocate the memory block so it can be reused by the sensor */
+        /* For a set number of averages, peek at sensor data and add to avarages,
+            then release the packet so its slot can be reused by the sensor */
         while (num_averages <= SENSOR_1_NUMBER_OF_AVERAGES) {
-            OS_queueDequeue(&queue_sensor_1, &packet_r);
+            packet_r = OS_spscQueuePeek(&queue_sensor_1);
             sensor_id = packet_r->id;
             for (uint_fast8_t i = 1; i <=SENSOR_PACKET_DATA_LENGTH; i++) {
                 /* "Store" Sensor data for processing */
                 data_average[i-1] += packet_r->data[i-1];
             }
-            /* Deallocate the packet once its finished. */
-            OS_memPoolDeallocate(&mempool_sensor_packet, packet_r);
+            /* Release the packet once its finished. */
+            OS_spscQueueRelease(&queue_sensor_1);
             num_averages++;
         }
         for (uint_fast8_t i = 1; i <=SENSOR_PACKET_DATA_LENGTH; i++) {
@@ -202,8 +199,8 @@ void task_compile_print_sens_1(void const * const args) {
             data_average[i-1] /= num_averages;
         }
         OS_mutexAcquire(&serial_mutex);
-        printf("Sensor %d Transmitted: \tTime: %d, \tD1: %d, \tD2: %d, \tD3: %d\n\r", sensor_id,
-                OS_elapsedTicks(), data_average[0], data_average[1], data_average[2]);
+        printf("Sensor %d Transmitted: \tTime: %d, \tD1: %d, \tD2: %d, \tD3: %d, \tOverruns: %d\n\r", sensor_id,
+                OS_elapsedTicks(), data_average[0], data_average[1], data_average[2], sensor_1_overruns);
         OS_mutexRelease(&serial_mutex);
     }
 }
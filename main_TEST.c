@@ -1,5 +1,7 @@
 #include "os.h"
+#include "stm32f4xx.h"
 #include <stdio.h>
+#include <string.h>
 #include "utils/serial.h"
 #include "roundRobin.h"
 #include "sleep.h"
@@ -7,19 +9,45 @@
 #include "semaphore.h"
 #include "queue.h"
 #include "mempool.h"
+#include "memAlloc.h"
+#include "edf.h"
 
-/* Define which tests to run - uncomment to not run */
+/* Define which tests to run - comment out to not run.
+    The tasks of all the tests defined must not exceed MAX_TASKS (roundRobin.h),
+     and the tests to run alone must be the only test defined. */
 #define TEST_SLEEP          //3 tasks
 #define TEST_MUTEX          //5 tasks
 #define TEST_SEMAPHORE      //3 tasks
 #define TEST_QUEUE          //3 tasks
 #define TEST_MEMPOOL        //3 tasks
+//#define TEST_SCHEDULER_BENCH //1 task, run alone for the worst case of the linear scan
+//#define TEST_TIME_SLICE     //2 tasks
+//#define TEST_PRIORITY_INHERITANCE //3 tasks
+//#define TEST_WAIT_ABORTS    //1 task
+//#define TEST_QUEUE_BATCH    //2 tasks
+//#define TEST_QUEUE_ZERO_COPY //2 tasks
+//#define TEST_QUEUE_ISR      //2 tasks and an interrupt
+//#define TEST_TIMEOUT        //2 tasks
+//#define TEST_MEMPOOL_STRESS //3 tasks
+//#define TEST_MEM_ALLOC      //2 tasks
+//#define TEST_SLEEP_ACCURACY //4 tasks, run alone to check that no task wakes late
+//#define TEST_SLEEP_UNTIL    //1 task, run alone to check that it wakes exactly on its period
+//#define TEST_TICKLESS       //1 task, run alone, needs OS_TICKLESS_IDLE and OS_PRIVILEGED_TASKS (not on the POSIX port)
+//#define TEST_EDF            //3 tasks, run alone, as it runs all the enabled tests on the EDF scheduler
 
 #if defined (TEST_SLEEP) || defined (TEST_MUTEX) || defined (TEST_SEMAPHORE) || \
-         defined (TEST_QUEUE) || defined (TEST_MEMPOOL) 
+         defined (TEST_QUEUE) || defined (TEST_MEMPOOL) || defined (TEST_SCHEDULER_BENCH) || \
+         defined (TEST_TIME_SLICE) || defined (TEST_PRIORITY_INHERITANCE) || defined (TEST_WAIT_ABORTS) || \
+         defined (TEST_QUEUE_BATCH) || defined (TEST_QUEUE_ZERO_COPY) || defined (TEST_QUEUE_ISR) || defined (TEST_TIMEOUT) || \
+         defined (TEST_MEMPOOL_STRESS) || defined (TEST_MEM_ALLOC) || defined (TEST_SLEEP_ACCURACY) || \
+         defined (TEST_SLEEP_UNTIL) || defined (TEST_TICKLESS) || defined (TEST_EDF)
 # define TESTS_ACTIVE
 #endif
 
+#if defined (TEST_TICKLESS) && (!defined (OS_TICKLESS_IDLE) || !defined (OS_PRIVILEGED_TASKS))
+# error "TEST_TICKLESS needs OS_TICKLESS_IDLE, and OS_PRIVILEGED_TASKS to read the DWT, see os.h"
+#endif
+
 
 /* Function Prototypes  */
 void my_welcome(void);
@@ -46,6 +74,45 @@ void task_mempool_1(void const * const args);
 void task_mempool_2(void const * const args);
 void task_mempool_3(void const * const args);
 
+void task_scheduler_bench(void const * const args);
+void scheduler_benchmark(void);
+
+void task_time_slice_1(void const * const args);
+void task_time_slice_2(void const * const args);
+
+void task_priority_inheritance_low(void const * const args);
+void task_priority_inheritance_medium(void const * const args);
+void task_priority_inheritance_high(void const * const args);
+
+void task_wait_aborts(void const * const args);
+
+void task_queue_batch_producer(void const * const args);
+void task_queue_batch_consumer(void const * const args);
+
+void task_queue_zero_copy_producer(void const * const args);
+void task_queue_zero_copy_consumer(void const * const args);
+
+void task_queue_isr_producer(void const * const args);
+void task_queue_isr_consumer(void const * const args);
+void EXTI0_IRQHandler(void);
+
+void task_timeout_waiter(void const * const args);
+void task_timeout_holder(void const * const args);
+
+void task_mempool_stress(void const * const args);
+
+void task_mem_alloc_producer(void const * const args);
+void task_mem_alloc_consumer(void const * const args);
+
+void task_sleep_accuracy(void const * const args);
+
+void task_sleep_until(void const * const args);
+
+void task_tickless(void const * const args);
+
+void task_edf_periodic(void const * const args);
+void task_edf_report(void const * const args);
+
 void myOverflowTest(void);
 
 /* Global Variables , including mutexes, semaphores, queues, etc.*/
@@ -88,6 +155,149 @@ static OS_Queue_t _mempool_queue;
 __align(4)
 static uint32_t * _mempool_queue_store[MEMORY_POOL_QUEUE_SIZE];
 
+
+/* Batched Queue Test. Single byte items, so that wrapping around the end of
+    the queue storage is tested at every offset. */
+#define QUEUE_BATCH_TEST_SIZE       7
+#define QUEUE_BATCH_TEST_SEND       5
+#define QUEUE_BATCH_TEST_RECEIVE    3
+#define QUEUE_BATCH_TEST_PRINT      200
+static OS_Queue_t _queue_batch_test;
+__align(4)
+static uint8_t _queue_batch_store[QUEUE_BATCH_TEST_SIZE];
+
+
+/* Zero-Copy Queue Test. Items are built and read in place in the queue storage. */
+#define QUEUE_ZERO_COPY_TEST_SIZE   4
+#define QUEUE_ZERO_COPY_TEST_BYTES  16
+#define QUEUE_ZERO_COPY_TEST_PRINT  200
+typedef struct {
+    uint32_t sequence;
+    uint8_t payload[QUEUE_ZERO_COPY_TEST_BYTES];
+} QueueZeroCopyTestItem_t;
+static OS_Queue_t _queue_zero_copy_test;
+static QueueZeroCopyTestItem_t _queue_zero_copy_store[QUEUE_ZERO_COPY_TEST_SIZE];
+
+
+/* Interrupt Queue Test. The interrupt enqueues a running count, and the task
+    interrupted while enqueueing enqueues QUEUE_ISR_TEST_TASK_ITEM. */
+#define QUEUE_ISR_TEST_SIZE         4
+#define QUEUE_ISR_TEST_TASK_ITEM    0xFFFFFFFFUL
+#define QUEUE_ISR_TEST_PRINT        200
+static OS_Queue_t _queue_isr_test;
+__align(4)
+static uint32_t _queue_isr_store[QUEUE_ISR_TEST_SIZE];
+/* The next count to enqueue, and the number of enqueues that failed */
+static volatile uint32_t _queue_isr_next = 0, _queue_isr_full = 0, _queue_isr_busy = 0;
+
+
+/* Timeout Test. The holder keeps the mutex for twice the timeout, and gives
+    the semaphore half way through one of the waiter's waits. It then waits
+    for a semaphore that is never given while holding the mutex. */
+#define TIMEOUT_TEST_TICKS          20
+#define TIMEOUT_TEST_HOLDER_PRIORITY 2
+static OS_Mutex_t _timeout_mutex;
+static OS_Semaphore_t _timeout_semaphore, _timeout_start, _timeout_never;
+static OS_Queue_t _timeout_queue;
+__align(4)
+static uint32_t _timeout_queue_store[1];
+static OS_MemPool_t _timeout_pool;
+static uint32_t _timeout_pool_block[1];
+static volatile uint32_t _timeout_errors = 0;
+
+
+/* Memory Pool Stress Test. Every task holds MEMPOOL_STRESS_HELD blocks at once,
+    more than the pool has for all tasks, so tasks also wait for blocks. */
+#define MEMPOOL_STRESS_TASKS        3
+#define MEMPOOL_STRESS_BLOCKS       4
+#define MEMPOOL_STRESS_HELD         2
+#define MEMPOOL_STRESS_PRINT        2000
+/* Enough for all pools in this file, including the size classes of memAlloc.h */
+#define MEMPOOL_STRESS_SNAPSHOTS    16
+static OS_MemPool_t _mempool_stress;
+static uint32_t _mempool_stress_blocks[MEMPOOL_STRESS_BLOCKS][2];
+static volatile uint32_t _mempool_stress_cycles = 0, _mempool_stress_errors = 0;
+
+
+/* Size Class Allocator Test. The 512 byte class has no blocks, so those
+    sizes are served from the 1024 byte class. */
+#define MEM_ALLOC_TEST_QUEUE_SIZE   4
+#define MEM_ALLOC_TEST_PRINT        2000
+typedef struct {
+    uint8_t * block;
+    uint32_t size;
+} MemAllocTestItem_t;
+static const uint32_t _mem_alloc_blocks[MEM_ALLOC_CLASSES] = {4, 4, 4, 4, 2, 2, 0, 1};
+static uint64_t _mem_alloc_heap[(MEM_ALLOC_CLASS_BYTES(0, 4) + MEM_ALLOC_CLASS_BYTES(1, 4) + MEM_ALLOC_CLASS_BYTES(2, 4) +
+                                  MEM_ALLOC_CLASS_BYTES(3, 4) + MEM_ALLOC_CLASS_BYTES(4, 2) + MEM_ALLOC_CLASS_BYTES(5, 2) +
+                                  MEM_ALLOC_CLASS_BYTES(7, 1)) / sizeof(uint64_t)];
+static OS_Queue_t _mem_alloc_queue;
+static MemAllocTestItem_t _mem_alloc_queue_store[MEM_ALLOC_TEST_QUEUE_SIZE];
+static volatile uint32_t _mem_alloc_cycles = 0, _mem_alloc_errors = 0;
+
+
+/* Sleep Accuracy Test. The durations step across the 64 and 4096 tick level
+    boundaries of the timer wheel (SLEEP_TIMER_WHEEL, see sleep.h). */
+#define SLEEP_ACCURACY_TASKS        4
+#define SLEEP_ACCURACY_DURATIONS    8
+#define SLEEP_ACCURACY_PRINT        16
+static const uint32_t _sleep_accuracy_durations[SLEEP_ACCURACY_DURATIONS] = {0, 1, 63, 64, 65, 127, 4095, 4097};
+static volatile uint32_t _sleep_accuracy_cycles = 0, _sleep_accuracy_errors = 0, _sleep_accuracy_max_late = 0;
+
+
+/* Periodic Sleep Test. Every SLEEP_UNTIL_OVERRUN_EVERY cycles the task works
+    for SLEEP_UNTIL_OVERRUN_WORK ticks, longer than two periods. */
+#define SLEEP_UNTIL_PERIOD          10
+#define SLEEP_UNTIL_OVERRUN_EVERY   8
+#define SLEEP_UNTIL_OVERRUN_WORK    25
+#define SLEEP_UNTIL_PRINT           32
+static volatile uint32_t _sleep_until_cycles = 0, _sleep_until_overruns = 0, _sleep_until_errors = 0, _sleep_until_max_late = 0;
+
+
+/* Tickless Idle Test. The durations step across the longest period the SysTick
+    can be programmed for while idling (around 99 ticks at 168 MHz). */
+#define TICKLESS_DURATIONS  8
+#define TICKLESS_PRINT      8
+static const uint32_t _tickless_durations[TICKLESS_DURATIONS] = {2, 10, 50, 97, 98, 99, 150, 400};
+static volatile uint32_t _tickless_cycles = 0, _tickless_errors = 0;
+
+
+/* EDF Test. Two periodic tasks with a utilisation of 5/10 + 6/15 = 0.9, above
+    the 0.83 bound of rate monotonic scheduling for two tasks. Under fixed
+    priorities the second task would miss its deadline in its first period. */
+#define EDF_TEST_TASKS      2
+#define EDF_TEST_REPORT     500
+typedef struct {
+    uint32_t period;
+    uint32_t work;
+} EdfTestTask_t;
+static const EdfTestTask_t _edf_test_tasks[EDF_TEST_TASKS] = {{10, 5}, {15, 6}};
+static volatile uint32_t _edf_jobs[EDF_TEST_TASKS] = {0}, _edf_missed[EDF_TEST_TASKS] = {0};
+
+
+/* Scheduler Benchmark */
+#define SCHEDULER_BENCH_RUNS 1000
+
+
+/* Time Slice Test */
+#define TIME_SLICE_TEST_TICKS 10
+#define TIME_SLICE_TEST_SLICES 20
+/* The number of the time slice test task that last ran */
+static uint32_t volatile _time_slice_last_task = 0;
+
+
+/* Priority Inheritance Test */
+#define PI_TEST_HOLD_TICKS      5
+#define PI_TEST_MEDIUM_TICKS    20
+#define PI_TEST_CYCLES          10
+/* The lock shared by the low and high priority tasks, taken as a mutex (with
+    priority inheritance) or a binary semaphore (without) on alternate cycles */
+static OS_Mutex_t _pi_mutex;
+static OS_Semaphore_t _pi_semaphore;
+static uint32_t volatile _pi_use_mutex = 0;
+/* Signals between the tasks to run each cycle */
+static OS_Semaphore_t _pi_start_low, _pi_locked_low, _pi_start_medium, _pi_done_medium;
+
 /*=============================================================================
 **       
 =============================================================================*/
@@ -156,6 +366,80 @@ int main(void) {
                     tcb_mempool_2,\
                     tcb_mempool_3;
 #endif
+#ifdef TEST_SCHEDULER_BENCH
+    static uint32_t stack_scheduler_bench[64];
+    static OS_TCB_t tcb_scheduler_bench;
+#endif
+#ifdef TEST_TIME_SLICE
+    static uint32_t stack_time_slice_1[64],\
+                    stack_time_slice_2[64];
+	static OS_TCB_t tcb_time_slice_1,\
+                    tcb_time_slice_2;
+#endif
+#ifdef TEST_PRIORITY_INHERITANCE
+    static uint32_t stack_pi_low[64],\
+                    stack_pi_medium[64],\
+                    stack_pi_high[64];
+	static OS_TCB_t tcb_pi_low,\
+                    tcb_pi_medium,\
+                    tcb_pi_high;
+#endif
+#ifdef TEST_WAIT_ABORTS
+    static uint32_t stack_wait_aborts[64];
+    static OS_TCB_t tcb_wait_aborts;
+#endif
+#ifdef TEST_QUEUE_BATCH
+    static uint32_t stack_queue_batch_producer[64],\
+                    stack_queue_batch_consumer[64];
+	static OS_TCB_t tcb_queue_batch_producer,\
+                    tcb_queue_batch_consumer;
+#endif
+#ifdef TEST_QUEUE_ZERO_COPY
+    static uint32_t stack_queue_zero_copy_producer[64],\
+                    stack_queue_zero_copy_consumer[64];
+	static OS_TCB_t tcb_queue_zero_copy_producer,\
+                    tcb_queue_zero_copy_consumer;
+#endif
+#ifdef TEST_QUEUE_ISR
+    static uint32_t stack_queue_isr_producer[64],\
+                    stack_queue_isr_consumer[64];
+	static OS_TCB_t tcb_queue_isr_producer,\
+                    tcb_queue_isr_consumer;
+#endif
+#ifdef TEST_MEM_ALLOC
+    static uint32_t stack_mem_alloc_producer[64],\
+                    stack_mem_alloc_consumer[64];
+	static OS_TCB_t tcb_mem_alloc_producer,\
+                    tcb_mem_alloc_consumer;
+#endif
+#ifdef TEST_SLEEP_ACCURACY
+    static uint32_t stack_sleep_accuracy[SLEEP_ACCURACY_TASKS][64];
+	static OS_TCB_t tcb_sleep_accuracy[SLEEP_ACCURACY_TASKS];
+#endif
+#ifdef TEST_SLEEP_UNTIL
+    static uint32_t stack_sleep_until[64];
+	static OS_TCB_t tcb_sleep_until;
+#endif
+#ifdef TEST_TICKLESS
+    static uint32_t stack_tickless[64];
+	static OS_TCB_t tcb_tickless;
+#endif
+#ifdef TEST_EDF
+    static uint32_t stack_edf_periodic[EDF_TEST_TASKS][64],\
+                    stack_edf_report[64];
+	static OS_TCB_t tcb_edf_periodic[EDF_TEST_TASKS],\
+                    tcb_edf_report;
+#endif
+#ifdef TEST_MEMPOOL_STRESS
+    static uint32_t stack_mempool_stress[MEMPOOL_STRESS_TASKS][64];
+	static OS_TCB_t tcb_mempool_stress[MEMPOOL_STRESS_TASKS];
+#endif
+#ifdef TEST_TIMEOUT
+    static uint32_t stack_timeout_waiter[64],\
+                    stack_timeout_holder[64];
+	static OS_TCB_t tcb_timeout_waiter,\
+                    tcb_timeout_holder;
+#endif
 
 	/* Initialise TCBs */
 #ifdef TEST_SLEEP   
@@ -185,9 +469,79 @@ int main(void) {
     OS_initialiseTCB(&tcb_mempool_2, stack_mempool_2+64, task_mempool_2, PRIORITY_MAX, NULL);
     OS_initialiseTCB(&tcb_mempool_3, stack_mempool_3+64, task_mempool_3, PRIORITY_MAX, NULL);
 #endif
+#ifdef TEST_SCHEDULER_BENCH
+    /* Lowest priority, so the linear scan has to search every priority above it */
+    OS_initialiseTCB(&tcb_scheduler_bench, stack_scheduler_bench+64, task_scheduler_bench, 1, NULL);
+#endif
+#ifdef TEST_TIME_SLICE
+    /* Lowest priority, as the tasks never block and would starve lower priorities */
+    OS_initialiseTCB(&tcb_time_slice_1, stack_time_slice_1+64, task_time_slice_1, 1, (void *)1);
+    OS_initialiseTCB(&tcb_time_slice_2, stack_time_slice_2+64, task_time_slice_2, 1, (void *)2);
+    OS_roundRobinSetTimeSlice(1, TIME_SLICE_TEST_TICKS);
+#endif
+#ifdef TEST_PRIORITY_INHERITANCE
+    OS_initialiseTCB(&tcb_pi_low, stack_pi_low+64, task_priority_inheritance_low, 1, NULL);
+    OS_initialiseTCB(&tcb_pi_medium, stack_pi_medium+64, task_priority_inheritance_medium, 2, NULL);
+    OS_initialiseTCB(&tcb_pi_high, stack_pi_high+64, task_priority_inheritance_high, 3, NULL);
+#endif
+#ifdef TEST_WAIT_ABORTS
+    OS_initialiseTCB(&tcb_wait_aborts, stack_wait_aborts+64, task_wait_aborts, PRIORITY_MAX, NULL);
+#endif
+#ifdef TEST_QUEUE_BATCH
+    OS_initialiseTCB(&tcb_queue_batch_producer, stack_queue_batch_producer+64, task_queue_batch_producer, PRIORITY_MAX, NULL);
+    OS_initialiseTCB(&tcb_queue_batch_consumer, stack_queue_batch_consumer+64, task_queue_batch_consumer, PRIORITY_MAX, NULL);
+#endif
+#ifdef TEST_QUEUE_ZERO_COPY
+    OS_initialiseTCB(&tcb_queue_zero_copy_producer, stack_queue_zero_copy_producer+64, task_queue_zero_copy_producer, PRIORITY_MAX, NULL);
+    OS_initialiseTCB(&tcb_queue_zero_copy_consumer, stack_queue_zero_copy_consumer+64, task_queue_zero_copy_consumer, PRIORITY_MAX, NULL);
+#endif
+#ifdef TEST_QUEUE_ISR
+    OS_initialiseTCB(&tcb_queue_isr_producer, stack_queue_isr_producer+64, task_queue_isr_producer, PRIORITY_MAX, NULL);
+    OS_initialiseTCB(&tcb_queue_isr_consumer, stack_queue_isr_consumer+64, task_queue_isr_consumer, PRIORITY_MAX, NULL);
+    /* Let the unprivileged tasks trigger the test interrupt through NVIC->STIR */
+    SCB->CCR |= SCB_CCR_USERSETMPEND_Msk;
+    NVIC_EnableIRQ(EXTI0_IRQn);
+#endif
+#ifdef TEST_TIMEOUT
+    /* The holder has a lower priority, to inherit the waiter's priority */
+    OS_initialiseTCB(&tcb_timeout_waiter, stack_timeout_waiter+64, task_timeout_waiter, PRIORITY_MAX, NULL);
+    OS_initialiseTCB(&tcb_timeout_holder, stack_timeout_holder+64, task_timeout_holder, TIMEOUT_TEST_HOLDER_PRIORITY, NULL);
+#endif
+#ifdef TEST_MEMPOOL_STRESS
+    for (uint32_t i = 0; i < MEMPOOL_STRESS_TASKS; i++) {
+        OS_initialiseTCB(&tcb_mempool_stress[i], stack_mempool_stress[i]+64, task_mempool_stress, PRIORITY_MAX, (void *)(i + 1));
+    }
+#endif
+#ifdef TEST_MEM_ALLOC
+    OS_initialiseTCB(&tcb_mem_alloc_producer, stack_mem_alloc_producer+64, task_mem_alloc_producer, PRIORITY_MAX, NULL);
+    OS_initialiseTCB(&tcb_mem_alloc_consumer, stack_mem_alloc_consumer+64, task_mem_alloc_consumer, PRIORITY_MAX, NULL);
+#endif
+#ifdef TEST_SLEEP_ACCURACY
+    for (uint32_t i = 0; i < SLEEP_ACCURACY_TASKS; i++) {
+        OS_initialiseTCB(&tcb_sleep_accuracy[i], stack_sleep_accuracy[i]+64, task_sleep_accuracy, PRIORITY_MAX, (void *)i);
+    }
+#endif
+#ifdef TEST_SLEEP_UNTIL
+    OS_initialiseTCB(&tcb_sleep_until, stack_sleep_until+64, task_sleep_until, PRIORITY_MAX, NULL);
+#endif
+#ifdef TEST_TICKLESS
+    OS_initialiseTCB(&tcb_tickless, stack_tickless+64, task_tickless, PRIORITY_MAX, NULL);
+#endif
+#ifdef TEST_EDF
+    for (uint32_t i = 0; i < EDF_TEST_TASKS; i++) {
+        OS_initialiseTCB(&tcb_edf_periodic[i], stack_edf_periodic[i]+64, task_edf_periodic, PRIORITY_MAX, (void *)i);
+        OS_edfSetDeadline(&tcb_edf_periodic[i], _edf_test_tasks[i].period, _edf_test_tasks[i].period);
+    }
+    /* The default deadline runs the report in the background of the periodic tasks */
+    OS_initialiseTCB(&tcb_edf_report, stack_edf_report+64, task_edf_report, PRIORITY_MAX, NULL);
+#endif
 
 	/* Initialise the scheduler */
+#ifdef TEST_EDF
+	OS_init(&edf_scheduler);
+#else
 	OS_init(&round_robin_scheduler);
+#endif
     
     /* Initialise Mutexes for serial port print access (and testing) */
     OS_mutexInitialise(&_mutex_printf);
@@ -197,11 +551,33 @@ int main(void) {
     
     /* Initialise the queue for inter-task communication */
     OS_queueInitialise(&_queue_test, &_queue_store, TEST_QUEUE_SIZE, sizeof(QueueTestStruct_t));
+    OS_queueInitialise(&_queue_batch_test, &_queue_batch_store, QUEUE_BATCH_TEST_SIZE, sizeof(_queue_batch_store[0]));
+    OS_queueInitialise(&_queue_zero_copy_test, &_queue_zero_copy_store, QUEUE_ZERO_COPY_TEST_SIZE, sizeof(_queue_zero_copy_store[0]));
+    OS_queueInitialise(&_queue_isr_test, &_queue_isr_store, QUEUE_ISR_TEST_SIZE, sizeof(_queue_isr_store[0]));
     
     /* Initialise the memory pool */
     OS_memPoolInitialise(&_memory_pool_test, &_memory_pool_mem_block, MEMORY_POOL_SIZE, sizeof(MemPoolTestStruct_t));
     OS_queueInitialise(&_mempool_queue, &_mempool_queue_store, MEMORY_POOL_QUEUE_SIZE, sizeof(_mempool_queue_store[0]));
     
+    /* Initialise the priority inheritance test locks and signals */
+    OS_mutexInitialise(&_pi_mutex);
+    OS_semaphoreInitialiseBinary(&_pi_semaphore, 1);
+    OS_semaphoreInitialiseBinary(&_pi_start_low, 0);
+    OS_semaphoreInitialiseBinary(&_pi_locked_low, 0);
+    OS_semaphoreInitialiseBinary(&_pi_start_medium, 0);
+    OS_semaphoreInitialiseBinary(&_pi_done_medium, 0);
+
+    /* Initialise the timeout test resources, with a single slot and block */
+    OS_mutexInitialise(&_timeout_mutex);
+    OS_semaphoreInitialiseBinary(&_timeout_semaphore, 0);
+    OS_semaphoreInitialiseBinary(&_timeout_start, 0);
+    OS_semaphoreInitialiseBinary(&_timeout_never, 0);
+    OS_queueInitialise(&_timeout_queue, &_timeout_queue_store, 1, sizeof(_timeout_queue_store[0]));
+    OS_memPoolInitialise(&_timeout_pool, &_timeout_pool_block, 1, sizeof(_timeout_pool_block));
+    OS_memPoolInitialise(&_mempool_stress, &_mempool_stress_blocks, MEMPOOL_STRESS_BLOCKS, sizeof(_mempool_stress_blocks[0]));
+    OS_memAllocInitialise(&_mem_alloc_heap, sizeof(_mem_alloc_heap), _mem_alloc_blocks);
+    OS_queueInitialise(&_mem_alloc_queue, &_mem_alloc_queue_store, MEM_ALLOC_TEST_QUEUE_SIZE, sizeof(_mem_alloc_queue_store[0]));
+    
 
     /* Add tasks to the scheduler */
 #ifdef TEST_SLEEP 
@@ -231,6 +607,65 @@ int main(void) {
     OS_addTask(&tcb_mempool_2);
     OS_addTask(&tcb_mempool_3);
 #endif   
+#ifdef TEST_SCHEDULER_BENCH
+    OS_addTask(&tcb_scheduler_bench);
+    /* Must run before OS_start(), while main() is still privileged */
+    scheduler_benchmark();
+#endif
+#ifdef TEST_TIME_SLICE
+    OS_addTask(&tcb_time_slice_1);
+    OS_addTask(&tcb_time_slice_2);
+#endif
+#ifdef TEST_PRIORITY_INHERITANCE
+    OS_addTask(&tcb_pi_low);
+    OS_addTask(&tcb_pi_medium);
+    OS_addTask(&tcb_pi_high);
+#endif
+#ifdef TEST_WAIT_ABORTS
+    OS_addTask(&tcb_wait_aborts);
+#endif
+#ifdef TEST_QUEUE_BATCH
+    OS_addTask(&tcb_queue_batch_producer);
+    OS_addTask(&tcb_queue_batch_consumer);
+#endif
+#ifdef TEST_QUEUE_ZERO_COPY
+    OS_addTask(&tcb_queue_zero_copy_producer);
+    OS_addTask(&tcb_queue_zero_copy_consumer);
+#endif
+#ifdef TEST_QUEUE_ISR
+    OS_addTask(&tcb_queue_isr_producer);
+    OS_addTask(&tcb_queue_isr_consumer);
+#endif
+#ifdef TEST_TIMEOUT
+    OS_addTask(&tcb_timeout_waiter);
+    OS_addTask(&tcb_timeout_holder);
+#endif
+#ifdef TEST_MEMPOOL_STRESS
+    for (uint32_t i = 0; i < MEMPOOL_STRESS_TASKS; i++) {
+        OS_addTask(&tcb_mempool_stress[i]);
+    }
+#endif
+#ifdef TEST_MEM_ALLOC
+    OS_addTask(&tcb_mem_alloc_producer);
+    OS_addTask(&tcb_mem_alloc_consumer);
+#endif
+#ifdef TEST_SLEEP_ACCURACY
+    for (uint32_t i = 0; i < SLEEP_ACCURACY_TASKS; i++) {
+        OS_addTask(&tcb_sleep_accuracy[i]);
+    }
+#endif
+#ifdef TEST_SLEEP_UNTIL
+    OS_addTask(&tcb_sleep_until);
+#endif
+#ifdef TEST_TICKLESS
+    OS_addTask(&tcb_tickless);
+#endif
+#ifdef TEST_EDF
+    for (uint32_t i = 0; i < EDF_TEST_TASKS; i++) {
+        OS_addTask(&tcb_edf_periodic[i]);
+    }
+    OS_addTask(&tcb_edf_report);
+#endif
     
     /* Finally start the OS */
 	OS_start();
@@ -239,6 +674,215 @@ int main(void) {
 /*=============================================================================
     Test Tasks used to test parts of the OS functionality whilst developing 
 =============================================================================*/
+/*****************************************************************************
+    Scheduler benchmark, measuring the cycle count of the scheduler's search
+     for the highest runnable priority using the DWT cycle counter. The search
+     does not modify the scheduler state, so the benchmark can be run before
+     the OS is started without affecting the other tests. Comparing the priority bitmap against the
+     linear scan requires a second build with -DROUNDROBIN_LINEAR_SCAN.
+    For the worst case of the linear scan, all other tests should be disabled
+     so the only runnable task is at the lowest priority.
+    Requires from OS specific headers:
+        #include "roundRobin.h"
+        #include "stm32f4xx.h"
+******************************************************************************/
+void scheduler_benchmark(void) {
+    uint32_t start, cycles, cycles_min = UINT32_MAX, cycles_max = 0;
+    uint64_t cycles_total = 0;
+
+    /* Enable the DWT cycle counter. The DWT is not accessible from unprivileged
+        code, so this must run from main() before the OS is started. */
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    for (uint32_t i = 0; i < SCHEDULER_BENCH_RUNS; i++) {
+        start = DWT->CYCCNT;
+        OS_roundRobinHighestPriority();
+        cycles = DWT->CYCCNT - start;
+
+        cycles_total += cycles;
+        if (cycles < cycles_min) {
+            cycles_min = cycles;
+        }
+        if (cycles > cycles_max) {
+            cycles_max = cycles;
+        }
+    }
+#ifndef ROUNDROBIN_LINEAR_SCAN
+    printf("SCHED\tBitmap priority search: ");
+#else
+    printf("SCHED\tLinear scan priority search: ");
+#endif
+    printf("min %u, avg %u, max %u cycles over %u runs (%u priority levels)\n\r", cycles_min,
+            (uint32_t)(cycles_total / SCHEDULER_BENCH_RUNS), cycles_max, SCHEDULER_BENCH_RUNS, PRIORITY_LEVELS);
+}
+
+void task_scheduler_bench(void const * const args) {
+    /* Only exists to be found by the scheduler - sleep forever */
+    while (1) {
+        OS_sleep(1000);
+    }
+}
+
+
+/*****************************************************************************
+    Test Tasks for round-robin time slicing. Two CPU-bound tasks of equal
+     priority measure how many ticks each of their time slices lasted, which
+     should be about TIME_SLICE_TEST_TICKS (longer if preempted by the other
+     tests, and 1 tick per slice without time slices).
+    Requires from OS specific headers:
+        #include "roundRobin.h"
+        #include "mutex.h" (for printf)
+******************************************************************************/
+static void time_slice_measure(uint32_t task_number) {
+    uint32_t now = OS_elapsedTicks(), slice_start = now, last_seen = now;
+    uint32_t slices = 0, ticks_total = 0, first_slice = 1;
+    while (1) {
+        now = OS_elapsedTicks();
+        /* The other task has run since the last check, so the previous slice of this
+            task ended at the last tick it was seen running, and a new one has started */
+        if (_time_slice_last_task != task_number) {
+            /* Claim the new slice before anything that could take long, ie printf */
+            _time_slice_last_task = task_number;
+            if (!first_slice) {
+                ticks_total += last_seen - slice_start + 1;
+                if (++slices == TIME_SLICE_TEST_SLICES) {
+                    OS_mutexAcquire(&_mutex_printf);
+                    printf("SLICE\tTask %u  : avg %u ticks over %u slices (slice length %u), %u PendSVs avoided\n\r",
+                            task_number, ticks_total / slices, slices, TIME_SLICE_TEST_TICKS, OS_pendSVAvoidedCount());
+                    OS_mutexRelease(&_mutex_printf);
+                    slices = ticks_total = 0;
+                }
+            }
+            first_slice = 0;
+            /* Not now, which may have been read before this task was switched out */
+            now = slice_start = OS_elapsedTicks();
+        }
+        last_seen = now;
+    }
+}
+
+void task_time_slice_1(void const * const args) {
+    time_slice_measure((uint32_t)args);
+}
+
+void task_time_slice_2(void const * const args) {
+    time_slice_measure((uint32_t)args);
+}
+
+
+/*****************************************************************************
+    Test Task reporting how many of the waits for resources by the other tests
+     were aborted, as the resource was released in between the task finding it
+     unavailable and starting to wait. The waiting task then has to try again.
+    Requires from OS specific headers:
+        #include "mutex.h" (for printf)
+******************************************************************************/
+void task_wait_aborts(void const * const args) {
+    uint32_t waits, aborted;
+    while (1) {
+        OS_sleep(1000);
+        waits = OS_waitCount();
+        aborted = OS_waitAbortedCount();
+        OS_mutexAcquire(&_mutex_printf);
+        printf("WAIT\t%u waits, %u aborted (%u%%)\n\r", waits, aborted, waits ? (aborted * 100) / waits : 0);
+        OS_mutexRelease(&_mutex_printf);
+    }
+}
+
+
+/*****************************************************************************
+    Test Tasks for priority inheritance, measuring the worst-case time a high
+     priority task is blocked by a low priority task holding a lock for
+     PI_TEST_HOLD_TICKS, while a medium priority task runs for
+     PI_TEST_MEDIUM_TICKS in between.
+    Each cycle, the low priority task takes the lock, the medium priority task
+     is started, and the high priority task tries to take the lock. With the
+     mutex, the low priority task inherits the high priority and finishes
+     first, so the blocking time is bounded by PI_TEST_HOLD_TICKS. With the
+     binary semaphore (no owner to inherit the priority), the medium priority
+     task runs first and adds PI_TEST_MEDIUM_TICKS.
+    Busy times are counted in ticks the task was seen running, not including
+     the ticks it was preempted for.
+    Requires from OS specific headers:
+        #include "mutex.h"
+        #include "semaphore.h"
+******************************************************************************/
+static void priority_inheritance_busy(uint32_t ticks) {
+    uint32_t last = OS_elapsedTicks(), now;
+    while (ticks) {
+        now = OS_elapsedTicks();
+        if (now != last) {
+            last = now;
+            ticks--;
+        }
+    }
+}
+
+void task_priority_inheritance_low(void const * const args) {
+    while (1) {
+        OS_semaphoreTake(&_pi_start_low);
+        if (_pi_use_mutex) {
+            OS_mutexAcquire(&_pi_mutex);
+        } else {
+            OS_semaphoreTake(&_pi_semaphore);
+        }
+        OS_semaphoreGive(&_pi_locked_low);
+        priority_inheritance_busy(PI_TEST_HOLD_TICKS);
+        if (_pi_use_mutex) {
+            OS_mutexRelease(&_pi_mutex);
+        } else {
+            OS_semaphoreGive(&_pi_semaphore);
+        }
+    }
+}
+
+void task_priority_inheritance_medium(void const * const args) {
+    while (1) {
+        OS_semaphoreTake(&_pi_start_medium);
+        priority_inheritance_busy(PI_TEST_MEDIUM_TICKS);
+        OS_semaphoreGive(&_pi_done_medium);
+    }
+}
+
+void task_priority_inheritance_high(void const * const args) {
+    uint32_t start, blocked, blocked_max[2] = {0};
+    while (1) {
+        for (uint32_t cycle = 0; cycle < PI_TEST_CYCLES; cycle++) {
+            _pi_use_mutex = cycle & 1;
+            /* Let the low priority task take the lock, then start the medium
+                priority task, which can only run once this task blocks */
+            OS_semaphoreGive(&_pi_start_low);
+            OS_semaphoreTake(&_pi_locked_low);
+            OS_semaphoreGive(&_pi_start_medium);
+
+            start = OS_elapsedTicks();
+            if (_pi_use_mutex) {
+                OS_mutexAcquire(&_pi_mutex);
+            } else {
+                OS_semaphoreTake(&_pi_semaphore);
+            }
+            blocked = OS_elapsedTicks() - start;
+            if (_pi_use_mutex) {
+                OS_mutexRelease(&_pi_mutex);
+            } else {
+                OS_semaphoreGive(&_pi_semaphore);
+            }
+            if (blocked > blocked_max[_pi_use_mutex]) {
+                blocked_max[_pi_use_mutex] = blocked;
+            }
+            /* Wait for the medium priority task to finish before the next cycle */
+            OS_semaphoreTake(&_pi_done_medium);
+        }
+        OS_mutexAcquire(&_mutex_printf);
+        printf("PRIO	Worst-case blocking: %u ticks with inheritance (mutex), %u ticks without (semaphore), lock held for %u ticks\n\r",
+                blocked_max[1], blocked_max[0], PI_TEST_HOLD_TICKS);
+        OS_mutexRelease(&_mutex_printf);
+    }
+}
+
+
 /*****************************************************************************
     Test Tasks for Semaphores and Wait mechanism. 
     Requires from OS specific headers:
@@ -373,6 +1017,327 @@ void task_queue_3(void const * const args) {
 	} 
 }
 
+/*****************************************************************************
+    Test Tasks for batched queue operations. The producer sends a running count
+     in batches of QUEUE_BATCH_TEST_SEND items, enqueueing the rest again when
+     only part of a batch fits. The consumer receives up to
+     QUEUE_BATCH_TEST_RECEIVE items at a time, and checks that the count is
+     received in order.
+    Requires from OS specific headers:
+        #include "queue.h"
+        #include "mutex.h" (for printf)
+******************************************************************************/
+void task_queue_batch_producer(void const * const args) {
+    uint8_t batch[QUEUE_BATCH_TEST_SEND];
+    uint8_t count = 0;
+    uint32_t sent;
+    while (1) {
+        for (uint_fast8_t i = 0; i < QUEUE_BATCH_TEST_SEND; i++) {
+            batch[i] = count++;
+        }
+        for (sent = 0; sent < QUEUE_BATCH_TEST_SEND; ) {
+            sent += OS_queueEnqueueN(&_queue_batch_test, &batch[sent], QUEUE_BATCH_TEST_SEND - sent);
+        }
+        OS_sleep(10);
+    }
+}
+
+void task_queue_batch_consumer(void const * const args) {
+    uint8_t batch[QUEUE_BATCH_TEST_RECEIVE];
+    uint8_t expected = 0;
+    uint32_t received = 0, batches = 0, errors = 0, count;
+    while (1) {
+        count = OS_queueDequeueN(&_queue_batch_test, batch, QUEUE_BATCH_TEST_RECEIVE);
+        for (uint32_t i = 0; i < count; i++) {
+            if (batch[i] != expected) {
+                errors++;
+            }
+            expected = batch[i] + 1;
+        }
+        batches++;
+        received += count;
+        if (received % QUEUE_BATCH_TEST_PRINT < count) {
+            OS_mutexAcquire(&_mutex_printf);
+            printf("QUEUE_N\t%u items received in %u batches, %u out of order\r\n", received, batches, errors);
+            OS_mutexRelease(&_mutex_printf);
+        }
+    }
+}
+
+/*****************************************************************************
+    Test Tasks for zero-copy queue operations. The producer builds numbered
+     items in the slots it reserves, and the consumer reads them where they
+     are, checking that the slot is in the queue storage and that the items
+     are received in order and intact.
+    Requires from OS specific headers:
+        #include "queue.h"
+        #include "mutex.h" (for printf)
+******************************************************************************/
+void task_queue_zero_copy_producer(void const * const args) {
+    QueueZeroCopyTestItem_t * item;
+    uint32_t sequence = 0;
+    while (1) {
+        for (uint_fast8_t i = 0; i < QUEUE_ZERO_COPY_TEST_SIZE; i++) {
+            item = OS_queueReserve(&_queue_zero_copy_test);
+            item->sequence = sequence;
+            for (uint_fast8_t j = 0; j < QUEUE_ZERO_COPY_TEST_BYTES; j++) {
+                item->payload[j] = (uint8_t)(sequence + j);
+            }
+            OS_queueCommit(&_queue_zero_copy_test);
+            sequence++;
+        }
+        OS_sleep(10);
+    }
+}
+
+void task_queue_zero_copy_consumer(void const * const args) {
+    QueueZeroCopyTestItem_t const * item;
+    uint32_t expected = 0, received = 0, errors = 0;
+    while (1) {
+        item = OS_queuePeek(&_queue_zero_copy_test);
+        if (item < &_queue_zero_copy_store[0] || item >= &_queue_zero_copy_store[QUEUE_ZERO_COPY_TEST_SIZE] ||
+                item->sequence != expected) {
+            errors++;
+        } else {
+            for (uint_fast8_t j = 0; j < QUEUE_ZERO_COPY_TEST_BYTES; j++) {
+                if (item->payload[j] != (uint8_t)(expected + j)) {
+                    errors++;
+                    break;
+                }
+            }
+        }
+        expected = item->sequence + 1;
+        OS_queueRelease(&_queue_zero_copy_test);
+        if (++received % QUEUE_ZERO_COPY_TEST_PRINT == 0) {
+            OS_mutexAcquire(&_mutex_printf);
+            printf("QUEUE_ZC\t%u items received in place, %u errors\r\n", received, errors);
+            OS_mutexRelease(&_mutex_printf);
+        }
+    }
+}
+
+/*****************************************************************************
+    Test Tasks for enqueueing from an interrupt handler. The producer task
+     triggers the interrupt enough times in a row to fill the queue, and once
+     while it is itself enqueueing (which the interrupt must fail with
+     OS_ERR_BUSY). The consumer task waits for the items, so is woken by the
+     deferred notifications of the interrupt, and checks that the count is
+     received in order. It sleeps now and then, so the queue fills up.
+    On the POSIX port the interrupt is only taken on the next exception, so
+     the producer yields after triggering it.
+    Requires from OS specific headers:
+        #include "queue.h"
+        #include "mutex.h" (for printf)
+******************************************************************************/
+void EXTI0_IRQHandler(void) {
+    switch (OS_queueEnqueueFromISR(&_queue_isr_test, (void *)&_queue_isr_next)) {
+        case OS_OK:
+            _queue_isr_next++;
+            break;
+        case OS_ERR_FULL:
+            _queue_isr_full++;
+            break;
+        default:
+            _queue_isr_busy++;
+            break;
+    }
+}
+
+void task_queue_isr_producer(void const * const args) {
+    uint32_t * slot;
+    while (1) {
+        for (uint_fast8_t i = 0; i < QUEUE_ISR_TEST_SIZE + 2; i++) {
+            NVIC->STIR = EXTI0_IRQn;
+            OS_yield();
+        }
+        slot = OS_queueReserve(&_queue_isr_test);
+        NVIC->STIR = EXTI0_IRQn;
+        OS_yield();
+        *slot = QUEUE_ISR_TEST_TASK_ITEM;
+        OS_queueCommit(&_queue_isr_test);
+        OS_sleep(2);
+    }
+}
+
+void task_queue_isr_consumer(void const * const args) {
+    uint32_t item, expected = 0, received = 0, errors = 0;
+    while (1) {
+        OS_queueDequeue(&_queue_isr_test, &item);
+        if (item == QUEUE_ISR_TEST_TASK_ITEM) {
+            continue;
+        }
+        if (item != expected) {
+            errors++;
+        }
+        expected = item + 1;
+        if (++received % QUEUE_ISR_TEST_PRINT == 0) {
+            OS_mutexAcquire(&_mutex_printf);
+            printf("QUEUE_ISR\t%u items received from the interrupt, %u out of order, %u full, %u busy\r\n",
+                    received, errors, _queue_isr_full, _queue_isr_busy);
+            OS_mutexRelease(&_mutex_printf);
+        }
+        if (received % QUEUE_ISR_TEST_SIZE == 0) {
+            OS_sleep(3);
+        }
+    }
+}
+
+/*****************************************************************************
+    Test Tasks for the Timeout variants of the blocking functions. Every cycle
+     the waiter checks that waits for unavailable resources time out after at
+     least TIMEOUT_TEST_TICKS, that waits which are notified in time succeed,
+     and that a timeout of 0 does not wait at all.
+    The holder checks that it no longer has the waiter's priority once the
+     waiter has stopped waiting for the mutex it holds. It also waits for a
+     semaphore with a timeout while holding the mutex, inheriting the waiter's
+     priority during the wait, which must still time out.
+    Requires from OS specific headers:
+        #include "mutex.h"
+        #include "semaphore.h"
+        #include "queue.h"
+        #include "mempool.h"
+******************************************************************************/
+static void timeout_expect(OS_Status_t status, OS_Status_t expected, uint32_t start, uint32_t min_ticks, uint32_t max_ticks) {
+    uint32_t elapsed = OS_elapsedTicks() - start;
+    if (status != expected || elapsed < min_ticks || elapsed > max_ticks) {
+        _timeout_errors++;
+    }
+}
+
+void task_timeout_waiter(void const * const args) {
+    uint32_t start, item = 0, cycles = 0;
+    void * block, * other_block;
+    while (1) {
+        /* The mutex is held for twice the timeout */
+        OS_semaphoreGive(&_timeout_start);
+        OS_sleep(1);
+        start = OS_elapsedTicks();
+        timeout_expect(OS_mutexAcquireTimeout(&_timeout_mutex, TIMEOUT_TEST_TICKS), OS_ERR_TIMEOUT, start, TIMEOUT_TEST_TICKS, UINT32_MAX);
+        OS_sleep(TIMEOUT_TEST_TICKS * 2);
+        start = OS_elapsedTicks();
+        timeout_expect(OS_mutexAcquireTimeout(&_timeout_mutex, TIMEOUT_TEST_TICKS), OS_OK, start, 0, TIMEOUT_TEST_TICKS - 1);
+        OS_mutexRelease(&_timeout_mutex);
+
+        /* The semaphore is given half way through the first wait only */
+        start = OS_elapsedTicks();
+        timeout_expect(OS_semaphoreTakeTimeout(&_timeout_semaphore, TIMEOUT_TEST_TICKS), OS_OK, start, 0, TIMEOUT_TEST_TICKS - 1);
+        start = OS_elapsedTicks();
+        timeout_expect(OS_semaphoreTakeTimeout(&_timeout_semaphore, TIMEOUT_TEST_TICKS), OS_ERR_TIMEOUT, start, TIMEOUT_TEST_TICKS, UINT32_MAX);
+        start = OS_elapsedTicks();
+        timeout_expect(OS_semaphoreTakeTimeout(&_timeout_semaphore, 0), OS_ERR_TIMEOUT, start, 0, 0);
+
+        /* The queue holds a single item, and the pool a single block */
+        start = OS_elapsedTicks();
+        timeout_expect(OS_queueDequeueTimeout(&_timeout_queue, &item, TIMEOUT_TEST_TICKS), OS_ERR_TIMEOUT, start, TIMEOUT_TEST_TICKS, UINT32_MAX);
+        timeout_expect(OS_queueEnqueueTimeout(&_timeout_queue, &cycles, TIMEOUT_TEST_TICKS), OS_OK, start, 0, UINT32_MAX);
+        start = OS_elapsedTicks();
+        timeout_expect(OS_queueEnqueueTimeout(&_timeout_queue, &cycles, TIMEOUT_TEST_TICKS), OS_ERR_TIMEOUT, start, TIMEOUT_TEST_TICKS, UINT32_MAX);
+        timeout_expect(OS_queueDequeueTimeout(&_timeout_queue, &item, TIMEOUT_TEST_TICKS), OS_OK, start, 0, UINT32_MAX);
+        if (item != cycles) {
+            _timeout_errors++;
+        }
+        timeout_expect(OS_memPoolAllocateTimeout(&_timeout_pool, &block, TIMEOUT_TEST_TICKS), OS_OK, start, 0, UINT32_MAX);
+        start = OS_elapsedTicks();
+        timeout_expect(OS_memPoolAllocateTimeout(&_timeout_pool, &other_block, TIMEOUT_TEST_TICKS), OS_ERR_TIMEOUT, start, TIMEOUT_TEST_TICKS, UINT32_MAX);
+        OS_memPoolDeallocate(&_timeout_pool, block);
+
+        /* The holder waits for the semaphore with the mutex held, and releases
+            the mutex once its wait has timed out */
+        OS_semaphoreGive(&_timeout_start);
+        OS_sleep(1);
+        start = OS_elapsedTicks();
+        timeout_expect(OS_mutexAcquireTimeout(&_timeout_mutex, TIMEOUT_TEST_TICKS * 2), OS_OK, start, 0, TIMEOUT_TEST_TICKS * 2 - 1);
+        OS_mutexRelease(&_timeout_mutex);
+
+        OS_mutexAcquire(&_mutex_printf);
+        printf("TIMEOUT\t%u cycles, %u errors, Tick %x\r\n", ++cycles, _timeout_errors, OS_elapsedTicks());
+        OS_mutexRelease(&_mutex_printf);
+    }
+}
+
+void task_timeout_holder(void const * const args) {
+    uint32_t start;
+    while (1) {
+        OS_semaphoreTake(&_timeout_start);
+        OS_mutexAcquire(&_timeout_mutex);
+        OS_sleep(TIMEOUT_TEST_TICKS * 2);
+        if (OS_currentTCB()->priority != TIMEOUT_TEST_HOLDER_PRIORITY) {
+            _timeout_errors++;
+        }
+        OS_mutexRelease(&_timeout_mutex);
+        OS_sleep(TIMEOUT_TEST_TICKS * 3 / 2);
+        OS_semaphoreGive(&_timeout_semaphore);
+
+        OS_semaphoreTake(&_timeout_start);
+        OS_mutexAcquire(&_timeout_mutex);
+        start = OS_elapsedTicks();
+        timeout_expect(OS_semaphoreTakeTimeout(&_timeout_never, TIMEOUT_TEST_TICKS), OS_ERR_TIMEOUT, start, TIMEOUT_TEST_TICKS, UINT32_MAX);
+        OS_mutexRelease(&_timeout_mutex);
+        if (OS_currentTCB()->priority != TIMEOUT_TEST_HOLDER_PRIORITY) {
+            _timeout_errors++;
+        }
+    }
+}
+
+/*****************************************************************************
+    Test Tasks allocating and deallocating memory pool blocks concurrently.
+     Each task marks the blocks it holds with its number and checks them after
+     yielding, so a block handed out twice by the lock-free free block stack
+     is counted as an error.
+    Requires from OS specific headers:
+        #include "mempool.h"
+        #include "mutex.h" (for printf)
+******************************************************************************/
+#ifdef MEMPOOL_STATS
+/* With MEMPOOL_STATS, the pool must have been exhausted, with tasks waiting,
+    but never have had more blocks in use than it has */
+static void mempool_stress_checkStats(void) {
+    static OS_MemPoolSnapshot_t snapshots[MEMPOOL_STRESS_SNAPSHOTS];
+    uint32_t count = OS_memPoolStatsSnapshot(snapshots, MEMPOOL_STRESS_SNAPSHOTS);
+    for (uint32_t i = 0; i < count; i++) {
+        if (snapshots[i].pool == &_mempool_stress) {
+            OS_MemPoolStats_t * stats = &snapshots[i].stats;
+            if (stats->blocks != MEMPOOL_STRESS_BLOCKS || stats->peak_in_use != MEMPOOL_STRESS_BLOCKS ||
+                    stats->in_use > MEMPOOL_STRESS_BLOCKS || stats->blocked_allocations == 0) {
+                _mempool_stress_errors++;
+            }
+            OS_mutexAcquire(&_mutex_printf);
+            printf("MEMSTRESS\t%u pools, in use %u, peak %u, %u allocations, %u blocked for %u ticks\r\n",
+                    count, stats->in_use, stats->peak_in_use, stats->allocations, stats->blocked_allocations, stats->wait_ticks);
+            OS_mutexRelease(&_mutex_printf);
+            return;
+        }
+    }
+    _mempool_stress_errors++;
+}
+#endif
+
+void task_mempool_stress(void const * const args) {
+    uint32_t task = (uint32_t)args;
+    uint32_t * blocks[MEMPOOL_STRESS_HELD];
+    while (1) {
+        for (uint_fast8_t i = 0; i < MEMPOOL_STRESS_HELD; i++) {
+            blocks[i] = OS_memPoolAllocate(&_mempool_stress);
+            blocks[i][0] = blocks[i][1] = task;
+        }
+        OS_yield();
+        for (uint_fast8_t i = 0; i < MEMPOOL_STRESS_HELD; i++) {
+            if (blocks[i][0] != task || blocks[i][1] != task) {
+                _mempool_stress_errors++;
+            }
+            OS_memPoolDeallocate(&_mempool_stress, blocks[i]);
+        }
+        if (++_mempool_stress_cycles % MEMPOOL_STRESS_PRINT == 0) {
+            OS_mutexAcquire(&_mutex_printf);
+            printf("MEMSTRESS\t%u cycles, %u errors\r\n", _mempool_stress_cycles, _mempool_stress_errors);
+            OS_mutexRelease(&_mutex_printf);
+#ifdef MEMPOOL_STATS
+            mempool_stress_checkStats();
+#endif
+        }
+    }
+}
+
 /*****************************************************************************
     Test Tasks for Semaphores and Wait mechanism. 
     Requires from OS specific headers:
@@ -607,3 +1572,216 @@ void myOverflowTest(void) {
     
     while (1);
 }
+
+
+/*****************************************************************************
+    Test Tasks for the size class allocator. The producer allocates blocks of
+     sizes up to the largest class, fills them with their size and passes them
+     to the consumer, which checks and frees them, so every class is
+     exhausted and freed to by another task.
+    Requires from OS specific headers:
+        #include "memAlloc.h"
+        #include "queue.h"
+        #include "mutex.h" (for printf)
+******************************************************************************/
+void task_mem_alloc_producer(void const * const args) {
+    MemAllocTestItem_t item;
+    uint32_t size = 0;
+    while (1) {
+        /* Step through the sizes unevenly to hit every class, and both ends of it */
+        size = (size + 37) % (1UL << MEM_ALLOC_MAX_SHIFT) + 1;
+        item.size = size;
+        item.block = OS_memAlloc(size);
+        if (item.block == 0 || ((uint32_t)item.block & 7) != 0) {
+            _mem_alloc_errors++;
+            continue;
+        }
+        memset(item.block, (uint8_t)size, size);
+        OS_queueEnqueue(&_mem_alloc_queue, &item);
+
+        /* Sizes that fit no class can not be allocated */
+        if (OS_memAlloc((1UL << MEM_ALLOC_MAX_SHIFT) + 1) != 0) {
+            _mem_alloc_errors++;
+        }
+    }
+}
+
+void task_mem_alloc_consumer(void const * const args) {
+    MemAllocTestItem_t item;
+    while (1) {
+        OS_queueDequeue(&_mem_alloc_queue, &item);
+        for (uint32_t i = 0; i < item.size; i++) {
+            if (item.block[i] != (uint8_t)item.size) {
+                _mem_alloc_errors++;
+                break;
+            }
+        }
+        OS_memFree(item.block);
+        if (++_mem_alloc_cycles % MEM_ALLOC_TEST_PRINT == 0) {
+            OS_mutexAcquire(&_mutex_printf);
+            printf("MEMALLOC\t%u cycles, %u errors\r\n", _mem_alloc_cycles, _mem_alloc_errors);
+            OS_mutexRelease(&_mutex_printf);
+        }
+    }
+}
+
+
+/*****************************************************************************
+    Test Tasks checking the awakening time of sleeping tasks. A task sleeping
+     for N ticks must be awoken once the ticks are after the time it started
+     plus N, ie after N + 1 ticks if it started at the start of a tick. Earlier
+     awakenings are errors, and later ones are recorded, which should never be
+     later than a tick when the test is run alone.
+    Requires from OS specific headers:
+        #include "sleep.h"
+        #include "mutex.h" (for printf)
+******************************************************************************/
+void task_sleep_accuracy(void const * const args) {
+    uint32_t task = (uint32_t)args, cycle = 0, duration, start, late;
+    while (1) {
+        duration = _sleep_accuracy_durations[(task * 2 + cycle++) % SLEEP_ACCURACY_DURATIONS];
+        start = OS_elapsedTicks();
+        OS_sleep(duration);
+        late = OS_elapsedTicks() - start;
+        if (late < duration + 1) {
+            _sleep_accuracy_errors++;
+        } else if (late - (duration + 1) > _sleep_accuracy_max_late) {
+            _sleep_accuracy_max_late = late - (duration + 1);
+        }
+        if (++_sleep_accuracy_cycles % SLEEP_ACCURACY_PRINT == 0) {
+            OS_mutexAcquire(&_mutex_printf);
+            printf("SLEEPACC\t%u cycles, %u errors, %u ticks late at most, Tick %x\r\n",
+                    _sleep_accuracy_cycles, _sleep_accuracy_errors, _sleep_accuracy_max_late, OS_elapsedTicks());
+            OS_mutexRelease(&_mutex_printf);
+        }
+    }
+}
+
+
+/*****************************************************************************
+    Test Task checking periodic sleeps with OS_sleepUntil. The task works for
+     a varying number of ticks every period, and must still be awoken once the
+     ticks are after its awakening time, which must stay a whole number of
+     periods after the first. Working for longer than a period must be
+     reported as the number of periods missed, and not otherwise.
+    The awakening should never be later than a tick when the test is run alone.
+    Requires from OS specific headers:
+        #include "sleep.h"
+        #include "mutex.h" (for printf)
+******************************************************************************/
+void task_sleep_until(void const * const args) {
+    uint32_t first_wake = OS_elapsedTicks(), last_wake = first_wake, previous_wake;
+    uint32_t cycle = 0, work, start, overruns, late;
+    while (1) {
+        /* Work for a varying number of ticks, sometimes for over two periods */
+        work = (++cycle % SLEEP_UNTIL_OVERRUN_EVERY == 0) ? SLEEP_UNTIL_OVERRUN_WORK : cycle % 5;
+        start = OS_elapsedTicks();
+        while (OS_elapsedTicks() - start < work) {}
+
+        previous_wake = last_wake;
+        overruns = OS_sleepUntil(&last_wake, SLEEP_UNTIL_PERIOD);
+        late = OS_elapsedTicks() - last_wake;
+        if (late < 1 || (last_wake - first_wake) % SLEEP_UNTIL_PERIOD != 0 ||
+                last_wake - previous_wake != (overruns + 1) * SLEEP_UNTIL_PERIOD ||
+                (overruns != 0) != (work >= SLEEP_UNTIL_PERIOD)) {
+            _sleep_until_errors++;
+        } else if (late - 1 > _sleep_until_max_late) {
+            _sleep_until_max_late = late - 1;
+        }
+        _sleep_until_overruns += overruns;
+        if (++_sleep_until_cycles % SLEEP_UNTIL_PRINT == 0) {
+            OS_mutexAcquire(&_mutex_printf);
+            printf("SLEEPUNTIL\t%u cycles, %u overruns, %u errors, %u ticks late at most, Tick %x\r\n",
+                    _sleep_until_cycles, _sleep_until_overruns, _sleep_until_errors, _sleep_until_max_late, OS_elapsedTicks());
+            OS_mutexRelease(&_mutex_printf);
+        }
+    }
+}
+
+
+/*****************************************************************************
+    Test Task checking that no ticks are lost while the ticks are suppressed
+     in tickless idle mode. The task sleeps for durations below and above the
+     longest period the SysTick can be programmed for, so that only the idle
+     task runs in between, and compares the ticks elapsed against the DWT
+     cycle counter, which runs freely. The difference must stay within a tick
+     when the test is run alone, as any lost cycles accumulate.
+    Requires from OS specific headers:
+        #include "sleep.h"
+        #include "stm32f4xx.h"
+        #include "mutex.h" (for printf)
+******************************************************************************/
+void task_tickless(void const * const args) {
+    uint32_t cycle = 0, cycles_per_tick = SystemCoreClock / 1000;
+    uint32_t start_ticks, last_cycles, now_cycles;
+    uint64_t reference_cycles = 0;
+    int32_t drift;
+
+    /* Enable the DWT cycle counter, which needs OS_PRIVILEGED_TASKS */
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    last_cycles = DWT->CYCCNT;
+    start_ticks = OS_elapsedTicks();
+    while (1) {
+        OS_sleep(_tickless_durations[cycle++ % TICKLESS_DURATIONS]);
+        /* Accumulated a sleep at a time, as the counter wraps every 25 s at 168 MHz */
+        now_cycles = DWT->CYCCNT;
+        reference_cycles += now_cycles - last_cycles;
+        last_cycles = now_cycles;
+        drift = (int32_t)(reference_cycles / cycles_per_tick) - (int32_t)(OS_elapsedTicks() - start_ticks);
+        if (drift > 1 || drift < -1) {
+            _tickless_errors++;
+        }
+        if (++_tickless_cycles % TICKLESS_PRINT == 0) {
+            OS_mutexAcquire(&_mutex_printf);
+            printf("TICKLESS\t%u cycles, %u errors, %d ticks behind the DWT, Tick %x\r\n",
+                    _tickless_cycles, _tickless_errors, drift, OS_elapsedTicks());
+            OS_mutexRelease(&_mutex_printf);
+        }
+    }
+}
+
+
+/*****************************************************************************
+    Test Tasks for the EDF scheduler. Each periodic task works for a number of
+     the ticks it runs in every period, and its job must finish by the deadline
+     it was released with, which is the end of the period. The report runs only
+     when neither periodic task is runnable.
+    Requires from OS specific headers:
+        #include "edf.h"
+        #include "mutex.h" (for printf)
+******************************************************************************/
+void task_edf_periodic(void const * const args) {
+    uint32_t task = (uint32_t)args, worked, last, now;
+    while (1) {
+        /* Count the ticks in which the task ran, which is its execution time
+            as the EDF scheduler only preempts on ticks */
+        worked = 0;
+        last = OS_elapsedTicks();
+        while (worked < _edf_test_tasks[task].work) {
+            now = OS_elapsedTicks();
+            if (now != last) {
+                worked++;
+                last = now;
+            }
+        }
+        /* The job has finished in the tick before now, which must not be after its deadline */
+        if ((int32_t)(OS_elapsedTicks() - OS_currentTCB()->deadline) > 0) {
+            _edf_missed[task]++;
+        }
+        _edf_jobs[task]++;
+        OS_edfWaitNextPeriod();
+    }
+}
+
+void task_edf_report(void const * const args) {
+    while (1) {
+        OS_sleep(EDF_TEST_REPORT);
+        OS_mutexAcquire(&_mutex_printf);
+        for (uint32_t i = 0; i < EDF_TEST_TASKS; i++) {
+            printf("EDF\tTask %u (%u/%u ticks): %u jobs, %u deadlines missed, Tick %x\r\n", i,
+                    _edf_test_tasks[i].work, _edf_test_tasks[i].period, _edf_jobs[i], _edf_missed[i], OS_elapsedTicks());
+        }
+        OS_mutexRelease(&_mutex_printf);
+    }
+}
@@ -0,0 +1,487 @@
+#define _GNU_SOURCE
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include "stm32f4xx.h"
+#include "os.h"
+#include "os_internal.h"
+#include "roundRobin.h"
+#include "sleep.h"
+#include "utils/serial.h"
+
+/*=============================================================================
+ *  Hosted POSIX port of DocetOS, replacing OS/os_asm.s, the CMSIS device
+ *   support and utils/ so that the OS can run as an ordinary (single threaded)
+ *   Linux process, and be measured with host tools such as perf.
+ *  The Cortex-M4 is emulated as follows:
+ *       Thread mode   Each task runs on its own host stack (PORT_TASK_STACK_SIZE)
+ *                      using ucontext, started from the pc, r0 and lr the OS
+ *                      placed in its initial stack frame. The stack given to
+ *                      OS_initialiseTCB only holds that frame. The idle task
+ *                      runs on the stack of main().
+ *       Handler mode  SIGALRM (the SysTick) is blocked. SVC delegates call
+ *                      the _svc_* handlers directly through a table matching
+ *                      os_asm.s, with the arguments in an _OS_SVC_StackFrame_t.
+ *       SysTick       A SIGALRM interval timer, started by SysTick_Config().
+ *       PendSV        Run on return from every emulated exception while
+ *                      SCB->ICSR has PENDSVSET set, switching tasks with
+ *                      swapcontext (from the signal handler for the SysTick).
+ *       IRQs          External interrupts triggered through NVIC->STIR are
+ *                      taken on entry to the next SVC or SysTick, before its
+ *                      handler, from the table of handlers below.
+ *  The OS stores pointers in 32-bit words (ie the SVC stack frame), so the port
+ *   must be linked at low addresses (-no-pie, see the Makefile), and all
+ *   objects handed to the OS must be static or on a task's (heap) stack.
+ *  Compile with -DPORT_RUN_TICKS=n to exit after n ticks, ie for profiling.
+=============================================================================*/
+
+/*=============================================================================
+**       Definitions
+=============================================================================*/
+/* Size of the host stack of each task, kept below the malloc mmap threshold
+    so the stacks are allocated from the (low) heap */
+#define PORT_TASK_STACK_SIZE (64 * 1024)
+
+/* Value of the emulated NVIC->STIR while no interrupt is triggered */
+#define PORT_STIR_NONE 0xFFFFFFFFUL
+
+/* Number of ticks to run for before exiting, or 0 to run forever */
+#ifndef PORT_RUN_TICKS
+# define PORT_RUN_TICKS 0
+#endif
+
+/*=============================================================================
+**       Type Definitions
+=============================================================================*/
+/* The host context of a task, associated with its TCB */
+typedef struct {
+    OS_TCB_t const * tcb;
+    ucontext_t context;
+    void * stack;
+    /* The task function, argument and return address, from the initial stack frame */
+    void (* func)(void const * const);
+    void const * data;
+    void (* end)(void);
+} Port_Context_t;
+
+/* An SVC handler. Handlers without arguments ignore the stack frame, as when
+    dispatched from os_asm.s. */
+typedef void (* Port_SvcHandler_t)(_OS_SVC_StackFrame_t const * const);
+
+/*=============================================================================
+**       SVC Handler Declarations (os.c)
+=============================================================================*/
+void _svc_OS_enableSystick(void);
+void _svc_OS_schedule(void);
+void _svc_OS_taskAdd(_OS_SVC_StackFrame_t const * const stack);
+void _svc_OS_taskExit(void);
+void _svc_OS_taskYield(void);
+void _svc_OS_sleep(_OS_SVC_StackFrame_t const * const stack);
+void _svc_OS_sleepUntil(_OS_SVC_StackFrame_t const * const stack);
+void _svc_OS_taskWait(_OS_SVC_StackFrame_t const * const stack);
+void _svc_OS_taskNotify(_OS_SVC_StackFrame_t const * const stack);
+void _svc_OS_mutexHandOff(_OS_SVC_StackFrame_t const * const stack);
+void _svc_OS_mutexWait(_OS_SVC_StackFrame_t const * const stack);
+void _svc_OS_semaphoreWait(_OS_SVC_StackFrame_t const * const stack);
+void SysTick_Handler(void);
+
+/*=============================================================================
+**       External Interrupt Handlers (weak, null if not defined by the application)
+=============================================================================*/
+void EXTI0_IRQHandler(void) __attribute__((weak));
+
+/*=============================================================================
+**       Static Function Prototypes
+=============================================================================*/
+static void port_svc(enum OS_SVC_e svc, uintptr_t r0, uintptr_t r1, uintptr_t r2, uintptr_t r3);
+static void port_exceptionReturn(void);
+static void port_irq(void);
+static void port_switch(OS_TCB_t * next_tcb);
+static Port_Context_t * port_context(OS_TCB_t const * tcb);
+static void port_taskStart(void);
+static void port_sysTickSignal(int signal);
+static void port_sysTick(void);
+static void port_init(void) __attribute__((constructor));
+
+/*=============================================================================
+**       Variables
+=============================================================================*/
+/* Emulated core peripherals, see stm32f4xx.h */
+SCB_Type _port_scb = { 0 };
+SysTick_Type _port_systick = { 0 };
+CoreDebug_Type _port_coredebug = { 0 };
+static DWT_Type _port_dwt = { 0 };
+NVIC_Type _port_nvic = { .ISER = 0, .STIR = PORT_STIR_NONE };
+uint32_t SystemCoreClock = 1000000000UL;
+
+/* The emulated exclusive monitor, holding the address of the last __LDREXW
+    or 0 if cleared, and the flag deferring the SysTick during __STREXW */
+uint32_t volatile * volatile _port_exclusive_address = 0;
+volatile uint32_t _port_exclusive_critical = 0;
+volatile uint32_t _port_tick_deferred = 0;
+
+/* The SVC dispatch table. If this doesn't match enum OS_SVC_e (and os_asm.s),
+    BIG TROUBLE will ensue. */
+static Port_SvcHandler_t const _svc_table[] = {
+    (Port_SvcHandler_t)_svc_OS_enableSystick,
+    (Port_SvcHandler_t)_svc_OS_schedule,
+    _svc_OS_taskAdd,
+    (Port_SvcHandler_t)_svc_OS_taskExit,
+    (Port_SvcHandler_t)_svc_OS_taskYield,
+    _svc_OS_sleep,
+    _svc_OS_sleepUntil,
+    _svc_OS_taskWait,
+    _svc_OS_taskNotify,
+    _svc_OS_mutexHandOff,
+    _svc_OS_mutexWait,
+    _svc_OS_semaphoreWait
+};
+
+/* Handlers of the external interrupts, by IRQ number */
+static void (* const _irq_table[])(void) = {
+    [EXTI0_IRQn] = EXTI0_IRQHandler
+};
+
+/* Host contexts of the idle task (first) and every task that has been added.
+    Contexts of exited tasks have a null tcb, and are reused. */
+static Port_Context_t _contexts[MAX_TASKS + 1];
+static uint32_t _contexts_used = 1;
+
+/* The signal set holding only SIGALRM, blocked in handler mode */
+static sigset_t _sysTick_mask;
+
+
+/*=============================================================================
+**       Startup (replaces os_asm.s)
+=============================================================================*/
+/**
+ * [_task_initialiseSwitch Starts the OS by turning the caller into the idle task,
+ *   enabling the SysTick and yielding to the first task. Never returns.]
+ * @param idleTask [the system idle task]
+ */
+void _task_initialiseSwitch(OS_TCB_t const * const idleTask) {
+    sigset_t no_signals;
+
+    /* The idle context is saved on the first switch away from it */
+    _currentTCB = (OS_TCB_t *)idleTask;
+    port_svc(OS_SVC_ENABLE_SYSTICK, 0, 0, 0, 0);
+    port_svc(OS_SVC_YIELD_TASK, 0, 0, 0, 0);
+
+    /* The idle task waits for the SysTick, like WFI */
+    sigemptyset(&no_signals);
+    while (1) {
+        sigsuspend(&no_signals);
+    }
+}
+
+/* The assembly task switch is replaced by port_switch, and is never called */
+void _task_switch(void) {
+    __builtin_trap();
+}
+
+
+/*=============================================================================
+**       SVC Delegates (os.h, os_internal.h, sleep.h)
+=============================================================================*/
+void OS_addTask(OS_TCB_t const * const tcb) {
+    /* Create the host context in thread mode, so that PendSV never allocates
+        memory from inside an interrupted task */
+    Port_Context_t * context = port_context(tcb);
+    OS_StackFrame_t const * stack_frame = (OS_StackFrame_t const *)tcb->sp;
+    if ((uintptr_t)tcb > UINT32_MAX) {
+        fprintf(stderr, "port: TCBs must be static and the port linked with -no-pie\n");
+        abort();
+    }
+    if (context == 0) {
+        /* Reuse the context of an exited task, or create a new one */
+        context = port_context(0);
+        if (context == 0) {
+            if (_contexts_used == MAX_TASKS + 1) {
+                /* The scheduler would ignore the task too (see roundRobin_addTask) */
+                fprintf(stderr, "port: more than MAX_TASKS tasks added, task ignored\n");
+                return;
+            }
+            context = &_contexts[_contexts_used++];
+            context->stack = malloc(PORT_TASK_STACK_SIZE);
+            if (context->stack == 0 || (uintptr_t)context->stack > UINT32_MAX) {
+                fprintf(stderr, "port: task stacks must be allocated below 4 GiB\n");
+                abort();
+            }
+        }
+        context->tcb = tcb;
+    }
+    /* Start the task from its initial stack frame */
+    context->func = (void (*)(void const * const))(uintptr_t)stack_frame->pc;
+    context->data = (void const *)(uintptr_t)stack_frame->r0;
+    context->end = (void (*)(void))(uintptr_t)stack_frame->lr;
+    getcontext(&context->context);
+    context->context.uc_stack.ss_sp = context->stack;
+    context->context.uc_stack.ss_size = PORT_TASK_STACK_SIZE;
+    context->context.uc_link = 0;
+    context->context.uc_sigmask = _sysTick_mask;
+    makecontext(&context->context, port_taskStart, 0);
+
+    port_svc(OS_SVC_ADD_TASK, (uintptr_t)tcb, 0, 0, 0);
+}
+
+void OS_yield(void) {
+    port_svc(OS_SVC_YIELD_TASK, 0, 0, 0, 0);
+}
+
+void OS_sleep(const uint32_t sleep_in_ms) {
+    port_svc(OS_SVC_SLEEP, sleep_in_ms, 0, 0, 0);
+}
+
+void _OS_wait(void * reason, void * resource_wait_list, const uint32_t fail_fast_sequence) {
+    port_svc(OS_SVC_WAIT, (uintptr_t)reason, (uintptr_t)resource_wait_list, fail_fast_sequence, 0);
+}
+
+void _OS_notify(void * resource_wait_list) {
+    port_svc(OS_SVC_NOTIFY, (uintptr_t)resource_wait_list, 0, 0, 0);
+}
+
+void _OS_mutexHandOff(void * mutex) {
+    port_svc(OS_SVC_MUTEX_HAND_OFF, (uintptr_t)mutex, 0, 0, 0);
+}
+
+void _OS_mutexWait(void * mutex, const uint32_t fail_fast_sequence, const uint32_t timeout) {
+    port_svc(OS_SVC_MUTEX_WAIT, (uintptr_t)mutex, fail_fast_sequence, timeout, 0);
+}
+
+void _OS_semaphoreWait(void * semaphore, const uint32_t fail_fast_sequence, const uint32_t give, const uint32_t timeout) {
+    port_svc(OS_SVC_SEMAPHORE_WAIT, (uintptr_t)semaphore, fail_fast_sequence, give, timeout);
+}
+
+void _OS_taskExit(void) {
+    /* Free the context to be reused. The task is switched away from straight
+        away, and its stack is not used again. */
+    port_context(_currentTCB)->tcb = 0;
+    port_svc(OS_SVC_EXIT_TASK, 0, 0, 0, 0);
+}
+
+void _OS_sleepUntil(const uint32_t wake_time) {
+    port_svc(OS_SVC_SLEEP_UNTIL, wake_time, 0, 0, 0);
+}
+
+
+/*=============================================================================
+**       Exception Emulation
+=============================================================================*/
+/**
+ * [port_svc Emulates an SVC instruction, calling the handler in handler mode
+ *   with the arguments stacked as by the CPU, followed by PendSV if pending.]
+ * @param svc [the SVC number]
+ * @param r0  [first argument]
+ * @param r1  [second argument]
+ * @param r2  [third argument]
+ * @param r3  [fourth argument]
+ */
+static void port_svc(enum OS_SVC_e svc, uintptr_t r0, uintptr_t r1, uintptr_t r2, uintptr_t r3) {
+    /* The OS passes pointers in 32-bit registers, see the top of this file */
+    _OS_SVC_StackFrame_t stack_frame = { .r0 = (uint32_t)r0, .r1 = (uint32_t)r1, .r2 = (uint32_t)r2, .r3 = (uint32_t)r3 };
+    sigset_t thread_mask;
+
+    sigprocmask(SIG_BLOCK, &_sysTick_mask, &thread_mask);
+    _port_exclusive_address = 0;
+    port_irq();
+    _svc_table[svc](&stack_frame);
+    port_exceptionReturn();
+    sigprocmask(SIG_SETMASK, &thread_mask, 0);
+}
+
+/**
+ * [port_irq Takes the external interrupt triggered through NVIC->STIR, if any
+ *   and enabled, as if it was taken before the current exception.]
+ */
+static void port_irq(void) {
+    uint32_t irq = _port_nvic.STIR;
+    if (irq == PORT_STIR_NONE) {
+        return;
+    }
+    _port_nvic.STIR = PORT_STIR_NONE;
+    if (irq < sizeof(_irq_table) / sizeof(_irq_table[0]) && _irq_table[irq] != 0 &&
+            (_port_nvic.ISER & (1UL << irq))) {
+        _port_exclusive_address = 0;
+        _irq_table[irq]();
+    }
+}
+
+/**
+ * [port_exceptionReturn Runs PendSV while it is pending, as tail-chained on
+ *   return from an exception. PendSV is left pending until the OS is started.]
+ */
+static void port_exceptionReturn(void) {
+    while (_currentTCB != 0 && (SCB->ICSR & SCB_ICSR_PENDSVSET_Msk)) {
+        SCB->ICSR &= ~SCB_ICSR_PENDSVSET_Msk;
+        port_switch((OS_TCB_t *)_OS_scheduler());
+    }
+}
+
+/**
+ * [port_switch Switches to the context of the next task (PendSV). Returns once
+ *   the current task is switched back to.]
+ * @param next_tcb [the task to switch to]
+ */
+static void port_switch(OS_TCB_t * next_tcb) {
+    /* The context of an exited task is no longer needed, and is discarded */
+    static ucontext_t exited_context;
+    Port_Context_t * current_context;
+    if (next_tcb == _currentTCB) {
+        return;
+    }
+    current_context = port_context(_currentTCB);
+    _currentTCB = next_tcb;
+    _port_exclusive_address = 0;
+    swapcontext(current_context ? &current_context->context : &exited_context, &port_context(next_tcb)->context);
+}
+
+/**
+ * [port_context Finds the host context of a task.]
+ * @param  tcb [the task to find the context of, or 0 for an unused context]
+ * @return     [pointer to the context, or 0 if not found]
+ */
+static Port_Context_t * port_context(OS_TCB_t const * tcb) {
+    for (uint32_t i = 0; i < _contexts_used; i++) {
+        if (_contexts[i].tcb == tcb) {
+            return &_contexts[i];
+        }
+    }
+    return 0;
+}
+
+/**
+ * [port_taskStart Entry point of every task's host context. Leaves handler
+ *   mode and calls the task function, returning into _OS_taskEnd.]
+ */
+static void port_taskStart(void) {
+    Port_Context_t const * context = port_context(_currentTCB);
+    sigprocmask(SIG_UNBLOCK, &_sysTick_mask, 0);
+    context->func(context->data);
+    context->end();
+}
+
+/**
+ * [port_sysTickSignal SIGALRM handler, taking the SysTick exception unless
+ *   it interrupted an emulated __STREXW, which takes it when done.]
+ * @param signal [SIGALRM]
+ */
+static void port_sysTickSignal(int signal) {
+    (void)signal;
+    if (_port_exclusive_critical) {
+        _port_tick_deferred = 1;
+        return;
+    }
+    port_sysTick();
+}
+
+/**
+ * [port_sysTick Emulates the SysTick exception, with SIGALRM blocked.]
+ */
+static void port_sysTick(void) {
+    _port_exclusive_address = 0;
+    port_irq();
+    SysTick_Handler();
+#if PORT_RUN_TICKS
+    if (OS_elapsedTicks() >= PORT_RUN_TICKS) {
+        _exit(0);
+    }
+#endif
+    port_exceptionReturn();
+}
+
+/**
+ * [port_deferredTick Takes a SysTick deferred by __STREXW.]
+ */
+void port_deferredTick(void) {
+    sigset_t thread_mask;
+    sigprocmask(SIG_BLOCK, &_sysTick_mask, &thread_mask);
+    _port_tick_deferred = 0;
+    port_sysTick();
+    sigprocmask(SIG_SETMASK, &thread_mask, 0);
+}
+
+
+/*=============================================================================
+**       CMSIS Functions
+=============================================================================*/
+void SystemCoreClockUpdate(void) {
+}
+
+/**
+ * [SysTick_Config Starts SIGALRM firing every ticks cycles of SystemCoreClock]
+ * @param  ticks [number of cycles between SysTick exceptions]
+ * @return       [0 on success, 1 otherwise]
+ */
+uint32_t SysTick_Config(uint32_t ticks) {
+    struct sigaction action = { 0 };
+    struct itimerval timer = { 0 };
+    uint64_t period_us = ((uint64_t)ticks * 1000000UL) / SystemCoreClock;
+
+    action.sa_handler = port_sysTickSignal;
+    action.sa_flags = SA_RESTART;
+    action.sa_mask = _sysTick_mask;
+    if (sigaction(SIGALRM, &action, 0) != 0) {
+        return 1;
+    }
+    timer.it_interval.tv_sec = period_us / 1000000UL;
+    timer.it_interval.tv_usec = period_us % 1000000UL;
+    timer.it_value = timer.it_interval;
+    SysTick->LOAD = ticks - 1;
+    SysTick->CTRL = SysTick_CTRL_CLKSOURCE_Msk | SysTick_CTRL_TICKINT_Msk | SysTick_CTRL_ENABLE_Msk;
+    return setitimer(ITIMER_REAL, &timer, 0) != 0;
+}
+
+void NVIC_SetPriority(IRQn_Type IRQn, uint32_t priority) {
+    (void)IRQn;
+    (void)priority;
+}
+
+void NVIC_EnableIRQ(IRQn_Type IRQn) {
+    _port_nvic.ISER |= 1UL << IRQn;
+}
+
+/* Samples the host's monotonic clock into CYCCNT, in ns (SystemCoreClock) */
+DWT_Type * port_dwt(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    _port_dwt.CYCCNT = (uint32_t)((uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec);
+    return &_port_dwt;
+}
+
+uint32_t __get_PRIMASK(void) {
+    sigset_t mask;
+    sigprocmask(SIG_BLOCK, 0, &mask);
+    return sigismember(&mask, SIGALRM);
+}
+
+void __set_PRIMASK(uint32_t primask) {
+    sigprocmask(primask ? SIG_BLOCK : SIG_UNBLOCK, &_sysTick_mask, 0);
+}
+
+void __disable_irq(void) {
+    __set_PRIMASK(1);
+}
+
+void __enable_irq(void) {
+    __set_PRIMASK(0);
+}
+
+
+/*=============================================================================
+**       Serial (replaces utils/serial.c)
+=============================================================================*/
+/* printf() goes straight to stdout, unbuffered like the UART */
+void serial_init(void) {
+    setvbuf(stdout, 0, _IONBF, 0);
+}
+
+/* Runs before main() to set up the port */
+static void port_init(void) {
+    _contexts[0].tcb = OS_idleTCB_p;
+    sigemptyset(&_sysTick_mask);
+    sigaddset(&_sysTick_mask, SIGALRM);
+}
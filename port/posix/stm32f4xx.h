@@ -0,0 +1,173 @@
+#ifndef _PORT_POSIX_STM32F4XX_H_
+#define _PORT_POSIX_STM32F4XX_H_
+
+#include <stdint.h>
+
+/*=============================================================================
+ *  Stand-in for the CMSIS device header used when building DocetOS as a hosted
+ *   POSIX process (see port.c). It is found before the real device header by
+ *   placing port/posix first on the include path, and provides just enough of
+ *   the Cortex-M4 core to run OS/ and OS_UTILS/ unmodified:
+ *       - __svc, __align and __breakpoint compiler keywords
+ *       - SCB, SysTick and CoreDebug as plain structures in memory. Pending
+ *          PendSV by writing SCB->ICSR is picked up by the port on exception
+ *          return, and SysTick_Config() starts a SIGALRM interval timer.
+ *       - DWT->CYCCNT, counting nanoseconds of the host's monotonic clock
+ *       - An emulated exclusive monitor for __LDREXW / __STREXW / __CLREX,
+ *          cleared on every emulated exception entry as on the Cortex-M4
+ *       - PRIMASK, emulated by blocking SIGALRM
+ *       - NVIC->STIR, software triggering the external interrupts port.c has
+ *          handlers for. The interrupt is taken on the next emulated exception
+ *          entry (SVC or SysTick) instead of straight away, and is only taken
+ *          if enabled by NVIC_EnableIRQ() at the time.
+ *  Tickless idle (OS_TICKLESS_IDLE) reprograms the SysTick registers directly,
+ *   and is not supported by the port.
+=============================================================================*/
+
+#ifdef OS_TICKLESS_IDLE
+# error "OS_TICKLESS_IDLE is not supported by the POSIX port."
+#endif
+
+/* Tasks can always access the emulated core peripherals */
+#ifndef OS_PRIVILEGED_TASKS
+# define OS_PRIVILEGED_TASKS
+#endif
+
+/*=============================================================================
+**       Compiler Keywords
+=============================================================================*/
+/* SVC delegates become ordinary functions, defined by port.c */
+#define __svc(x)
+#define __align(x) __attribute__((aligned(x)))
+#define __breakpoint(x) __builtin_trap()
+
+
+/*=============================================================================
+**       Core Peripherals
+=============================================================================*/
+typedef struct {
+    volatile uint32_t CPUID;
+    volatile uint32_t ICSR;
+    volatile uint32_t VTOR;
+    volatile uint32_t AIRCR;
+    volatile uint32_t SCR;
+    volatile uint32_t CCR;
+} SCB_Type;
+
+typedef struct {
+    volatile uint32_t CTRL;
+    volatile uint32_t LOAD;
+    volatile uint32_t VAL;
+    volatile uint32_t CALIB;
+} SysTick_Type;
+
+typedef struct {
+    volatile uint32_t CTRL;
+    volatile uint32_t CYCCNT;
+} DWT_Type;
+
+typedef struct {
+    volatile uint32_t DHCSR;
+    volatile uint32_t DCRSR;
+    volatile uint32_t DCRDR;
+    volatile uint32_t DEMCR;
+} CoreDebug_Type;
+
+typedef struct {
+    volatile uint32_t ISER;
+    volatile uint32_t STIR;
+} NVIC_Type;
+
+typedef enum {
+    PendSV_IRQn  = -2,
+    SysTick_IRQn = -1,
+    EXTI0_IRQn   = 6
+} IRQn_Type;
+
+extern SCB_Type _port_scb;
+extern SysTick_Type _port_systick;
+extern CoreDebug_Type _port_coredebug;
+extern NVIC_Type _port_nvic;
+DWT_Type * port_dwt(void);
+
+#define SCB       (&_port_scb)
+#define SysTick   (&_port_systick)
+#define CoreDebug (&_port_coredebug)
+#define NVIC      (&_port_nvic)
+/* Every access to the DWT samples the host clock into CYCCNT first */
+#define DWT       (port_dwt())
+
+#define SCB_ICSR_PENDSVSET_Msk      (1UL << 28)
+#define SCB_ICSR_PENDSVCLR_Msk      (1UL << 27)
+#define SCB_ICSR_PENDSTSET_Msk      (1UL << 26)
+#define SCB_ICSR_PENDSTCLR_Msk      (1UL << 25)
+#define SCB_CCR_STKALIGN_Msk        (1UL << 9)
+#define SCB_CCR_USERSETMPEND_Msk    (1UL << 1)
+#define SysTick_CTRL_ENABLE_Msk     (1UL << 0)
+#define SysTick_CTRL_TICKINT_Msk    (1UL << 1)
+#define SysTick_CTRL_CLKSOURCE_Msk  (1UL << 2)
+#define SysTick_LOAD_RELOAD_Msk     (0xFFFFFFUL)
+#define DWT_CTRL_CYCCNTENA_Msk      (1UL << 0)
+#define CoreDebug_DEMCR_TRCENA_Msk  (1UL << 24)
+
+/* Clock of the emulated core, at which DWT->CYCCNT counts (1 cycle per ns) */
+extern uint32_t SystemCoreClock;
+
+void SystemCoreClockUpdate(void);
+uint32_t SysTick_Config(uint32_t ticks);
+void NVIC_SetPriority(IRQn_Type IRQn, uint32_t priority);
+void NVIC_EnableIRQ(IRQn_Type IRQn);
+
+
+/*=============================================================================
+**       Intrinsics
+=============================================================================*/
+/* The emulated exclusive monitor, see port.c */
+extern uint32_t volatile * volatile _port_exclusive_address;
+extern volatile uint32_t _port_exclusive_critical;
+extern volatile uint32_t _port_tick_deferred;
+void port_deferredTick(void);
+
+static inline uint32_t __LDREXW(uint32_t volatile * address) {
+    _port_exclusive_address = address;
+    return *address;
+}
+
+/* The check and store must not be split by the SysTick, which is deferred until
+    the store is done. An exception taken before that clears the monitor, failing
+    the store. */
+static inline uint32_t __STREXW(uint32_t value, uint32_t volatile * address) {
+    uint32_t failed = 1;
+    _port_exclusive_critical = 1;
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    if (_port_exclusive_address == address) {
+        *address = value;
+        failed = 0;
+    }
+    _port_exclusive_address = 0;
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    _port_exclusive_critical = 0;
+    if (_port_tick_deferred) {
+        port_deferredTick();
+    }
+    return failed;
+}
+
+static inline void __CLREX(void) {
+    _port_exclusive_address = 0;
+}
+
+static inline uint8_t __CLZ(uint32_t value) {
+    return value ? (uint8_t)__builtin_clz(value) : 32;
+}
+
+#define __DMB() __sync_synchronize()
+#define __DSB() __sync_synchronize()
+#define __ISB() __sync_synchronize()
+
+uint32_t __get_PRIMASK(void);
+void __set_PRIMASK(uint32_t primask);
+void __disable_irq(void);
+void __enable_irq(void);
+
+#endif /* _PORT_POSIX_STM32F4XX_H_ */